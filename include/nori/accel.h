@@ -20,6 +20,7 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 #define __NORI_BVH_H
 
 #include <nori/mesh.h>
+#include <unordered_set>
 
 NORI_NAMESPACE_BEGIN
 
@@ -62,6 +63,18 @@ public:
 	/// Build the BVH
 	void build();
 
+	/// Check whether the BVH has been built (and is not empty)
+	bool isBuilt() const { return !m_nodes.empty(); }
+
+	/**
+	* \brief Remove meshes from the BVH without deleting them
+	*
+	* Used when the meshes are taken over by a reloaded version of the
+	* scene. When a mesh was removed, the BVH is discarded, since it
+	* refers to the removed triangles.
+	*/
+	void releaseMeshes(const std::unordered_set<const Mesh *> &meshes);
+
 	/**
 	* \brief Intersect a ray against all triangle meshes registered
 	* with the BVH
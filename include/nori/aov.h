@@ -0,0 +1,128 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/color.h>
+#include <nori/vector.h>
+#include <vector>
+
+NORI_NAMESPACE_BEGIN
+
+/// Data of the first surface seen by a camera ray
+struct AOVRecord {
+    /// Albedo of the BSDF (zero if the ray escaped)
+    Color3f albedo = Color3f(0.0f);
+    /// Shading normal in world space
+    Normal3f normal = Normal3f(0.0f);
+    /// Distance along the ray
+    float depth = 0.0f;
+    /// Mesh seen by the ray (nullptr if the ray escaped)
+    const Mesh *mesh = nullptr;
+    /// Index of the mesh within the scene (-1 if the ray escaped)
+    int meshID = -1;
+
+    /// Record the surface of an intersection (the mesh ID is set by the renderer)
+    void setSurface(const Intersection &its);
+};
+
+/**
+ * \brief Arbitrary output variables (AOVs) of a rectangular image region
+ *
+ * Stores one plane of floats per channel (structure of arrays) for the
+ * selected set of variables. Albedo, normal and depth are averaged over
+ * all samples of a pixel without applying the reconstruction filter,
+ * while the mesh ID is taken from the first sample of the pixel, i.e.
+ * the one recorded while its sample count was still zero. Since every
+ * pixel belongs to exactly one image block, merging blocks adds their
+ * planes, except for the mesh IDs of pixels that already had samples.
+ */
+class AOVBuffer {
+public:
+    enum EType {
+        EAlbedo = 0,
+        ENormal,
+        EDepth,
+        EMeshID,
+        ESampleCount,
+        ETypeCount
+    };
+
+    /// Allocate planes for a region of the given size and set of variables
+    AOVBuffer(const Vector2i &size, const std::vector<EType> &types);
+
+    /// Convert a name such as "albedo" or "depth" into a variable type
+    static EType typeFromString(const std::string &name);
+
+    /// Return the selected variables
+    const std::vector<EType> &getTypes() const { return m_types; }
+
+    /// Return the size of the region
+    const Vector2i &getSize() const { return m_size; }
+
+    /// Clear all planes
+    void clear();
+
+    /**
+     * \brief Record the variables of a sample
+     *
+     * \param pixel
+     *     Pixel coordinates relative to the region
+     * \param record
+     *     Data of the first surface seen by the sample
+     */
+    void put(const Point2i &pixel, const AOVRecord &record);
+
+    /**
+     * \brief Add a region of another buffer with the same variables
+     *
+     * Pixels that already have samples keep their mesh ID.
+     *
+     * \param other
+     *     Buffer to be added
+     * \param offset
+     *     Position of the other buffer within this one
+     * \param size
+     *     Size of the region of the other buffer that is added
+     */
+    void put(const AOVBuffer &other, const Point2i &offset, const Vector2i &size);
+
+    /// Return the names of the output channels (e.g. "albedo.R")
+    std::vector<std::string> getChannelNames() const;
+
+    /**
+     * \brief Return the normalized planes of all output channels
+     *
+     * The planes are stored one after another in the order of
+     * \ref getChannelNames().
+     */
+    std::vector<float> resolve() const;
+protected:
+    /// Return the first plane of a variable
+    float *plane(int index) { return m_data.data() + (size_t) index * m_size.x() * m_size.y(); }
+    const float *plane(int index) const { return m_data.data() + (size_t) index * m_size.x() * m_size.y(); }
+
+    Vector2i m_size;
+    std::vector<EType> m_types;
+    /// Index of the first plane of every variable (-1 if not selected)
+    int m_planes[ETypeCount];
+    int m_planeCount;
+    std::vector<float> m_data;
+};
+
+NORI_NAMESPACE_END
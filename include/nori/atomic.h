@@ -0,0 +1,41 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/common.h>
+#include <atomic>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Atomically add a value to a floating point variable
+ *
+ * Implemented using a compare-and-swap loop, since <tt>std::atomic<float></tt>
+ * provides no native <tt>fetch_add()</tt> prior to C++20. Contention on a
+ * single variable should be rare for this to be efficient.
+ */
+inline float atomicAdd(std::atomic<float> &dest, float value) {
+    float current = dest.load(std::memory_order_relaxed);
+    while (!dest.compare_exchange_weak(current, current + value,
+                                       std::memory_order_relaxed))
+        ;
+    return current;
+}
+
+NORI_NAMESPACE_END
@@ -23,6 +23,23 @@
 
 NORI_NAMESPACE_BEGIN
 
+/// Options for writing OpenEXR files
+struct EXRSettings {
+    /// Compression methods (in the order of OpenEXR's Imf::Compression)
+    enum ECompression {
+        ENone = 0, ERLE, EZIPS, EZIP, EPIZ, EPXR24, EB44, EB44A, EDWAA, EDWAB
+    };
+
+    /// Compression method (ZIP is OpenEXR's default)
+    ECompression compression = EZIP;
+
+    /// Store 16 bit (half) instead of 32 bit floats
+    bool half = false;
+
+    /// Look up a compression method by name ("none", "zip", "piz", "dwaa", ..)
+    static ECompression compressionFromString(const std::string &name);
+};
+
 /**
  * \brief Stores a RGB high dynamic-range bitmap
  *
@@ -44,11 +61,43 @@ public:
     /// Load an OpenEXR file with the specified filename
     Bitmap(const std::string &filename);
 
-    /// Save the bitmap as an EXR file with the specified filename
-    void saveEXR(const std::string &filename);
+    /**
+     * \brief Save the bitmap as an EXR file with the specified filename
+     *
+     * When given, the output variables (which must have the same size
+     * as the bitmap) are added as further layers of the file.
+     */
+    void saveEXR(const std::string &filename, const AOVBuffer *aovs = nullptr,
+        const EXRSettings &settings = EXRSettings());
 
     /// Save the bitmap as a PNG file (with sRGB tonemapping) with the specified filename
     void savePNG(const std::string &filename);
+
+    /**
+     * \brief Save RGB pixels with an arbitrary memory layout (e.g. those
+     * of an image block) as an EXR file without copying them
+     *
+     * \param filename
+     *     Output file name without the extension
+     * \param size
+     *     Size of the image
+     * \param data
+     *     Pointer to the red component of the upper left pixel
+     * \param pixelStride
+     *     Distance between two pixels of a row in bytes
+     * \param rowStride
+     *     Distance between two rows in bytes
+     * \param aovs
+     *     Output variables written as further layers (may be \c nullptr)
+     * \param settings
+     *     Compression and precision of the file
+     */
+    static void saveEXR(const std::string &filename, const Vector2i &size, const float *data,
+        size_t pixelStride, size_t rowStride, const AOVBuffer *aovs, const EXRSettings &settings);
+
+    /// Save RGB pixels with an arbitrary memory layout as a PNG file (see \ref saveEXR())
+    static void savePNG(const std::string &filename, const Vector2i &size, const float *data,
+        size_t pixelStride, size_t rowStride);
 };
 
 NORI_NAMESPACE_END
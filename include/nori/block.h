@@ -24,9 +24,16 @@
 
 #include <nori/color.h>
 #include <nori/vector.h>
-#include <tbb/mutex.h>
+#include <nori/aov.h>
+#include <tbb/spin_mutex.h>
+#include <tbb/spin_rw_mutex.h>
+#include <memory>
+#include <atomic>
+#include <vector>
 
-#define NORI_BLOCK_SIZE 32 /* Block size used for parallelization */
+#define NORI_BLOCK_SIZE 32 /* Default block size used for parallelization */
+#define NORI_MIN_BLOCK_SIZE 8 /* Smallest block created by splitting the tail of a pass */
+#define NORI_BLOCK_ROWS_PER_LOCK 4 /* Rows that share a lock when merging blocks */
 
 NORI_NAMESPACE_BEGIN
 
@@ -46,6 +53,12 @@ NORI_NAMESPACE_BEGIN
  */
 class ImageBlock : public Eigen::Array<Color4f, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> {
 public:
+    /// Raw sample recorded in deferred mode
+    struct Sample {
+        Point2f position;
+        Color3f value;
+    };
+
     /**
      * Create a new image block of the specified maximum size
      * \param size
@@ -85,21 +98,100 @@ public:
     /// Convert a bitmap into an image block
     void fromBitmap(const Bitmap &bitmap);
 
-    /// Clear all contents
-    void clear() { setConstant(Color4f()); }
+    /**
+     * \brief Divide all pixels by their accumulated filter weight (in place)
+     *
+     * Afterwards, the block can be saved via \ref saveEXR() and \ref
+     * savePNG() without converting it into a bitmap first. No further
+     * samples should be added to a normalized block.
+     */
+    void normalize();
+
+    /// Save a normalized block (and its output variables) as an OpenEXR file
+    void saveEXR(const std::string &filename, const EXRSettings &settings) const;
+
+    /// Save a normalized block as a PNG file (with sRGB tonemapping)
+    void savePNG(const std::string &filename) const;
+
+    /// Clear all contents (including recorded samples and output variables)
+    void clear() {
+        setConstant(Color4f());
+        m_samples.clear();
+        if (m_aovs)
+            m_aovs->clear();
+    }
+
+    /**
+     * \brief Select the output variables recorded besides the color
+     *
+     * Allocates an \ref AOVBuffer covering the block without its
+     * border, which is merged along with the pixels. An empty set
+     * disables the output variables.
+     */
+    void setAOVs(const std::vector<AOVBuffer::EType> &types);
+
+    /// Return the output variables (or \c nullptr if there are none)
+    AOVBuffer *getAOVs() { return m_aovs.get(); }
+
+    /// Return the output variables (or \c nullptr if there are none)
+    const AOVBuffer *getAOVs() const { return m_aovs.get(); }
+
+    /**
+     * \brief Enable or disable deferred reconstruction
+     *
+     * In deferred mode, \ref put() only records the samples, and the
+     * reconstruction filter is applied to all of them at once by
+     * \ref resolve(). Until then, the raw samples are available via
+     * \ref getSamples(), e.g. to store them for refiltering the image
+     * later on. The sample buffer takes space proportional to the block
+     * size times the number of samples per pixel.
+     */
+    void setDeferred(bool deferred) { m_deferred = deferred; }
+
+    /// Are samples recorded instead of being splatted right away?
+    bool isDeferred() const { return m_deferred; }
+
+    /// Return the samples recorded since the last \ref resolve()
+    const std::vector<Sample> &getSamples() const { return m_samples; }
+
+    /// Splat all recorded samples into the block and clear the sample buffer
+    void resolve();
 
     /// Record a sample with the given position and radiance value
     void put(const Point2f &pos, const Color3f &value);
 
+    /**
+     * \brief Record a batch of samples that lie within the same pixel
+     *
+     * The samples are first splatted into a small buffer covering the
+     * filter footprint of the pixel, which is then added to the block
+     * at once. Samples outside of the pixel are ignored.
+     *
+     * \param pixel
+     *     Integer coordinates of the pixel within the main image
+     * \param positions
+     *     Sample positions (as passed to \ref put(const Point2f &, const Color3f &))
+     * \param values
+     *     Radiance values of the samples
+     * \param count
+     *     Number of samples
+     */
+    void put(const Point2i &pixel, const Point2f *positions, const Color3f *values, size_t count);
+
     /**
      * \brief Merge another image block into this one
      *
-     * During the merge operation, this function locks 
-     * the destination block using a mutex.
+     * Several threads may merge blocks at the same time, provided that
+     * the interiors (i.e. the regions without border) of these blocks
+     * don't overlap. Pixels that lie within the filter footprint of a
+     * neighboring block are added under one of several row locks, while
+     * the remaining pixels are owned by the block and added without any
+     * synchronization. Merges wait while the block is locked via
+     * \ref lock(), but don't exclude each other otherwise.
      */
     void put(ImageBlock &b);
 
-    /// Lock the image block (using an internal mutex)
+    /// Lock the image block (waits for merges in progress to finish)
     inline void lock() const { m_mutex.lock(); }
     
     /// Unlock the image block
@@ -108,6 +200,23 @@ public:
     /// Return a human-readable string summary
     std::string toString() const;
 protected:
+    /**
+     * \brief Splat a sample into a raster that covers a region of the block
+     *
+     * \param pos
+     *     Sample position in the pixel coordinates of the block
+     * \param value
+     *     Sample value (with a weight of one)
+     * \param target
+     *     Row-major raster that receives the sample
+     * \param origin
+     *     Block pixel that corresponds to the first entry of \c target
+     * \param size
+     *     Size of the raster; pixels outside of it are skipped
+     */
+    void splat(const Point2f &pos, const Color4f &value, Color4f *target,
+        const Point2i &origin, const Vector2i &size);
+
     Point2i m_offset;
     Vector2i m_size;
     int m_borderSize = 0;
@@ -116,27 +225,63 @@ protected:
     float *m_weightsX = nullptr;
     float *m_weightsY = nullptr;
     float m_lookupFactor = 0;
-    mutable tbb::mutex m_mutex;
+    /// Radius (in pixels) of the filter footprint of a pixel
+    int m_footprintRadius = 0;
+    /// Footprint buffer used by the batched \ref put()
+    Eigen::Array<Color4f, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> m_footprint;
+    /// Samples recorded in deferred mode
+    std::vector<Sample> m_samples;
+    bool m_deferred = false;
+    std::unique_ptr<AOVBuffer> m_aovs;
+    /// Held exclusively by \ref lock() and shared by concurrent merges
+    mutable tbb::spin_rw_mutex m_mutex;
+    /// Locks of the rows touched by overlapping merges (one per stripe of rows)
+    std::unique_ptr<tbb::spin_mutex[]> m_rowLocks;
 };
 
 /**
- * \brief Spiraling block generator
+ * \brief Block generator
  *
  * This class can be used to chop up an image into many small
- * rectangular blocks suitable for parallel rendering. The blocks
- * are ordered in spiraling pattern so that the center is
- * rendered first.
+ * rectangular blocks suitable for parallel rendering. The order of
+ * the blocks is computed once at construction time, after which
+ * blocks are handed out using a single atomic increment. By default,
+ * the blocks are ordered in a spiraling pattern so that the center is
+ * rendered first; space-filling curves (Hilbert, Morton) instead keep
+ * consecutive blocks close to each other, which improves the cache
+ * locality of the scene data accessed by neighboring threads.
+ *
+ * Since the cost of the blocks varies a lot, the last blocks to be
+ * handed out are recursively split into quadrants (down to
+ * \ref NORI_MIN_BLOCK_SIZE), so that the threads finish at roughly the
+ * same time instead of waiting for a few expensive blocks.
  */
 class BlockGenerator {
 public:
+    /// Supported block orders
+    enum EOrder { ESpiral = 0, EScanline, EHilbert, EMorton };
+
     /**
      * \brief Create a block generator with
      * \param size
      *      Size of the image that should be split into blocks
      * \param blockSize
      *      Maximum size of the individual blocks
+     * \param order
+     *      Order in which the blocks are handed out
+     * \param tailSize
+     *      Number of blocks at the end of the order that are split into
+     *      smaller ones (repeatedly, so that the last \c tailSize blocks
+     *      all have the minimum size). Zero disables splitting.
+     * \param firstTile
+     *      Index of the first block that is handed out, counting the
+     *      blocks of the image in scanline order
+     * \param lastTile
+     *      Index one past the last block that is handed out (-1: up to
+     *      the last block of the image)
      */
-    BlockGenerator(const Vector2i &size, int blockSize);
+    BlockGenerator(const Vector2i &size, int blockSize,
+        EOrder order = ESpiral, int tailSize = 0, int firstTile = 0, int lastTile = -1);
     
     /**
      * \brief Return the next block to be rendered
@@ -148,19 +293,42 @@ public:
     bool next(ImageBlock &block);
 
     /// Return the total number of blocks
-    int getBlockCount() const { return m_blocksLeft; }
+    int getBlockCount() const { return (int) m_blocks.size(); }
+
+    /// Look up a block order by name ("spiral", "scanline", "hilbert" or "morton")
+    static EOrder orderFromString(const std::string &name);
 protected:
     enum EDirection { ERight = 0, EDown, ELeft, EUp };
 
-    Point2i m_block;
+    /// Append the blocks along a center-out spiral
+    void generateSpiral();
+
+    /// Append the blocks along a Hilbert curve covering the block grid
+    void generateHilbert();
+
+    /// Append the blocks in Morton (Z-curve) order
+    void generateMorton();
+
+    /// Recursively split the last \c tailSize blocks into quadrants
+    void splitTail(int tailSize);
+
+    /// Rectangular region of the image
+    struct Block {
+        Point2i offset;
+        Vector2i size;
+    };
+
+    /// Append the block at the given position of the block grid
+    void append(const Point2i &block);
+
     Vector2i m_numBlocks;
     Vector2i m_size;
     int m_blockSize;
-    int m_numSteps;
-    int m_blocksLeft;
-    int m_stepsLeft;
-    int m_direction;
-    tbb::mutex m_mutex;
+    /// Range of blocks (in scanline order) that are handed out
+    int m_firstTile, m_lastTile;
+    /// Blocks in the order in which they are handed out
+    std::vector<Block> m_blocks;
+    std::atomic<int> m_next;
 };
 
 NORI_NAMESPACE_END
@@ -110,6 +110,13 @@ public:
      * or not to store photons on a surface
      */
     virtual bool isDiffuse() const { return false; }
+
+    /**
+     * \brief Return the albedo (i.e. the overall reflectance) of the
+     * BSDF, which is written as an output variable. Smooth specular
+     * materials report a value of one.
+     */
+    virtual Color3f getAlbedo() const { return Color3f(1.0f); }
 };
 
 NORI_NAMESPACE_END
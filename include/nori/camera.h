@@ -57,6 +57,47 @@ public:
         const Point2f &samplePosition,
         const Point2f &apertureSample) const = 0;
 
+    /**
+     * \brief Sample a connection from a reference point to the camera
+     *
+     * This is the adjoint of \ref sampleRay() and is needed by integrators
+     * that trace paths starting from the light sources.
+     *
+     * \param ref
+     *    Reference point in world space
+     *
+     * \param samplePosition
+     *    On success, the fractional pixel coordinates at which the
+     *    reference point is seen by the camera
+     *
+     * \param wi
+     *    On success, the normalized direction from \c ref to the camera
+     *
+     * \param dist
+     *    On success, the distance between \c ref and the camera
+     *
+     * \param pdf
+     *    On success, the density of the sampled direction with respect
+     *    to solid angles at \c ref
+     *
+     * \return
+     *    The importance emitted by the camera towards \c ref, or zero if
+     *    the point is not visible on the image plane
+     */
+    virtual Color3f sampleImportance(const Point3f &ref, Point2f &samplePosition,
+            Vector3f &wi, float &dist, float &pdf) const {
+        throw NoriException("Camera::sampleImportance(): not supported by %s!", toString());
+    }
+
+    /**
+     * \brief Return the densities with which \ref sampleRay() generates
+     * the given ray: \c pdfPos with respect to area on the aperture and
+     * \c pdfDir with respect to solid angles
+     */
+    virtual void pdfRay(const Ray3f &ray, float &pdfPos, float &pdfDir) const {
+        throw NoriException("Camera::pdfRay(): not supported by %s!", toString());
+    }
+
     /// Return the size of the output image in pixels
     const Vector2i &getOutputSize() const { return m_outputSize; }
 
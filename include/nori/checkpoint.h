@@ -0,0 +1,110 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/render.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Snapshot of an in-progress render
+ *
+ * Holds the raw contents of the full-frame image block (the weighted,
+ * unnormalized RGB sums and the accumulated filter weight, including the
+ * border region), the number of samples per pixel rendered so far and,
+ * when sampling adaptively, the per-pixel sample statistics. Since the
+ * samples only depend on the pixel, the sample index and the sampler
+ * configuration, this is all it takes to continue a render later on.
+ *
+ * Checkpoints are stored as OpenEXR files with the channels R, G, B and
+ * W (plus N, skipped, mean and m2 for the statistics), whose data window
+ * extends beyond the display window by the border size.
+ */
+class RenderCheckpoint {
+public:
+    /**
+     * \brief Capture the state of a render
+     *
+     * The image block is locked while its contents are being copied.
+     *
+     * \param block
+     *     Full-frame image block that receives the samples
+     * \param statistics
+     *     Per-pixel statistics of adaptive sampling (may be empty)
+     * \param sampleCount
+     *     Number of samples per pixel rendered so far
+     * \param samplerInfo
+     *     Description of the sampler, which must match when resuming
+     */
+    RenderCheckpoint(const ImageBlock &block, const std::vector<PixelStatistics> &statistics,
+        uint32_t sampleCount, const std::string &samplerInfo);
+
+    /// Load a checkpoint from an OpenEXR file
+    RenderCheckpoint(const std::string &filename);
+
+    /**
+     * \brief Write the checkpoint to an OpenEXR file
+     *
+     * The data is first written to a temporary file that then replaces
+     * the destination, so that an interrupted write never destroys the
+     * previous checkpoint.
+     */
+    void save(const std::string &filename) const;
+
+    /**
+     * \brief Copy the checkpoint into an image block and statistics buffer
+     *
+     * Throws an exception when their dimensions don't match.
+     */
+    void restore(ImageBlock &block, std::vector<PixelStatistics> &statistics) const;
+
+    /**
+     * \brief Add the pixels of another checkpoint (e.g. of a different
+     * part of a distributed render)
+     *
+     * The statistics of adaptive sampling are discarded, since they
+     * can't be combined.
+     */
+    void add(const RenderCheckpoint &other);
+
+    /// Turn the checkpoint into a normalized bitmap (without the border)
+    Bitmap *toBitmap() const;
+
+    /// Return the number of samples per pixel rendered so far
+    uint32_t getSampleCount() const { return m_sampleCount; }
+
+    /// Return the description of the sampler that rendered the samples
+    const std::string &getSamplerInfo() const { return m_samplerInfo; }
+protected:
+    /// Return the number of pixels including the border region
+    size_t getPixelCount() const {
+        return (size_t) (m_size.x() + 2 * m_borderSize) * (size_t) (m_size.y() + 2 * m_borderSize);
+    }
+
+    Vector2i m_size;
+    int m_borderSize;
+    /// RGBW values of all pixels including the border
+    std::vector<float> m_pixels;
+    /// Statistics of all pixels including the (unused) border
+    std::vector<PixelStatistics> m_statistics;
+    uint32_t m_sampleCount;
+    std::string m_samplerInfo;
+};
+
+NORI_NAMESPACE_END
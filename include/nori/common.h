@@ -49,6 +49,9 @@
 /* "Ray epsilon": relative error threshold for ray intersection computations */
 #define Epsilon 1e-4f
 
+/* Largest float that is strictly smaller than one (keeps samples in [0, 1)) */
+#define OneMinusEpsilon 0.99999994f
+
 /* A few useful constants */
 #undef M_PI
 
@@ -117,15 +120,19 @@ typedef TRay<Point2f, Vector2f> Ray2f;
 typedef TRay<Point3f, Vector3f> Ray3f;
 
 /// Some more forward declarations
+class AOVBuffer;
+struct AOVRecord;
 class BSDF;
 class Bitmap;
 class BlockGenerator;
 class Camera;
 class ImageBlock;
 class Integrator;
+struct Intersection;
 class KDTree;
 class Emitter;
 struct EmitterQueryRecord;
+struct EXRSettings;
 class Mesh;
 class NoriObject;
 class NoriObjectFactory;
@@ -27,6 +27,13 @@ NORI_NAMESPACE_BEGIN
  * 
  * This data structure can be used to transform uniformly distributed
  * samples to a stored discrete probability distribution.
+ *
+ * Once \ref normalize() has been called, sampling uses an alias table
+ * (Walker's method, constructed using Vose's algorithm) and runs in
+ * constant time regardless of the number of entries. The cumulative
+ * distribution is still kept around to answer \ref operator[] queries.
+ * It is accumulated in double precision: with millions of entries, the
+ * differences of a float CDF near one would be off by several percent.
  * 
  * \ingroup libcore
  */
@@ -41,7 +48,8 @@ public:
     /// Clear all entries
     void clear() {
         m_cdf.clear();
-        m_cdf.push_back(0.0f);
+        m_cdf.push_back(0.0);
+        m_alias.clear();
         m_normalized = false;
     }
 
@@ -52,7 +60,7 @@ public:
 
     /// Append an entry with the specified discrete probability
     void append(float pdfValue) {
-        m_cdf.push_back(m_cdf[m_cdf.size()-1] + pdfValue);
+        m_cdf.push_back(m_cdf[m_cdf.size()-1] + (double) pdfValue);
     }
 
     /// Return the number of entries so far
@@ -62,7 +70,7 @@ public:
 
     /// Access an entry by its index
     float operator[](size_t entry) const {
-        return m_cdf[entry+1] - m_cdf[entry];
+        return (float) (m_cdf[entry+1] - m_cdf[entry]);
     }
 
     /// Have the probability densities been normalized?
@@ -94,12 +102,14 @@ public:
      * \return Sum of the (previously unnormalized) entries
      */
     float normalize() {
-        m_sum = m_cdf[m_cdf.size()-1];
-        if (m_sum > 0) {
-            m_normalization = 1.0f / m_sum;
+        double sum = m_cdf[m_cdf.size()-1];
+        m_sum = (float) sum;
+        if (sum > 0) {
+            m_normalization = (float) (1.0 / sum);
+            buildAliasTable(sum);
             for (size_t i=1; i<m_cdf.size(); ++i) 
-                m_cdf[i] *= m_normalization;
-            m_cdf[m_cdf.size()-1] = 1.0f;
+                m_cdf[i] /= sum;
+            m_cdf[m_cdf.size()-1] = 1.0;
             m_normalized = true;
         } else {
             m_normalization = 0.0f;
@@ -116,10 +126,8 @@ public:
      *     The discrete index associated with the sample
      */
     size_t sample(float sampleValue) const {
-        std::vector<float>::const_iterator entry = 
-                std::lower_bound(m_cdf.begin(), m_cdf.end(), sampleValue);
-        size_t index = (size_t) std::max((ptrdiff_t) 0, entry - m_cdf.begin() - 1);
-        return std::min(index, m_cdf.size()-2);
+        float pdf;
+        return sample(sampleValue, pdf);
     }
 
     /**
@@ -133,9 +141,7 @@ public:
      *     The discrete index associated with the sample
      */
     size_t sample(float sampleValue, float &pdf) const {
-        size_t index = sample(sampleValue);
-        pdf = operator[](index);
-        return index;
+        return sampleReuse(sampleValue, pdf);
     }
 
     /**
@@ -149,10 +155,8 @@ public:
      *     The discrete index associated with the sample
      */
     size_t sampleReuse(float &sampleValue) const {
-        size_t index = sample(sampleValue);
-        sampleValue = (sampleValue - m_cdf[index])
-            / (m_cdf[index + 1] - m_cdf[index]);
-        return index;
+        float pdf;
+        return sampleReuse(sampleValue, pdf);
     }
 
     /**
@@ -168,10 +172,26 @@ public:
      *     The discrete index associated with the sample
      */
     size_t sampleReuse(float &sampleValue, float &pdf) const {
-        size_t index = sample(sampleValue, pdf);
-        sampleValue = (sampleValue - m_cdf[index])
-            / (m_cdf[index + 1] - m_cdf[index]);
-        return index;
+        if (m_alias.empty())
+            return sampleReuseCDF(sampleValue, pdf);
+
+        /* Pick a bucket, then decide between it and its alias. The
+           fractional part of the scaled sample drives the second choice */
+        size_t size = m_alias.size();
+        float scaled = sampleValue * (float) size;
+        size_t bucket = std::min((size_t) scaled, size - 1);
+        float u = std::min(scaled - (float) bucket, OneMinusEpsilon);
+
+        const AliasEntry &entry = m_alias[bucket];
+        if (u < entry.prob) {
+            sampleValue = u / entry.prob;
+            pdf = entry.pdf;
+            return bucket;
+        } else {
+            sampleValue = std::min((u - entry.prob) / (1.0f - entry.prob), OneMinusEpsilon);
+            pdf = entry.aliasPdf;
+            return entry.alias;
+        }
     }
 
     /**
@@ -190,7 +210,76 @@ public:
         return result + "}]";
     }
 private:
-    std::vector<float> m_cdf;
+    /// Alias table entry, packed so that a lookup touches a single cache line
+    struct AliasEntry {
+        float prob;      ///< Probability of keeping this bucket
+        uint32_t alias;  ///< Index that is returned otherwise
+        float pdf;       ///< Probability of this bucket's own entry
+        float aliasPdf;  ///< Probability of the alias entry
+    };
+
+    /// Build the alias table from the unnormalized CDF using Vose's algorithm
+    void buildAliasTable(double sum) {
+        size_t n = size();
+        m_alias.resize(n);
+
+        std::vector<double> scaled(n);
+        std::vector<uint32_t> small, large;
+        small.reserve(n);
+        large.reserve(n);
+
+        for (size_t i=0; i<n; ++i) {
+            double weight = m_cdf[i+1] - m_cdf[i];
+            scaled[i] = weight * ((double) n / sum);
+            m_alias[i].pdf = (float) (weight / sum);
+            if (scaled[i] < 1.0)
+                small.push_back((uint32_t) i);
+            else
+                large.push_back((uint32_t) i);
+        }
+
+        while (!small.empty() && !large.empty()) {
+            uint32_t s = small.back(); small.pop_back();
+            uint32_t l = large.back();
+
+            m_alias[s].prob = (float) scaled[s];
+            m_alias[s].alias = l;
+            scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+
+            if (scaled[l] < 1.0) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+
+        /* Whatever remains is (up to round-off) exactly one */
+        for (uint32_t i : large) {
+            m_alias[i].prob = 1.0f;
+            m_alias[i].alias = i;
+        }
+        for (uint32_t i : small) {
+            m_alias[i].prob = 1.0f;
+            m_alias[i].alias = i;
+        }
+
+        for (size_t i=0; i<n; ++i)
+            m_alias[i].aliasPdf = m_alias[m_alias[i].alias].pdf;
+    }
+
+    /// Fallback: binary search over the CDF (used before \ref normalize())
+    size_t sampleReuseCDF(float &sampleValue, float &pdf) const {
+        std::vector<double>::const_iterator entry = 
+                std::lower_bound(m_cdf.begin(), m_cdf.end(), (double) sampleValue);
+        size_t index = (size_t) std::max((ptrdiff_t) 0, entry - m_cdf.begin() - 1);
+        index = std::min(index, m_cdf.size()-2);
+        pdf = operator[](index);
+        sampleValue = (float) ((sampleValue - m_cdf[index])
+            / (m_cdf[index + 1] - m_cdf[index]));
+        return index;
+    }
+
+    std::vector<double> m_cdf;
+    std::vector<AliasEntry> m_alias;
     float m_sum, m_normalization;
     bool m_normalized;
 };
@@ -39,6 +39,56 @@ public:
     /// Perform an (optional) preprocess step
     virtual void preprocess(const Scene *scene) { }
 
+    /**
+     * \brief Does the preprocess step depend on the scene's active camera?
+     *
+     * Integrators that learn from camera paths (e.g. path guiding) return
+     * \c true, so that they are preprocessed again for every camera when
+     * rendering several cameras of a scene.
+     */
+    virtual bool preprocessDependsOnCamera() const { return false; }
+
+    /**
+     * \brief Perform an (optional) postprocess step
+     *
+     * This is called once after all image blocks have been rendered and
+     * can be used to add contributions that were not returned by \ref Li()
+     * (e.g. the light tracing strategies of a bidirectional path tracer)
+     * to the (not yet normalized) output image.
+     */
+    virtual void postprocess(const Scene *scene, ImageBlock &result) { }
+
+    /**
+     * \brief Render the entire image (optional)
+     *
+     * Integrators that cannot be expressed as independent per-pixel radiance
+     * estimates (e.g. progressive photon mapping, which alternates between
+     * camera and photon passes) can override this function to take over
+     * image synthesis. The implementation must lock \c result while
+     * writing to it, since it is concurrently displayed by the preview.
+     *
+     * \return \c false if the default block-based renderer (which
+     *     calls \ref Li() for every pixel sample) should be used instead
+     */
+    virtual bool render(const Scene *scene, ImageBlock &result) { return false; }
+
+    /**
+     * \brief Does \ref render() take over image synthesis?
+     *
+     * Allows the renderer to reject options that only the block-based
+     * renderer supports (such as output variables) before rendering.
+     */
+    virtual bool overridesRender() const { return false; }
+
+    /**
+     * \brief Does the integrator need the entire image at once?
+     *
+     * Integrators that override \ref render() or \ref postprocess()
+     * must return \c true, since the renderer can't stream their
+     * output tile by tile in that case.
+     */
+    virtual bool requiresFullImage() const { return false; }
+
     /**
      * \brief Sample the incident radiance along a ray
      *
@@ -53,6 +103,18 @@ public:
      */
     virtual Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const = 0;
 
+    /**
+     * \brief Sample the incident radiance along a camera ray and record
+     * the first surface that it hits
+     *
+     * Used when rendering output variables (AOVs). The default
+     * implementation intersects the ray once more before calling
+     * \ref Li(). Integrators that find the first surface anyway should
+     * override this and fill in \c record from their own intersection.
+     */
+    virtual Color3f LiAOV(const Scene *scene, Sampler *sampler, const Ray3f &ray,
+        AOVRecord &record) const;
+
     /**
      * \brief Return the type of object (i.e. Mesh/BSDF/etc.) 
      * provided by this instance
@@ -0,0 +1,119 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/bbox.h>
+#include <nori/color.h>
+#include <nori/frame.h>
+#include <tbb/spin_rw_mutex.h>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Irradiance cache (Ward et al. 1988, Ward and Heckbert 1992)
+ *
+ * Stores sparse records of the cosine-weighted average of the incident
+ * radiance over the hemisphere (i.e. irradiance divided by pi; for ambient
+ * occlusion this is simply the unoccluded fraction) together with its
+ * rotational and translational gradients. Queries interpolate all records
+ * whose validity region covers the query point; if there are none, the
+ * caller computes a new record using stratified hemisphere sampling via
+ * \ref createRecord() and inserts it.
+ *
+ * Records are organized in an octree that can be shared between threads:
+ * lookups acquire a reader lock and insertions a writer lock.
+ */
+class IrradianceCache {
+public:
+    /// A single cache record
+    struct Record {
+        Point3f p;
+        Normal3f n;
+        /// Harmonic mean distance to the surrounding geometry (validity radius)
+        float radius;
+        Color3f value;
+        /// Per-channel gradients with respect to rotation and translation
+        Vector3f rotGradient[3];
+        Vector3f transGradient[3];
+    };
+
+    /**
+     * \brief Create a new cache
+     *
+     * \param bbox
+     *     Region that will receive records (usually the scene bounds)
+     * \param accuracy
+     *     Maximum interpolation error of a record (Ward's \a a)
+     * \param minSpacing, maxSpacing
+     *     Bounds of the record validity radius relative to the size of \c bbox
+     */
+    IrradianceCache(const BoundingBox3f &bbox, float accuracy,
+                    float minSpacing, float maxSpacing);
+
+    ~IrradianceCache();
+
+    /**
+     * \brief Interpolate the cached records at the point \c p with normal \c n
+     * \return \c false if no record is valid at this point
+     */
+    bool lookup(const Point3f &p, const Normal3f &n, Color3f &result) const;
+
+    /// Insert a record into the cache (thread-safe)
+    void insert(const Record &record);
+
+    /**
+     * \brief Return the direction at the center of the stratum \c (j, k),
+     * jittered by \c sample, of an \c M x \c N stratified cosine-weighted
+     * hemisphere sampling in local coordinates
+     */
+    static Vector3f sampleStratum(int j, int k, int M, int N, const Point2f &sample);
+
+    /**
+     * \brief Turn the result of a stratified hemisphere sampling into a record
+     *
+     * \param L
+     *     Incident radiance of the stratum \c (j, k), stored at <tt>L[j*N+k]</tt>
+     * \param dist
+     *     Distance to the surface hit by the sample (infinity if none)
+     */
+    Record createRecord(const Point3f &p, const Frame &frame, int M, int N,
+                        const Color3f *L, const float *dist) const;
+
+    /// Return the number of stored records
+    size_t getRecordCount() const { return m_recordCount; }
+
+    /// Return a human-readable summary
+    std::string toString() const;
+
+private:
+    struct Node;
+
+    void insert(Node *node, const BoundingBox3f &bounds, const Record &record,
+                const BoundingBox3f &extent, float size, int depth);
+
+    BoundingBox3f m_bbox;
+    float m_accuracy;
+    float m_minRadius, m_maxRadius;
+    std::unique_ptr<Node> m_root;
+    size_t m_recordCount = 0;
+    mutable tbb::spin_rw_mutex m_mutex;
+};
+
+NORI_NAMESPACE_END
@@ -0,0 +1,241 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/bbox.h>
+#include <tbb/parallel_invoke.h>
+#include <algorithm>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Left-balanced kd-tree for point data (e.g. photons)
+ *
+ * The tree is stored implicitly in heap order: the children of node \c i
+ * are found at indices <tt>2i+1</tt> and <tt>2i+2</tt>, hence no child
+ * pointers are needed. Positions are kept in separate per-axis arrays
+ * (structure of arrays), so that traversal only touches the coordinates
+ * and the payload of type \c T is loaded for accepted points only.
+ */
+template <typename T> class PointKDTree {
+public:
+    /// Result record of a nearest neighbor query
+    struct SearchResult {
+        uint32_t index;
+        float dist2;
+
+        bool operator<(const SearchResult &r) const { return dist2 < r.dist2; }
+    };
+
+    /// Return the number of stored points
+    size_t size() const { return m_data.size(); }
+
+    /// Return the payload associated with the node \c index
+    const T &operator[](size_t index) const { return m_data[index]; }
+
+    /// Return the position associated with the node \c index
+    Point3f getPosition(size_t index) const {
+        return Point3f(m_pos[0][index], m_pos[1][index], m_pos[2][index]);
+    }
+
+    /// Return the amount of memory used by the tree in bytes
+    size_t getMemoryUsage() const {
+        return m_data.size() * (sizeof(T) + 3 * sizeof(float) + sizeof(uint8_t));
+    }
+
+    /// Release all memory
+    void clear() {
+        m_data.clear(); m_data.shrink_to_fit();
+        m_axis.clear(); m_axis.shrink_to_fit();
+        for (int i = 0; i < 3; ++i) {
+            m_pos[i].clear(); m_pos[i].shrink_to_fit();
+        }
+    }
+
+    /**
+     * \brief Build the tree from a set of points and associated payloads
+     *
+     * Both arrays must have the same size; they are consumed in the
+     * process. Large subtrees are built in parallel.
+     */
+    void build(std::vector<Point3f> &positions, std::vector<T> &data) {
+        if (positions.size() != data.size())
+            throw NoriException("PointKDTree::build(): size mismatch!");
+        size_t n = positions.size();
+        m_data.resize(n);
+        m_axis.resize(n);
+        for (int i = 0; i < 3; ++i)
+            m_pos[i].resize(n);
+
+        std::vector<uint32_t> indices(n);
+        for (size_t i = 0; i < n; ++i)
+            indices[i] = (uint32_t) i;
+
+        build(0, indices.data(), indices.data() + n, positions, data);
+    }
+
+    /**
+     * \brief Invoke \c functor(index, dist2) for every point within
+     * distance \c radius of \c p
+     */
+    template <typename Functor> void search(const Point3f &p, float radius, Functor functor) const {
+        if (m_data.empty())
+            return;
+        float radius2 = radius * radius;
+        uint32_t stack[64];
+        int stackPos = 0;
+        stack[stackPos++] = 0;
+
+        while (stackPos > 0) {
+            uint32_t node = stack[--stackPos];
+            int axis = m_axis[node];
+            float d = p[axis] - m_pos[axis][node];
+
+            uint32_t left = 2 * node + 1, right = left + 1;
+            uint32_t nearChild = d < 0 ? left : right, farChild = d < 0 ? right : left;
+            if (farChild < m_data.size() && d * d < radius2)
+                stack[stackPos++] = farChild;
+            if (nearChild < m_data.size())
+                stack[stackPos++] = nearChild;
+
+            float dist2 = distance2(p, node);
+            if (dist2 < radius2)
+                functor((uint32_t) node, dist2);
+        }
+    }
+
+    /**
+     * \brief Find the (up to) \c k nearest points to \c p within distance
+     * \c maxRadius
+     *
+     * \param results
+     *     Storage for at least \c k entries. On return, the entries form
+     *     a max-heap with respect to the distance, i.e. <tt>results[0]</tt>
+     *     is the farthest of the found points.
+     * \return The number of points that were found
+     */
+    size_t nearest(const Point3f &p, float maxRadius, size_t k, SearchResult *results) const {
+        if (m_data.empty() || k == 0)
+            return 0;
+        float radius2 = maxRadius * maxRadius;
+        size_t found = 0;
+
+        struct Entry { uint32_t node; float planeDist2; };
+        Entry stack[64];
+        int stackPos = 0;
+        stack[stackPos++] = { 0, 0.0f };
+
+        while (stackPos > 0) {
+            Entry entry = stack[--stackPos];
+            if (entry.planeDist2 >= radius2)
+                continue;
+            uint32_t node = entry.node;
+            int axis = m_axis[node];
+            float d = p[axis] - m_pos[axis][node];
+
+            /* Push the far child first, so that the near one is visited next */
+            uint32_t left = 2 * node + 1, right = left + 1;
+            uint32_t nearChild = d < 0 ? left : right, farChild = d < 0 ? right : left;
+            if (farChild < m_data.size())
+                stack[stackPos++] = { farChild, d * d };
+            if (nearChild < m_data.size())
+                stack[stackPos++] = { nearChild, entry.planeDist2 };
+
+            float dist2 = distance2(p, node);
+            if (dist2 >= radius2)
+                continue;
+
+            if (found < k) {
+                results[found++] = { node, dist2 };
+                std::push_heap(results, results + found);
+                if (found == k)
+                    radius2 = results[0].dist2;
+            } else {
+                std::pop_heap(results, results + k);
+                results[k - 1] = { node, dist2 };
+                std::push_heap(results, results + k);
+                radius2 = results[0].dist2;
+            }
+        }
+        return found;
+    }
+
+protected:
+    float distance2(const Point3f &p, uint32_t node) const {
+        float dx = p.x() - m_pos[0][node],
+              dy = p.y() - m_pos[1][node],
+              dz = p.z() - m_pos[2][node];
+        return dx * dx + dy * dy + dz * dz;
+    }
+
+    /// Number of nodes in the left subtree of a left-balanced tree with \c n nodes
+    static size_t leftSubtreeSize(size_t n) {
+        if (n <= 1)
+            return 0;
+        size_t fullLevels = 1;
+        while (2 * fullLevels + 1 <= n)
+            fullLevels = 2 * fullLevels + 1;
+        /* 'fullLevels' nodes fill the complete upper levels; the remainder
+           occupies the last level from the left */
+        size_t halfLastLevel = (fullLevels + 1) / 2;
+        return (fullLevels - 1) / 2 + std::min(n - fullLevels, halfLastLevel);
+    }
+
+    void build(uint32_t node, uint32_t *start, uint32_t *end,
+               const std::vector<Point3f> &positions, std::vector<T> &data) {
+        size_t n = (size_t) (end - start);
+        if (n == 0)
+            return;
+
+        /* Split along the axis of largest extent */
+        BoundingBox3f bbox;
+        for (uint32_t *it = start; it != end; ++it)
+            bbox.expandBy(positions[*it]);
+        int axis = bbox.getMajorAxis();
+
+        uint32_t *median = start + leftSubtreeSize(n);
+        std::nth_element(start, median, end, [&](uint32_t a, uint32_t b) {
+            return positions[a][axis] < positions[b][axis];
+        });
+
+        const Point3f &p = positions[*median];
+        for (int i = 0; i < 3; ++i)
+            m_pos[i][node] = p[i];
+        m_axis[node] = (uint8_t) axis;
+        m_data[node] = std::move(data[*median]);
+
+        uint32_t left = 2 * node + 1, right = left + 1;
+        if (n > 1024) {
+            tbb::parallel_invoke(
+                [&] { build(left, start, median, positions, data); },
+                [&] { build(right, median + 1, end, positions, data); }
+            );
+        } else {
+            build(left, start, median, positions, data);
+            build(right, median + 1, end, positions, data);
+        }
+    }
+
+private:
+    std::vector<float> m_pos[3];
+    std::vector<uint8_t> m_axis;
+    std::vector<T> m_data;
+};
+
+NORI_NAMESPACE_END
@@ -0,0 +1,107 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/common.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Helper functions shared by the low-discrepancy samplers
+ *
+ * Besides the construction of the sequences themselves, this contains
+ * integer hashing used to derive statistically independent scrambling
+ * seeds for every pixel and dimension.
+ */
+namespace LowDiscrepancy {
+    /// Finalizer of the MurmurHash3 64 bit hash (good avalanche behavior)
+    inline uint64_t mixBits(uint64_t v) {
+        v ^= v >> 33;
+        v *= 0xff51afd7ed558ccdULL;
+        v ^= v >> 33;
+        v *= 0xc4ceb9fe1a85ec53ULL;
+        v ^= v >> 33;
+        return v;
+    }
+
+    /// Combine two values into a hash
+    inline uint64_t hash(uint64_t a, uint64_t b) {
+        return mixBits(a ^ mixBits(b + 0x9e3779b97f4a7c15ULL));
+    }
+
+    /// Combine three values into a hash
+    inline uint64_t hash(uint64_t a, uint64_t b, uint64_t c) {
+        return hash(hash(a, b), c);
+    }
+
+    /// Reverse the order of the bits of a 32 bit integer
+    inline uint32_t reverseBits(uint32_t v) {
+        v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+        v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+        v = ((v >> 4) & 0x0F0F0F0Fu) | ((v & 0x0F0F0F0Fu) << 4);
+        v = ((v >> 8) & 0x00FF00FFu) | ((v & 0x00FF00FFu) << 8);
+        return (v >> 16) | (v << 16);
+    }
+
+    /**
+     * \brief Nested uniform (Owen) scrambling of a 32 bit fixed point value
+     *
+     * Uses the hash-based construction of Laine and Karras as improved by
+     * Burley ("Practical Hash-based Owen Scrambling", JCGT 2020): higher
+     * bits only ever influence lower ones after the bit reversal.
+     */
+    inline uint32_t nestedUniformScramble(uint32_t v, uint32_t seed) {
+        v = reverseBits(v);
+        v += seed;
+        v ^= v * 0x6c50b47cu;
+        v ^= v * 0xb82f1e52u;
+        v ^= v * 0xc7afe638u;
+        v ^= v * 0x8d22f6e6u;
+        return reverseBits(v);
+    }
+
+    /// Convert a 32 bit fixed point value into a float on [0, 1)
+    inline float toFloat(uint32_t v) {
+        return std::min(v * (1.0f / 4294967296.0f), OneMinusEpsilon);
+    }
+
+    /**
+     * \brief Number of dimensions of the Sobol sequence provided by \ref sobol()
+     *
+     * The first two dimensions form a (0, 2)-sequence in base 2; higher
+     * dimensional samples are obtained by padding independently scrambled
+     * copies of these (Burley 2020), which avoids the poor 2D projections
+     * of higher Sobol dimensions.
+     */
+    const int SobolDimensions = 2;
+
+    /**
+     * \brief Return component \c dim of the point \c index of the Sobol
+     * sequence as a 32 bit fixed point value
+     */
+    extern uint32_t sobol(uint32_t index, int dim);
+
+    /// Return the \c i-th prime number (up to \ref PrimeCount)
+    extern uint32_t prime(int i);
+
+    /// Number of primes available through \ref prime()
+    const int PrimeCount = 256;
+}
+
+NORI_NAMESPACE_END
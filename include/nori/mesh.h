@@ -165,6 +165,25 @@ public:
     /// Register a child object (e.g. a BSDF) with the mesh
     virtual void addChild(NoriObject *child);
 
+    /**
+     * \brief Delete the BSDF and the emitter
+     *
+     * Allows registering new ones when an unchanged mesh is reused by a
+     * reloaded version of its scene (see \ref loadFromXML()).
+     */
+    void clearChildren();
+
+    /**
+     * \brief Return a description of the XML element and the files the
+     * mesh was created from
+     *
+     * A mesh with the same signature has the same geometry.
+     */
+    const std::string &getSignature() const { return m_signature; }
+
+    /// Set the signature of the mesh (called by the XML parser)
+    void setSignature(const std::string &signature) { m_signature = signature; }
+
     /// Return the name of this mesh
     const std::string &getName() const { return m_name; }
 
@@ -185,6 +204,7 @@ protected:
 
 protected:
     std::string		m_name;					///< Identifying name
+    std::string		m_signature;			///< Description of the mesh's source
     MatrixXf		m_V;					///< Vertex positions
     MatrixXf		m_N;					///< Vertex normals
     MatrixXf		m_UV;					///< Vertex texture coordinates
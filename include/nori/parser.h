@@ -25,7 +25,16 @@ NORI_NAMESPACE_BEGIN
 /**
  * \brief Load a scene from the specified filename and
  * return its root object
+ *
+ * \param previous
+ *     Previously loaded version of the scene (optional). Its meshes are
+ *     reused when their XML element (apart from the BSDF and emitter)
+ *     and the files it refers to are unchanged, which avoids loading
+ *     the files again. If no geometry changed at all, the BVH is reused
+ *     as well (see \ref Scene::adoptMeshes()). The previous version must
+ *     not be rendered anymore, but it still has to be deleted by the
+ *     caller, even if loading fails.
  */
-extern NoriObject *loadFromXML(const std::string &filename);
+extern NoriObject *loadFromXML(const std::string &filename, Scene *previous = nullptr);
 
 NORI_NAMESPACE_END
@@ -0,0 +1,290 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/block.h>
+#include <vector>
+#include <limits>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+
+NORI_NAMESPACE_BEGIN
+
+class SampleFile;
+class TileWriter;
+
+/// Options that control how \ref Renderer distributes the pixel samples
+struct RenderSettings {
+    /**
+     * \brief Number of samples per pixel
+     *
+     * Zero selects the sample count of the scene's sampler (or 16 times
+     * that when sampling adaptively, where this is an upper bound).
+     */
+    uint32_t sampleCount = 0;
+
+    /**
+     * \brief Number of samples per pixel rendered in each pass
+     *
+     * Progressive rendering adds passes over the whole image until the
+     * sample count or the time budget is reached, so that stopping early
+     * still yields a uniformly converged image. Zero renders all samples
+     * in a single pass (or in passes of the sampler's sample count when
+     * sampling adaptively), unless a time budget or a checkpoint file is
+     * given, in which case every pass takes a single sample per pixel.
+     */
+    uint32_t passSampleCount = 0;
+
+    /// Stop starting new passes after this many seconds (0: unlimited)
+    float timeBudget = 0.0f;
+
+    /**
+     * \brief Target relative error of adaptive sampling
+     *
+     * When positive, every pass after the first one only samples the
+     * pixels whose estimated relative error still exceeds this value.
+     * Zero disables adaptive sampling.
+     */
+    float adaptiveThreshold = 0.0f;
+
+    /**
+     * \brief File that periodically receives the state of the render (empty: none)
+     *
+     * Not supported by integrators that require the full image, since
+     * their postprocessing step isn't part of the state.
+     */
+    std::string checkpointFilename;
+
+    /// Time between two checkpoints in seconds
+    float checkpointInterval = 300.0f;
+
+    /// Continue the render stored in the checkpoint file (if it exists)
+    bool resume = false;
+
+    /// Print the percentage of finished blocks of every pass
+    bool showProgress = false;
+
+    /// Maximum size of the image blocks that are rendered in parallel
+    int blockSize = NORI_BLOCK_SIZE;
+
+    /// Order in which the blocks of every pass are rendered
+    BlockGenerator::EOrder blockOrder = BlockGenerator::ESpiral;
+
+    /**
+     * \brief Apply the reconstruction filter once per block
+     *
+     * The samples of a block are recorded while it is rendered and only
+     * splatted when it has finished (see \ref ImageBlock::setDeferred()).
+     */
+    bool deferredFilter = false;
+
+    /**
+     * \brief File that receives the raw samples (empty: none)
+     *
+     * Allows reconstructing the image with a different filter later on.
+     * Implies \ref deferredFilter.
+     */
+    std::string sampleFilename;
+
+    /// Output variables recorded besides the image (empty: none)
+    std::vector<AOVBuffer::EType> aovs;
+
+    /**
+     * \brief Render a part of the image that is merged with other parts
+     *
+     * Allows distributing a frame over several processes, which render
+     * different tiles and/or sample ranges. Their unnormalized results
+     * (see \ref Renderer::savePartial()) are summed afterwards.
+     */
+    bool partial = false;
+
+    /// Index of the first block that is rendered (scanline order)
+    int firstTile = 0;
+
+    /// Index one past the last block that is rendered (-1: all blocks)
+    int lastTile = -1;
+
+    /**
+     * \brief Index of the first sample rendered in every pixel
+     *
+     * The samples up to (but excluding) \ref sampleCount are rendered.
+     */
+    uint32_t firstSample = 0;
+};
+
+/**
+ * \brief Per-pixel sample statistics used by adaptive sampling
+ *
+ * Keeps the number of samples taken in a pixel together with a running
+ * mean and sum of squared deviations of their luminance (Welford's
+ * algorithm), from which the error of the pixel estimate follows.
+ * Invalid (negative, NaN or infinite) samples are left out of the
+ * estimate, but they still count as taken, since the sample count is
+ * also the index where the sample sequence of the pixel continues.
+ */
+struct PixelStatistics {
+    uint32_t sampleCount = 0;
+    uint32_t skippedCount = 0;
+    float mean = 0.0f;
+    float m2 = 0.0f;
+
+    /// Record the luminance of a new sample
+    void put(float value) {
+        sampleCount++;
+        float delta = value - mean;
+        mean += delta / getValidCount();
+        m2 += delta * (value - mean);
+    }
+
+    /// Record a sample whose value is invalid
+    void skip() {
+        sampleCount++;
+        skippedCount++;
+    }
+
+    /// Number of samples that contribute to the estimate
+    uint32_t getValidCount() const { return sampleCount - skippedCount; }
+
+    /// Standard error of the mean relative to the pixel luminance
+    float relativeError() const {
+        uint32_t validCount = getValidCount();
+        if (validCount < 2)
+            return std::numeric_limits<float>::infinity();
+        float variance = m2 / (validCount - 1);
+        /* The offset avoids spending samples on nearly black pixels */
+        return std::sqrt(variance / validCount) / (mean + 1e-2f);
+    }
+};
+
+/**
+ * \brief Renders a scene into an image block
+ *
+ * Splits the image into blocks that are rendered in parallel and merged
+ * into the result. The samples of a pixel only depend on the pixel and
+ * the sample index, so that rendering the samples in several passes (as
+ * done by progressive rendering) yields the same image as a single pass.
+ */
+class Renderer {
+public:
+    /**
+     * \brief Prepare rendering a scene
+     * \param scene
+     *     Scene to be rendered (its integrator must have been preprocessed)
+     * \param result
+     *     Image block covering the whole image, which receives the result
+     * \param settings
+     *     Options that control the distribution of the samples
+     * \param camera
+     *     Camera whose view is rendered (default: the scene's active
+     *     camera). Several renderers of the same scene can render
+     *     different cameras concurrently, unless the integrator
+     *     requires the full image.
+     */
+    Renderer(Scene *scene, ImageBlock &result, const RenderSettings &settings,
+        const Camera *camera = nullptr);
+
+    /**
+     * \brief Prepare rendering a scene whose finished tiles are streamed
+     * to a file instead of being kept in memory
+     *
+     * The tile size of the writer must match the block size of the
+     * settings, and all samples have to be rendered in a single pass.
+     */
+    Renderer(Scene *scene, TileWriter &writer, const RenderSettings &settings);
+
+    /// Wait for pending checkpoints to be written
+    ~Renderer();
+
+    /// Render the image (this blocks until rendering has finished)
+    void render();
+
+    /**
+     * \brief Stop rendering after the current pass
+     *
+     * This function is thread-safe. It has no effect when all samples
+     * are rendered in a single pass.
+     */
+    void stop() { m_stopped = true; }
+
+    /// Return the number of samples per pixel rendered so far
+    uint32_t getRenderedSampleCount() const { return m_renderedSampleCount; }
+
+    /**
+     * \brief Write the unnormalized result (the weighted sums and filter
+     * weights including the border) to an OpenEXR file
+     *
+     * The file has the format of a \ref RenderCheckpoint. Summing the
+     * files of all parts of a frame yields the result of rendering it
+     * at once.
+     */
+    void savePartial(const std::string &filename) const;
+protected:
+    Renderer(Scene *scene, ImageBlock *result, TileWriter *writer, const RenderSettings &settings,
+        const Camera *camera);
+
+    /**
+     * \brief Render every block of the image with the given number of
+     * samples per pixel (skipping converged pixels when adaptive)
+     *
+     * \return The number of pixels that have not converged yet
+     */
+    size_t renderPass(uint32_t firstSample, uint32_t sampleCount);
+
+    /// Continue from the checkpoint file, if there is one
+    void resume();
+
+    /**
+     * \brief Write a checkpoint after a pass has finished
+     *
+     * Unless \c wait is set, the state is captured immediately but
+     * written by a separate thread, so that rendering can go on. A
+     * checkpoint is skipped if the previous one is still being written.
+     */
+    void checkpoint(bool wait);
+
+    /// Render the pixels of a block; returns the number of unconverged pixels
+    size_t renderBlock(Sampler *sampler, ImageBlock &block, uint32_t firstSample,
+        uint32_t sampleCount, bool &sampled);
+
+    /// Check whether the pixel still needs further samples
+    bool isActive(const PixelStatistics &stats) const {
+        return stats.sampleCount < m_sampleCount &&
+            stats.relativeError() > m_settings.adaptiveThreshold;
+    }
+
+    Scene *m_scene;
+    const Camera *m_camera;
+    ImageBlock *m_result;
+    TileWriter *m_tileWriter;
+    RenderSettings m_settings;
+    uint32_t m_sampleCount;
+    uint32_t m_passSampleCount;
+    std::atomic<uint32_t> m_renderedSampleCount;
+    std::atomic<bool> m_stopped;
+    std::string m_progressLabel;
+    std::vector<PixelStatistics> m_statistics;
+    std::thread m_checkpointThread;
+    std::atomic<bool> m_checkpointPending;
+    std::unique_ptr<SampleFile> m_sampleFile;
+    /// Index of every mesh within the scene (written as output variable)
+    std::unordered_map<const Mesh *, int> m_meshIDs;
+};
+
+NORI_NAMESPACE_END
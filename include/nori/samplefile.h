@@ -0,0 +1,70 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/block.h>
+#include <tbb/mutex.h>
+#include <fstream>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief File of raw (unfiltered) image samples
+ *
+ * Stores the position and radiance value of every sample of a render,
+ * so that the image can be reconstructed with a different filter later
+ * on without rendering it again. The file starts with a small header
+ * holding the image size, followed by one record of five floats
+ * (x, y, r, g, b) per sample in the byte order of the machine.
+ */
+class SampleFile {
+public:
+    /**
+     * \brief Open a sample file for writing
+     *
+     * \param filename
+     *     Name of the file
+     * \param size
+     *     Size of the rendered image
+     * \param append
+     *     Add the samples to an existing file (e.g. when resuming a
+     *     render) instead of replacing it
+     */
+    SampleFile(const std::string &filename, const Vector2i &size, bool append);
+
+    /// Append the samples recorded by a block in deferred mode (thread-safe)
+    void write(const ImageBlock &block);
+
+    /// Return the image size stored in a sample file
+    static Vector2i readSize(const std::string &filename);
+
+    /**
+     * \brief Reconstruct the image stored in a sample file
+     *
+     * Splats all samples into the given block, which must cover the
+     * whole image. Its filter can differ from the one used to render.
+     */
+    static void read(const std::string &filename, ImageBlock &block);
+protected:
+    std::ofstream m_file;
+    std::string m_filename;
+    tbb::mutex m_mutex;
+};
+
+NORI_NAMESPACE_END
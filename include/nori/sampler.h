@@ -19,6 +19,7 @@
 #pragma once
 
 #include <nori/object.h>
+#include <nori/lowdiscrepancy.h>
 #include <memory>
 
 NORI_NAMESPACE_BEGIN
@@ -81,12 +82,28 @@ public:
      * \brief Prepare to generate new samples
      * 
      * This function is called initially and every time the 
-     * integrator starts rendering a new pixel.
+     * integrator starts rendering a new pixel. The samples of a pixel
+     * must be a pure function of the pixel coordinates, the sample index
+     * and the dimension (and the configured seed), so that an image does
+     * not depend on the block size or on the scheduling of the threads.
+     *
+     * \param pixel
+     *    Integer coordinates of the pixel to be rendered
+     * \param sampleIndex
+     *    Index of the first sample that will be generated, which allows
+     *    continuing the sample sequence of a pixel in a later pass
      */
-    virtual void generate() = 0;
-
-    /// Advance to the next sample
-    virtual void advance() = 0;
+    virtual void generate(const Point2i &pixel, uint32_t sampleIndex = 0) {
+        m_pixelSeed = LowDiscrepancy::hash((uint32_t) pixel.x(), (uint32_t) pixel.y(), m_seed);
+        m_sampleIndex = sampleIndex;
+        m_dimension = 0;
+    }
+
+    /// Advance to the next sample (this resets the current dimension)
+    virtual void advance() {
+        m_sampleIndex++;
+        m_dimension = 0;
+    }
 
     /// Retrieve the next component value from the current sample
     virtual float next1D() = 0;
@@ -97,6 +114,22 @@ public:
     /// Return the number of configured pixel samples
     virtual size_t getSampleCount() const { return m_sampleCount; }
 
+    /// Return the index of the current pixel sample
+    uint32_t getSampleIndex() const { return m_sampleIndex; }
+
+    /// Return the global seed of the sampler
+    uint32_t getSeed() const { return m_seed; }
+
+    /**
+     * \brief Change the global seed, e.g. to render statistically
+     * independent versions of an image
+     *
+     * Integrators that generate random numbers of their own (such as
+     * photon mappers) also derive them from this seed. Tables that a
+     * sampler precomputed from its initial seed are kept.
+     */
+    void setSeed(uint32_t seed) { m_seed = seed; }
+
     /**
      * \brief Return the type of object (i.e. Mesh/Sampler/etc.) 
      * provided by this instance
@@ -104,6 +137,14 @@ public:
     EClassType getClassType() const { return ESampler; }
 protected:
     size_t m_sampleCount;
+    /// Global seed that decorrelates different renderings of a scene
+    uint32_t m_seed = 0;
+    /// Hash of the current pixel and the seed
+    uint64_t m_pixelSeed = 0;
+    /// Index of the current pixel sample
+    uint32_t m_sampleIndex = 0;
+    /// Number of dimensions consumed by the current sample
+    uint32_t m_dimension = 0;
 };
 
 NORI_NAMESPACE_END
@@ -46,9 +46,40 @@ public:
     /// Return a pointer to the scene's integrator
     Integrator *getIntegrator() { return m_integrator; }
 
-    /// Return a pointer to the scene's camera
+    /// Return a pointer to the scene's (active) camera
     const Camera *getCamera() const { return m_camera; }
 
+    /**
+     * \brief Return all cameras of the scene
+     *
+     * A scene can contain several cameras (e.g. the frames of a
+     * turntable), which are rendered one after another while sharing
+     * the meshes and the acceleration data structure. The first one is
+     * active by default.
+     */
+    const std::vector<Camera *> &getCameras() const { return m_cameras; }
+
+    /// Make one of the scene's cameras the active camera
+    void selectCamera(size_t index) {
+        if (index >= m_cameras.size())
+            throw NoriException("Scene::selectCamera(): invalid camera index %i!", index);
+        m_camera = m_cameras[index];
+    }
+
+    /**
+     * \brief Temporarily replace the active camera (e.g. to render
+     * another view)
+     *
+     * The caller keeps the ownership of the camera, and it has to
+     * restore the previous camera before deleting it.
+     *
+     * \return The previously active camera
+     */
+    Camera *setCamera(Camera *camera) {
+        std::swap(camera, m_camera);
+        return camera;
+    }
+
     /// Return a pointer to the scene's sample generator (const version)
     const Sampler *getSampler() const { return m_sampler; }
 
@@ -58,6 +89,9 @@ public:
     /// Return a reference to an array containing all meshes
     const std::vector<Mesh *> &getMeshes() const { return m_meshes; }
 
+    /// Return a reference to an array containing all meshes with an attached emitter
+    const std::vector<Mesh *> &getEmitterMeshes() const { return m_emitterMeshes; }
+
     /**
      * \brief Intersect a ray against all triangles stored in the scene
      * and return detailed intersection information
@@ -112,16 +146,45 @@ public:
     /// Add a child object to the scene (meshes, integrators etc.)
     void addChild(NoriObject *obj);
 
+    /**
+     * \brief Register the previous version of a reloaded scene
+     *
+     * Called by the XML parser before \ref activate(). The meshes that
+     * were reused from the previous version (see \ref loadFromXML()) still
+     * belong to it until \ref activate() succeeds, which then takes them
+     * over. If the geometry is unchanged, i.e. the scene consists of the
+     * same meshes in the same order, the previous BVH is taken over as
+     * well instead of building a new one. Afterwards, the previous version
+     * no longer contains the reused meshes and can't be rendered anymore.
+     *
+     * A scene that is deleted before its activation succeeded (because
+     * loading it failed) leaves the reused meshes to the previous version.
+     */
+    void setPreviousVersion(Scene *previous) { m_previous = previous; }
+
     /// Return a string summary of the scene (for debugging purposes)
     std::string toString() const;
 
     EClassType getClassType() const { return EScene; }
 private:
+    /// Take over the meshes (and possibly the BVH) of the previous version
+    void adoptMeshes();
+
+    /// Return the meshes that are shared with the previous version
+    std::unordered_set<const Mesh *> getSharedMeshes() const;
+
+    /// Remove meshes from the scene without deleting them
+    void releaseMeshes(const std::unordered_set<const Mesh *> &meshes);
+
     std::vector<Mesh *> m_meshes;
+    std::vector<Mesh *> m_emitterMeshes;
     Integrator *m_integrator = nullptr;
     Sampler *m_sampler = nullptr;
+    std::vector<Camera *> m_cameras;
     Camera *m_camera = nullptr;
     Accel *m_accel = nullptr;
+    /// Previous version whose meshes are taken over on activation
+    Scene *m_previous = nullptr;
 };
 
 NORI_NAMESPACE_END
@@ -0,0 +1,134 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/render.h>
+#include <nori/bitmap.h>
+#include <map>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <ctime>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Long-running process that renders jobs received over a local
+ * UNIX domain socket
+ *
+ * Loading a scene (parsing the meshes and building the acceleration data
+ * structure) often takes longer than rendering a preview of it. The
+ * server therefore keeps every scene it has loaded in memory and only
+ * reloads it when the scene file has been modified.
+ *
+ * Clients send one job per line and receive one line per job, either
+ * <tt>done &lt;output&gt;</tt> or <tt>error &lt;message&gt;</tt>:
+ *
+ * <pre>
+ * &lt;scene.xml&gt; output=&lt;image.exr&gt; [camera=&lt;camera.xml&gt;]
+ *     [lookat=ox,oy,oz,tx,ty,tz,ux,uy,uz] [fov=&lt;degrees&gt;]
+ *     [width=&lt;pixels&gt;] [height=&lt;pixels&gt;] [spp=&lt;count&gt;]
+ * </pre>
+ *
+ * \c camera replaces the scene's camera by the one described in an XML
+ * file, while \c lookat creates a perspective camera with the given
+ * field of view (default: 30 degrees) and size (default: that of the
+ * scene's camera). The line <tt>shutdown</tt> stops the server.
+ *
+ * The calling thread accepts connections and reads the jobs of all
+ * clients (using \c poll()) into a queue, which a render thread drains
+ * in the order of arrival. Jobs are rendered one after another, each of
+ * them using all threads of the TBB pool, while further clients can
+ * connect and submit jobs. Only the render thread accesses the loaded
+ * scenes.
+ */
+class RenderServer {
+public:
+    /**
+     * \brief Create the server
+     *
+     * \param socketPath
+     *     Path of the UNIX domain socket (replaced if it exists)
+     * \param settings
+     *     Default options of every job
+     * \param exrSettings
+     *     Compression and precision of the written OpenEXR files
+     */
+    RenderServer(const std::string &socketPath, const RenderSettings &settings,
+        const EXRSettings &exrSettings);
+
+    /// Delete the loaded scenes
+    ~RenderServer();
+
+    /// Accept and render jobs until a client requests a shutdown
+    void run();
+protected:
+    /// Client connection, which is closed once it was read completely and all of its jobs were answered
+    struct Connection {
+        int fd;
+
+        Connection(int fd) : fd(fd) { }
+        ~Connection();
+
+        /// Send a line to the client (a client that went away is ignored)
+        void send(const std::string &line);
+    };
+
+    /// Job line together with the connection that receives the reply
+    struct Job {
+        std::shared_ptr<Connection> connection;
+        std::string line;
+    };
+
+    /// A loaded scene together with the modification time of its file
+    struct SceneEntry {
+        std::unique_ptr<Scene> scene;
+        time_t modificationTime;
+    };
+
+    /// Queue the complete lines of a connection's input buffer
+    void queueJobs(const std::shared_ptr<Connection> &connection, std::string &buffer);
+
+    /// Render the queued jobs until a shutdown is requested (runs on the render thread)
+    void renderJobs();
+
+    /// Render the job described by a line; returns the output filename
+    std::string render(const std::string &job);
+
+    /// Return the scene stored in a file, loading it if necessary
+    Scene *getScene(const std::string &filename);
+
+    std::string m_socketPath;
+    RenderSettings m_settings;
+    EXRSettings m_exrSettings;
+    /// Loaded scenes indexed by the absolute path of their file
+    std::map<std::string, SceneEntry> m_scenes;
+
+    /// Jobs that wait for the render thread
+    std::deque<Job> m_jobs;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    /// Set when a shutdown was requested or the server failed
+    bool m_stopping = false;
+    /// Pipe that wakes up the connection handling of \ref run()
+    int m_wakeup[2] = { -1, -1 };
+};
+
+NORI_NAMESPACE_END
@@ -0,0 +1,109 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/block.h>
+#include <tbb/mutex.h>
+
+#include <ImfForward.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Streams rendered image blocks into a tiled OpenEXR file
+ *
+ * The image is divided into tiles that coincide with the blocks of a
+ * \ref BlockGenerator using the same block size (blocks that were split
+ * at the end of a pass lie within a single tile). Every tile accumulates
+ * the contributions of the blocks that reach into it, and it is written
+ * and released as soon as all blocks within the reach of the filter have
+ * been added. Hence only the tiles along the front of finished blocks are
+ * kept in memory instead of the whole image.
+ *
+ * Every pixel must be added exactly once, i.e. the image has to be
+ * rendered in a single pass.
+ */
+class TileWriter {
+public:
+    /**
+     * \brief Create the output file
+     *
+     * \param filename
+     *     Name of the OpenEXR file
+     * \param size
+     *     Size of the image
+     * \param tileSize
+     *     Size of the tiles (i.e. of the rendered blocks)
+     * \param filter
+     *     Reconstruction filter of the rendered blocks
+     * \param aovs
+     *     Output variables written as further layers
+     * \param settings
+     *     Compression and precision of the file
+     */
+    TileWriter(const std::string &filename, const Vector2i &size, int tileSize,
+        const ReconstructionFilter *filter, const std::vector<AOVBuffer::EType> &aovs,
+        const EXRSettings &settings);
+
+    /// Close the file
+    ~TileWriter();
+
+    /**
+     * \brief Add a rendered block (thread-safe)
+     *
+     * Writes all tiles that are finished by this block.
+     */
+    void put(const ImageBlock &block);
+
+    /// Verify that every tile has been written
+    void finish();
+protected:
+    struct Tile {
+        /// Accumulated contributions (allocated on demand)
+        std::unique_ptr<ImageBlock> pixels;
+        /// Number of pixels rendered within the tile
+        int renderedPixels = 0;
+        bool written = false;
+    };
+
+    /// Return the region of a tile
+    BoundingBox2i getTileBounds(const Point2i &tile) const;
+
+    /// Check whether all blocks reaching into a tile have been added
+    bool isReady(const Point2i &tile) const;
+
+    /// Normalize a tile and write it to the file
+    void writeTile(const Point2i &tile, const ImageBlock &pixels);
+
+    Vector2i m_size;
+    int m_tileSize;
+    int m_borderSize;
+    /// Number of neighboring tiles reached by the border of a block
+    int m_reach;
+    Vector2i m_numTiles;
+    std::vector<Tile> m_tiles;
+    std::vector<AOVBuffer::EType> m_aovs;
+    std::unique_ptr<Imf::TiledOutputFile> m_file;
+    /// Protects the tiles
+    tbb::mutex m_mutex;
+    /// Serializes access to the file
+    tbb::mutex m_fileMutex;
+};
+
+NORI_NAMESPACE_END
@@ -9,6 +9,16 @@ tests = [
     "pa5/tests/ttest-microfacet.xml",
     "pa5/tests/test-direct.xml",
     "pa5/tests/test-furnace.xml",
+    "pa5/tests/test-ris.xml",
+    "pa5/tests/test-guided.xml",
+    "pa5/tests/test-bdpt.xml",
+    "pa5/tests/test-photonmapper.xml",
+    "pa5/tests/test-sppm.xml",
+    "pa5/tests/test-samplers.xml",
+    "pa5/tests/test-checkpoint.xml",
+    "pa5/tests/test-block.xml",
+    "pa5/tests/test-reconstruction.xml",
+    "pa5/tests/test-tilewriter.xml",
 ]
 
 total = len(tests)
@@ -21,6 +21,7 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 #include <tbb/tbb.h>
 #include <Eigen/Geometry>
 #include <atomic>
+#include <algorithm>
 
 /*
 * =======================================================================
@@ -311,6 +312,25 @@ void Accel::addMesh(Mesh *mesh) {
 	m_bbox.expandBy(mesh->getBoundingBox());
 }
 
+void Accel::releaseMeshes(const std::unordered_set<const Mesh *> &meshes) {
+	size_t count = m_meshes.size();
+	m_meshes.erase(std::remove_if(m_meshes.begin(), m_meshes.end(),
+		[&](const Mesh *mesh) { return meshes.count(mesh) > 0; }), m_meshes.end());
+	if (m_meshes.size() == count)
+		return;
+
+	/* Register the remaining meshes again (without a BVH) */
+	std::vector<Mesh *> remaining;
+	remaining.swap(m_meshes);
+	m_meshOffset.clear();
+	m_meshOffset.push_back(0u);
+	m_nodes.clear();
+	m_indices.clear();
+	m_bbox.reset();
+	for (auto mesh : remaining)
+		addMesh(mesh);
+}
+
 void Accel::clear() {
 	for (auto mesh : m_meshes)
 		delete mesh;
@@ -2,18 +2,42 @@
 #include <nori/scene.h>
 #include <nori/sampler.h>
 #include <nori/warp.h>
+#include <nori/irradiancecache.h>
+#include <limits>
 
 NORI_NAMESPACE_BEGIN
 
 class AoIntegrator : public Integrator {
 public:
-	AoIntegrator(const PropertyList &props) {}
+	AoIntegrator(const PropertyList &props) {
+		/* Interpolate sparse occlusion records instead of sampling every hit */
+		m_useCache = props.getBoolean("cache", false);
+		/* Maximum interpolation error of a cache record */
+		m_cacheAccuracy = props.getFloat("cacheAccuracy", 0.2f);
+		/* Bounds of the record spacing relative to the scene size */
+		m_cacheMinSpacing = props.getFloat("cacheMinSpacing", 0.001f);
+		m_cacheMaxSpacing = props.getFloat("cacheMaxSpacing", 0.1f);
+
+		if (m_cacheAccuracy <= 0)
+			throw NoriException("AoIntegrator: cacheAccuracy must be positive!");
+		if (m_cacheMinSpacing <= 0 || m_cacheMaxSpacing < m_cacheMinSpacing)
+			throw NoriException("AoIntegrator: invalid cache spacing!");
+	}
+
+	void preprocess(const Scene *scene) {
+		if (m_useCache)
+			m_cache.reset(new IrradianceCache(scene->getBoundingBox(),
+				m_cacheAccuracy, m_cacheMinSpacing, m_cacheMaxSpacing));
+	}
 
 	Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const {
 		Intersection its;
 		if (!scene->rayIntersect(ray, its))
 			return Color3f(0.0f);
 
+		if (m_cache)
+			return cachedLi(scene, sampler, its);
+
 		float sum = 0.0f;
 		Frame shFrame = its.shFrame;
 		Point3f fragPosition = its.p;
@@ -28,9 +52,59 @@ public:
 	}
 
 	std::string toString() const {
-		return std::string("AoIntegrator[]");
+		return tfm::format(
+			"AoIntegrator[\n"
+			"  cache = %s,\n"
+			"  cacheAccuracy = %f,\n"
+			"  cacheMinSpacing = %f,\n"
+			"  cacheMaxSpacing = %f\n"
+			"]",
+			m_useCache ? "true" : "false", m_cacheAccuracy,
+			m_cacheMinSpacing, m_cacheMaxSpacing
+		);
 	}
+private:
+	/**
+	 * \brief Look up the occlusion in the cache, and create a new record with
+	 * stratified hemisphere sampling (about \c sampleCount rays) on a miss
+	 */
+	Color3f cachedLi(const Scene *scene, Sampler *sampler, const Intersection &its) const {
+		Color3f result;
+		if (m_cache->lookup(its.p, its.shFrame.n, result))
+			return result;
+
+		/* M x N strata with N ~ pi * M, as suggested by Ward and Heckbert */
+		int M = std::max(1, (int) std::round(std::sqrt(sampler->getSampleCount() / M_PI)));
+		int N = std::max(1, (int) std::round(sampler->getSampleCount() / (float) M));
+		std::vector<Color3f> L(M * N);
+		std::vector<float> dist(M * N);
+		for (int j = 0; j < M; j++) {
+			for (int k = 0; k < N; k++) {
+				Vector3f dir = its.shFrame.toWorld(
+					IrradianceCache::sampleStratum(j, k, M, N, sampler->next2D()));
+				Intersection shadowIts;
+				if (scene->rayIntersect(Ray3f(its.p, dir), shadowIts)) {
+					L[j * N + k] = Color3f(0.0f);
+					dist[j * N + k] = shadowIts.t;
+				}
+				else {
+					L[j * N + k] = Color3f(1.0f);
+					dist[j * N + k] = std::numeric_limits<float>::infinity();
+				}
+			}
+		}
+
+		IrradianceCache::Record record = m_cache->createRecord(its.p, its.shFrame, M, N, L.data(), dist.data());
+		m_cache->insert(record);
+		return record.value;
+	}
+
+	bool m_useCache;
+	float m_cacheAccuracy;
+	float m_cacheMinSpacing;
+	float m_cacheMaxSpacing;
+	std::unique_ptr<IrradianceCache> m_cache;
 };
 
 NORI_REGISTER_CLASS(AoIntegrator, "ao")
-NORI_NAMESPACE_END
\ No newline at end of file
+NORI_NAMESPACE_END
@@ -0,0 +1,173 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/aov.h>
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/bsdf.h>
+#include <algorithm>
+
+NORI_NAMESPACE_BEGIN
+
+/// Number of planes and channel names of every variable
+static const int aovChannelCount[AOVBuffer::ETypeCount] = { 3, 3, 1, 1, 1 };
+static const char *aovChannelNames[AOVBuffer::ETypeCount][3] = {
+    { "albedo.R", "albedo.G", "albedo.B" },
+    { "normal.X", "normal.Y", "normal.Z" },
+    { "depth.Z" },
+    { "meshId.ID" },
+    { "sampleCount.N" }
+};
+
+void AOVRecord::setSurface(const Intersection &its) {
+    albedo = its.mesh->getBSDF()->getAlbedo();
+    normal = its.shFrame.n;
+    depth = its.t;
+    mesh = its.mesh;
+}
+
+Color3f Integrator::LiAOV(const Scene *scene, Sampler *sampler, const Ray3f &ray,
+        AOVRecord &record) const {
+    Intersection its;
+    if (scene->rayIntersect(ray, its))
+        record.setSurface(its);
+    return Li(scene, sampler, ray);
+}
+
+AOVBuffer::AOVBuffer(const Vector2i &size, const std::vector<EType> &types)
+    : m_size(size) {
+    /* The sample count is always needed for averaging */
+    std::fill(m_planes, m_planes + ETypeCount, -1);
+    m_planes[ESampleCount] = 0;
+    m_planeCount = 1;
+
+    for (EType type : types) {
+        if (std::find(m_types.begin(), m_types.end(), type) != m_types.end())
+            continue;
+        m_types.push_back(type);
+        if (m_planes[type] < 0) {
+            m_planes[type] = m_planeCount;
+            m_planeCount += aovChannelCount[type];
+        }
+    }
+
+    m_data.resize((size_t) m_planeCount * m_size.x() * m_size.y());
+    clear();
+}
+
+AOVBuffer::EType AOVBuffer::typeFromString(const std::string &name) {
+    std::string value = toLower(name);
+    if (value == "albedo")
+        return EAlbedo;
+    else if (value == "normal")
+        return ENormal;
+    else if (value == "depth")
+        return EDepth;
+    else if (value == "meshid")
+        return EMeshID;
+    else if (value == "samplecount")
+        return ESampleCount;
+    else
+        throw NoriException("Unknown output variable \"%s\" (expected albedo, normal, "
+            "depth, meshId or sampleCount)", name);
+}
+
+void AOVBuffer::clear() {
+    std::fill(m_data.begin(), m_data.end(), 0.0f);
+}
+
+void AOVBuffer::put(const Point2i &pixel, const AOVRecord &record) {
+    size_t index = (size_t) pixel.y() * m_size.x() + pixel.x();
+    float &count = plane(m_planes[ESampleCount])[index];
+
+    /* Stored with an offset of one, so that unwritten pixels are background */
+    if (m_planes[EMeshID] >= 0 && count == 0)
+        plane(m_planes[EMeshID])[index] = (float) (record.meshID + 1);
+
+    count += 1.0f;
+    if (m_planes[EAlbedo] >= 0) {
+        for (int i=0; i<3; ++i)
+            plane(m_planes[EAlbedo] + i)[index] += record.albedo[i];
+    }
+    if (m_planes[ENormal] >= 0) {
+        for (int i=0; i<3; ++i)
+            plane(m_planes[ENormal] + i)[index] += record.normal[i];
+    }
+    if (m_planes[EDepth] >= 0)
+        plane(m_planes[EDepth])[index] += record.depth;
+}
+
+void AOVBuffer::put(const AOVBuffer &other, const Point2i &offset, const Vector2i &size) {
+    if (other.m_types != m_types)
+        throw NoriException("AOVBuffer::put(): the output variables don't match!");
+
+    /* The mesh ID of the first merged samples wins (before the counts are added) */
+    int meshPlane = m_planes[EMeshID];
+    if (meshPlane >= 0) {
+        for (int y=0; y<size.y(); ++y) {
+            size_t src = (size_t) y * other.m_size.x(),
+                   dst = (size_t) (y + offset.y()) * m_size.x() + offset.x();
+            const float *count = plane(m_planes[ESampleCount]) + dst;
+            for (int x=0; x<size.x(); ++x) {
+                if (count[x] == 0)
+                    plane(meshPlane)[dst + x] = other.plane(meshPlane)[src + x];
+            }
+        }
+    }
+
+    for (int p=0; p<m_planeCount; ++p) {
+        if (p == meshPlane)
+            continue;
+        for (int y=0; y<size.y(); ++y) {
+            const float *src = other.plane(p) + (size_t) y * other.m_size.x();
+            float *dst = plane(p) + (size_t) (y + offset.y()) * m_size.x() + offset.x();
+            Eigen::Map<Eigen::ArrayXf>(dst, size.x()) += Eigen::Map<const Eigen::ArrayXf>(src, size.x());
+        }
+    }
+}
+
+std::vector<std::string> AOVBuffer::getChannelNames() const {
+    std::vector<std::string> names;
+    for (EType type : m_types)
+        for (int i=0; i<aovChannelCount[type]; ++i)
+            names.push_back(aovChannelNames[type][i]);
+    return names;
+}
+
+std::vector<float> AOVBuffer::resolve() const {
+    size_t pixelCount = (size_t) m_size.x() * m_size.y();
+    std::vector<float> result;
+    result.reserve(getChannelNames().size() * pixelCount);
+    const float *count = plane(m_planes[ESampleCount]);
+
+    for (EType type : m_types) {
+        for (int i=0; i<aovChannelCount[type]; ++i) {
+            const float *src = plane(m_planes[type] + i);
+            for (size_t j=0; j<pixelCount; ++j) {
+                switch (type) {
+                    case EMeshID: result.push_back(src[j] - 1.0f); break;
+                    case ESampleCount: result.push_back(src[j]); break;
+                    default: result.push_back(count[j] > 0 ? src[j] / count[j] : 0.0f); break;
+                }
+            }
+        }
+    }
+    return result;
+}
+
+NORI_NAMESPACE_END
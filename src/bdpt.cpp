@@ -0,0 +1,537 @@
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/sampler.h>
+#include <nori/emitter.h>
+#include <nori/bsdf.h>
+#include <nori/aov.h>
+#include <nori/camera.h>
+#include <nori/block.h>
+#include <nori/warp.h>
+#include <nori/atomic.h>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Vertex of a camera or light subpath
+ *
+ * Densities are stored with respect to surface area at the vertex:
+ * \c pdfFwd is the density of generating this vertex from its predecessor
+ * in the subpath, \c pdfRev the density of generating it when walking
+ * the path in the opposite direction.
+ */
+struct PathVertex {
+	enum EType { ECamera, ELight, ESurface };
+
+	EType type;
+	Point3f p;
+	/// Shading frame (only meaningful for surface and light vertices)
+	Frame shFrame;
+	const Mesh *mesh = nullptr;
+	const BSDF *bsdf = nullptr;
+	/// Direction towards the previous vertex of the subpath (world space)
+	Vector3f wi;
+	Color3f beta;
+	float pdfFwd = 0.f;
+	float pdfRev = 0.f;
+	/// Whether the vertex scatters using a Dirac delta BSDF
+	bool delta = false;
+
+	bool isOnSurface() const { return type != ECamera; }
+
+	bool isEmitter() const { return type == ELight || (mesh && mesh->isEmitter()); }
+
+	/// Radiance emitted from this vertex towards \c v (emitters are one-sided)
+	Color3f le(const PathVertex &v) const {
+		if (!isEmitter())
+			return Color3f(0.0f);
+		Vector3f w = v.p - p;
+		if (shFrame.n.dot(w) <= 0)
+			return Color3f(0.0f);
+		return mesh->getEmitter()->le();
+	}
+
+	/// BSDF value for scattering from the previous vertex towards \c next
+	Color3f f(const PathVertex &next) const {
+		if (type != ESurface || delta)
+			return Color3f(0.0f);
+		Vector3f wo = (next.p - p).normalized();
+		BSDFQueryRecord bRec(shFrame.toLocal(wi), shFrame.toLocal(wo), ESolidAngle);
+		return bsdf->eval(bRec);
+	}
+
+	/// Convert a solid angle density at this vertex into an area density at \c next
+	float convertDensity(float pdf, const PathVertex &next) const {
+		Vector3f w = next.p - p;
+		float invDist2 = 1.f / w.squaredNorm();
+		if (next.isOnSurface())
+			pdf *= std::abs(next.shFrame.n.dot(w * std::sqrt(invDist2)));
+		return pdf * invDist2;
+	}
+};
+
+/**
+ * \brief Temporarily override a value, restoring it when going out of scope
+ */
+template <typename T> class ScopedAssignment {
+public:
+	ScopedAssignment(T *target = nullptr, T value = T()) : m_target(target) {
+		if (m_target) {
+			m_backup = *m_target;
+			*m_target = value;
+		}
+	}
+
+	~ScopedAssignment() {
+		if (m_target)
+			*m_target = m_backup;
+	}
+
+	ScopedAssignment &operator=(ScopedAssignment &&other) {
+		if (m_target)
+			*m_target = m_backup;
+		m_target = other.m_target;
+		m_backup = other.m_backup;
+		other.m_target = nullptr;
+		return *this;
+	}
+private:
+	T *m_target;
+	T m_backup;
+};
+
+/**
+ * \brief Bidirectional path tracer
+ *
+ * Traces a camera and a light subpath per sample and combines all
+ * connections between them using the balance heuristic. Connections of
+ * light subpath vertices to the camera (light tracing, t = 1) land on
+ * arbitrary pixels; they are splatted into a separate image and added
+ * to the output in \ref postprocess().
+ */
+class BDPTIntegrator : public Integrator {
+public:
+	BDPTIntegrator(const PropertyList &props) {
+		/* Maximum number of scattering events of a complete path */
+		m_maxDepth = props.getInteger("maxDepth", 5);
+		if (m_maxDepth < 0)
+			throw NoriException("BDPTIntegrator: maxDepth must be non-negative!");
+		m_lightPaths = 0;
+	}
+
+	void preprocess(const Scene *scene) {
+		Vector2i size = scene->getCamera()->getOutputSize();
+		m_lightImageSize = size;
+		m_lightImage.reset(new std::atomic<float>[3 * size.x() * size.y()]);
+		for (int i = 0; i < 3 * size.x() * size.y(); i++)
+			m_lightImage[i].store(0.f, std::memory_order_relaxed);
+		m_lightPaths = 0;
+	}
+
+	bool requiresFullImage() const {
+		return true;
+	}
+
+	void postprocess(const Scene *scene, ImageBlock &result) {
+		uint64_t lightPaths = m_lightPaths.load();
+		if (lightPaths == 0)
+			return;
+
+		/* The camera importance integrates to one over the whole image plane,
+		   hence each pixel receives a fraction 1 / (width * height) of it */
+		float scale = static_cast<float>(m_lightImageSize.x()) * m_lightImageSize.y() / lightPaths;
+		int border = result.getBorderSize();
+		for (int y = 0; y < m_lightImageSize.y(); y++) {
+			for (int x = 0; x < m_lightImageSize.x(); x++) {
+				/* The block stores filter-weighted sums, so the splatted
+				   value is pre-multiplied by the accumulated pixel weight */
+				Color4f &pixel = result.coeffRef(y + border, x + border);
+				const std::atomic<float> *splat = &m_lightImage[3 * (y * m_lightImageSize.x() + x)];
+				float weight = pixel.w() * scale;
+				pixel.x() += splat[0].load(std::memory_order_relaxed) * weight;
+				pixel.y() += splat[1].load(std::memory_order_relaxed) * weight;
+				pixel.z() += splat[2].load(std::memory_order_relaxed) * weight;
+			}
+		}
+	}
+
+	Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const {
+		return Li(scene, sampler, ray, nullptr);
+	}
+
+	Color3f LiAOV(const Scene *scene, Sampler *sampler, const Ray3f &ray, AOVRecord &record) const {
+		return Li(scene, sampler, ray, &record);
+	}
+
+	Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray, AOVRecord *record) const {
+		/* Per-thread vertex storage, reused across samples */
+		static thread_local std::vector<PathVertex> cameraVertices, lightVertices;
+		cameraVertices.resize(m_maxDepth + 2);
+		lightVertices.resize(m_maxDepth + 1);
+
+		int nCamera = generateCameraSubpath(scene, sampler, ray, cameraVertices.data());
+		if (record && nCamera > 1) {
+			/* The first surface vertex of the camera subpath */
+			const PathVertex &vertex = cameraVertices[1];
+			record->albedo = vertex.bsdf->getAlbedo();
+			record->normal = vertex.shFrame.n;
+			record->depth = (vertex.p - ray.o).norm();
+			record->mesh = vertex.mesh;
+		}
+		int nLight = generateLightSubpath(scene, sampler, lightVertices.data());
+		m_lightPaths.fetch_add(1, std::memory_order_relaxed);
+
+		Color3f li(0.0f);
+		for (int t = 1; t <= nCamera; t++) {
+			for (int s = 0; s <= nLight; s++) {
+				int depth = s + t - 2;
+				if ((s == 1 && t == 1) || depth < 0 || depth > m_maxDepth)
+					continue;
+
+				Point2f pixel;
+				Color3f lpath = connect(scene, sampler, lightVertices.data(), cameraVertices.data(), s, t, pixel);
+				if (t != 1)
+					li += lpath;
+				else if (!lpath.isZero())
+					splat(pixel, lpath);
+			}
+		}
+		return li;
+	}
+
+	std::string toString() const {
+		return tfm::format("BDPTIntegrator[maxDepth=%i]", m_maxDepth);
+	}
+private:
+	/// Probability of choosing a given emitter when starting a light subpath
+	static float emitterPdf(const Scene *scene) {
+		return 1.f / static_cast<float>(scene->getEmitterMeshes().size());
+	}
+
+	/// Area density with which a light subpath starts at the emitter vertex \c v
+	static float pdfLightOrigin(const Scene *scene, const PathVertex &v) {
+		return emitterPdf(scene) / v.mesh->getSurfaceArea();
+	}
+
+	/// Area density at \c to of leaving the emitter vertex \c v towards it
+	static float pdfLight(const PathVertex &v, const PathVertex &to) {
+		Vector3f w = (to.p - v.p).normalized();
+		float pdfDir = Warp::squareToCosineHemispherePdf(v.shFrame.toLocal(w));
+		return v.convertDensity(pdfDir, to);
+	}
+
+	/// Area density at \c next of sampling it from \c v (reached from \c prev)
+	static float pdf(const Scene *scene, const PathVertex &v, const PathVertex *prev, const PathVertex &next) {
+		if (v.type == PathVertex::ELight)
+			return pdfLight(v, next);
+
+		Vector3f wn = (next.p - v.p).normalized();
+		float pdfDir;
+		if (v.type == PathVertex::ECamera) {
+			float pdfPos;
+			scene->getCamera()->pdfRay(Ray3f(v.p, wn), pdfPos, pdfDir);
+		}
+		else {
+			Vector3f wp = (prev->p - v.p).normalized();
+			BSDFQueryRecord bRec(v.shFrame.toLocal(wp), v.shFrame.toLocal(wn), ESolidAngle);
+			pdfDir = v.bsdf->pdf(bRec);
+		}
+		return v.convertDensity(pdfDir, next);
+	}
+
+	/**
+	 * \brief Extend a subpath by tracing \c ray and sampling the BSDF
+	 * at every intersection. Returns the number of vertices added.
+	 */
+	int randomWalk(const Scene *scene, Sampler *sampler, Ray3f ray, Color3f beta,
+			float pdfDir, int maxDepth, bool importance, PathVertex *path) const {
+		if (maxDepth == 0)
+			return 0;
+
+		int bounces = 0;
+		float pdfFwd = pdfDir;
+		while (true) {
+			Intersection its;
+			if (!scene->rayIntersect(ray, its))
+				break;
+
+			PathVertex &vertex = path[bounces], &prev = path[bounces - 1];
+			vertex.type = PathVertex::ESurface;
+			vertex.p = its.p;
+			vertex.shFrame = its.shFrame;
+			vertex.mesh = its.mesh;
+			vertex.bsdf = its.mesh->getBSDF();
+			vertex.wi = -ray.d.normalized();
+			vertex.beta = beta;
+			vertex.delta = false;
+			vertex.pdfFwd = prev.convertDensity(pdfFwd, vertex);
+			vertex.pdfRev = 0.f;
+			if (++bounces >= maxDepth)
+				break;
+
+			BSDFQueryRecord bRec(its.shFrame.toLocal(vertex.wi));
+			Color3f f = vertex.bsdf->sample(bRec, sampler->next2D());
+			if (f.isZero())
+				break;
+			Vector3f wo = its.shFrame.toWorld(bRec.wo);
+
+			float pdfRev;
+			if (bRec.measure == EDiscrete) {
+				vertex.delta = true;
+				pdfFwd = pdfRev = 0.f;
+			}
+			else {
+				pdfFwd = vertex.bsdf->pdf(bRec);
+				BSDFQueryRecord bRecRev(bRec.wo, bRec.wi, ESolidAngle);
+				pdfRev = vertex.bsdf->pdf(bRecRev);
+			}
+
+			beta *= f;
+			if (importance) {
+				/* Correct for the asymmetry of shading normals under adjoint transport */
+				float num = std::abs(vertex.wi.dot(its.shFrame.n)) * std::abs(wo.dot(its.geoFrame.n));
+				float denom = std::abs(vertex.wi.dot(its.geoFrame.n)) * std::abs(wo.dot(its.shFrame.n));
+				if (denom == 0)
+					break;
+				beta *= num / denom;
+			}
+
+			prev.pdfRev = vertex.convertDensity(pdfRev, prev);
+			ray = Ray3f(its.p, wo);
+		}
+		return bounces;
+	}
+
+	int generateCameraSubpath(const Scene *scene, Sampler *sampler, const Ray3f &ray, PathVertex *path) const {
+		float pdfPos, pdfDir;
+		scene->getCamera()->pdfRay(ray, pdfPos, pdfDir);
+
+		PathVertex &camera = path[0];
+		camera.type = PathVertex::ECamera;
+		camera.p = ray.o;
+		camera.mesh = nullptr;
+		camera.beta = Color3f(1.0f);
+		camera.pdfFwd = pdfPos;
+		camera.pdfRev = 0.f;
+		camera.delta = false;
+
+		/* The camera ray carries unit importance weight (We * cos / pdf = 1) */
+		return randomWalk(scene, sampler, ray, Color3f(1.0f), pdfDir,
+			m_maxDepth + 1, false, path + 1) + 1;
+	}
+
+	int generateLightSubpath(const Scene *scene, Sampler *sampler, PathVertex *path) const {
+		const std::vector<Mesh *> &emitters = scene->getEmitterMeshes();
+		if (emitters.empty())
+			return 0;
+
+		float uEmitter = sampler->next1D();
+		Point2f positionSample = sampler->next2D();
+		Point2f directionSample = sampler->next2D();
+
+		size_t index = std::min(static_cast<size_t>(uEmitter * emitters.size()), emitters.size() - 1);
+		const Mesh *mesh = emitters[index];
+		SampleOnEmitter soe = mesh->getEmitter()->sample(positionSample);
+		float pdfPos = emitterPdf(scene) * soe.probabilityDensity;
+
+		PathVertex &light = path[0];
+		light.type = PathVertex::ELight;
+		light.p = soe.position;
+		light.shFrame = Frame(soe.normal);
+		light.mesh = mesh;
+		light.beta = mesh->getEmitter()->le() / pdfPos;
+		light.pdfFwd = pdfPos;
+		light.pdfRev = 0.f;
+		light.delta = false;
+
+		/* Emit into the hemisphere around the normal (cosine-weighted) */
+		Vector3f local = Warp::squareToCosineHemisphere(directionSample);
+		float pdfDir = Warp::squareToCosineHemispherePdf(local);
+		if (pdfDir == 0)
+			return 1;
+		Color3f beta = light.beta * Frame::cosTheta(local) / pdfDir;
+
+		return randomWalk(scene, sampler, Ray3f(soe.position, light.shFrame.toWorld(local)),
+			beta, pdfDir, m_maxDepth, true, path + 1) + 1;
+	}
+
+	/// Geometric term between two vertices including visibility
+	static float G(const Scene *scene, const PathVertex &v0, const PathVertex &v1) {
+		Vector3f d = v1.p - v0.p;
+		float dist2 = d.squaredNorm();
+		Ray3f shadowRay(v0.p, d, Epsilon, 1.f - Epsilon);
+		if (scene->rayIntersect(shadowRay))
+			return 0.f;
+		d /= std::sqrt(dist2);
+		float g = 1.f / dist2;
+		if (v0.isOnSurface())
+			g *= std::abs(v0.shFrame.n.dot(d));
+		if (v1.isOnSurface())
+			g *= std::abs(v1.shFrame.n.dot(d));
+		return g;
+	}
+
+	/// Contribution of the strategy using \c s light and \c t camera vertices
+	Color3f connect(const Scene *scene, Sampler *sampler, PathVertex *lightVertices,
+			PathVertex *cameraVertices, int s, int t, Point2f &pixel) const {
+		const PathVertex &pt = cameraVertices[t - 1];
+		PathVertex sampled;
+		Color3f L(0.0f);
+
+		if (s == 0) {
+			/* The camera subpath hit an emitter by itself */
+			if (pt.type == PathVertex::ESurface && pt.isEmitter())
+				L = pt.beta * pt.le(cameraVertices[t - 2]);
+		}
+		else if (t == 1) {
+			/* Connect the light subpath to the camera */
+			const PathVertex &qs = lightVertices[s - 1];
+			if (qs.delta)
+				return Color3f(0.0f);
+			Vector3f wi;
+			float dist, pdfDir;
+			Color3f we = scene->getCamera()->sampleImportance(qs.p, pixel, wi, dist, pdfDir);
+			if (we.isZero() || pdfDir == 0)
+				return Color3f(0.0f);
+
+			sampled.type = PathVertex::ECamera;
+			sampled.p = qs.p + wi * dist;
+			sampled.beta = we / pdfDir;
+			L = qs.beta * qs.f(sampled) * sampled.beta;
+			if (L.isZero())
+				return L;
+			L *= std::abs(qs.shFrame.n.dot(wi));
+			Ray3f shadowRay(qs.p, wi, Epsilon, dist * (1.f - Epsilon));
+			if (scene->rayIntersect(shadowRay))
+				return Color3f(0.0f);
+		}
+		else if (s == 1) {
+			/* Sample a fresh point on an emitter */
+			if (pt.delta)
+				return Color3f(0.0f);
+			const std::vector<Mesh *> &emitters = scene->getEmitterMeshes();
+			if (emitters.empty())
+				return Color3f(0.0f);
+			float uEmitter = sampler->next1D();
+			Point2f positionSample = sampler->next2D();
+			size_t index = std::min(static_cast<size_t>(uEmitter * emitters.size()), emitters.size() - 1);
+			const Mesh *mesh = emitters[index];
+			SampleOnEmitter soe = mesh->getEmitter()->sample(positionSample);
+
+			sampled.type = PathVertex::ELight;
+			sampled.p = soe.position;
+			sampled.shFrame = Frame(soe.normal);
+			sampled.mesh = mesh;
+			sampled.pdfFwd = pdfLightOrigin(scene, sampled);
+			sampled.beta = mesh->getEmitter()->le() / (emitterPdf(scene) * soe.probabilityDensity);
+			if (soe.normal.dot(pt.p - soe.position) <= 0)
+				return Color3f(0.0f);
+
+			L = pt.beta * pt.f(sampled) * sampled.beta;
+			if (L.isZero())
+				return L;
+			L *= G(scene, pt, sampled);
+		}
+		else {
+			/* Connect two interior vertices */
+			const PathVertex &qs = lightVertices[s - 1];
+			if (qs.delta || pt.delta)
+				return Color3f(0.0f);
+			L = qs.beta * qs.f(pt) * pt.f(qs) * pt.beta;
+			if (L.isZero())
+				return L;
+			L *= G(scene, qs, pt);
+		}
+
+		if (L.isZero())
+			return L;
+		return L * misWeight(scene, lightVertices, cameraVertices, sampled, s, t);
+	}
+
+	/**
+	 * \brief Balance heuristic weight of the strategy (s, t), computed from
+	 * the ratios of the densities of all other strategies that could have
+	 * produced the same path
+	 */
+	float misWeight(const Scene *scene, PathVertex *lightVertices, PathVertex *cameraVertices,
+			PathVertex &sampled, int s, int t) const {
+		if (s + t == 2)
+			return 1.f;
+
+		auto remap0 = [](float f) { return f != 0 ? f : 1.f; };
+
+		PathVertex *qs = s > 0 ? &lightVertices[s - 1] : nullptr,
+			*pt = t > 0 ? &cameraVertices[t - 1] : nullptr,
+			*qsMinus = s > 1 ? &lightVertices[s - 2] : nullptr,
+			*ptMinus = t > 1 ? &cameraVertices[t - 2] : nullptr;
+
+		/* Temporarily update the vertex properties for the connection */
+		ScopedAssignment<PathVertex> a1;
+		if (s == 1)
+			a1 = ScopedAssignment<PathVertex>(qs, sampled);
+		else if (t == 1)
+			a1 = ScopedAssignment<PathVertex>(pt, sampled);
+
+		ScopedAssignment<bool> a2, a3;
+		if (pt)
+			a2 = ScopedAssignment<bool>(&pt->delta, false);
+		if (qs)
+			a3 = ScopedAssignment<bool>(&qs->delta, false);
+
+		ScopedAssignment<float> a4;
+		if (pt)
+			a4 = ScopedAssignment<float>(&pt->pdfRev,
+				s > 0 ? pdf(scene, *qs, qsMinus, *pt) : pdfLightOrigin(scene, *pt));
+
+		ScopedAssignment<float> a5;
+		if (ptMinus)
+			a5 = ScopedAssignment<float>(&ptMinus->pdfRev,
+				s > 0 ? pdf(scene, *pt, qs, *ptMinus) : pdfLight(*pt, *ptMinus));
+
+		ScopedAssignment<float> a6;
+		if (qs)
+			a6 = ScopedAssignment<float>(&qs->pdfRev, pdf(scene, *pt, ptMinus, *qs));
+
+		ScopedAssignment<float> a7;
+		if (qsMinus)
+			a7 = ScopedAssignment<float>(&qsMinus->pdfRev, pdf(scene, *qs, pt, *qsMinus));
+
+		float sumRi = 0.f;
+
+		/* The pinhole camera cannot be hit, so the camera vertex itself is skipped */
+		float ri = 1.f;
+		for (int i = t - 1; i > 0; --i) {
+			ri *= remap0(cameraVertices[i].pdfRev) / remap0(cameraVertices[i].pdfFwd);
+			if (!cameraVertices[i].delta && !cameraVertices[i - 1].delta)
+				sumRi += ri;
+		}
+
+		ri = 1.f;
+		for (int i = s - 1; i >= 0; --i) {
+			ri *= remap0(lightVertices[i].pdfRev) / remap0(lightVertices[i].pdfFwd);
+			bool deltaPredecessor = i > 0 && lightVertices[i - 1].delta;
+			if (!lightVertices[i].delta && !deltaPredecessor)
+				sumRi += ri;
+		}
+
+		return 1.f / (1.f + sumRi);
+	}
+
+	/// Accumulate a light tracing contribution into the splat image
+	void splat(const Point2f &pixel, const Color3f &value) const {
+		int x = static_cast<int>(pixel.x()), y = static_cast<int>(pixel.y());
+		if (x < 0 || y < 0 || x >= m_lightImageSize.x() || y >= m_lightImageSize.y())
+			return;
+		std::atomic<float> *dest = &m_lightImage[3 * (y * m_lightImageSize.x() + x)];
+		for (int i = 0; i < 3; i++)
+			atomicAdd(dest[i], value[i]);
+	}
+
+	int m_maxDepth;
+	Vector2i m_lightImageSize;
+	std::unique_ptr<std::atomic<float>[]> m_lightImage;
+	mutable std::atomic<uint64_t> m_lightPaths;
+};
+
+NORI_REGISTER_CLASS(BDPTIntegrator, "bdpt")
+NORI_NAMESPACE_END
@@ -17,12 +17,15 @@
 */
 
 #include <nori/bitmap.h>
+#include <nori/aov.h>
 #include <ImfInputFile.h>
 #include <ImfOutputFile.h>
 #include <ImfChannelList.h>
 #include <ImfStringAttribute.h>
 #include <ImfVersion.h>
 #include <ImfIO.h>
+#include <ImfThreading.h>
+#include <tbb/parallel_for.h>
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb_image_write.h>
@@ -78,59 +81,122 @@ Bitmap::Bitmap(const std::string &filename) {
     file.readPixels(dw.min.y, dw.max.y);
 }
 
-void Bitmap::saveEXR(const std::string &filename) {
-    cout << "Writing a " << cols() << "x" << rows()
+EXRSettings::ECompression EXRSettings::compressionFromString(const std::string &name) {
+    static const char *names[] = { "none", "rle", "zips", "zip", "piz", "pxr24", "b44", "b44a", "dwaa", "dwab" };
+    std::string value = toLower(name);
+    for (int i=0; i<(int) (sizeof(names) / sizeof(names[0])); ++i) {
+        if (value == names[i])
+            return (ECompression) i;
+    }
+    throw NoriException("Unknown OpenEXR compression \"%s\" (expected none, rle, zips, zip, "
+        "piz, pxr24, b44, b44a, dwaa or dwab)", name);
+}
+
+void Bitmap::saveEXR(const std::string &filename, const AOVBuffer *aovs, const EXRSettings &settings) {
+    saveEXR(filename, Vector2i((int) cols(), (int) rows()), reinterpret_cast<const float *>(data()),
+        sizeof(Color3f), sizeof(Color3f) * cols(), aovs, settings);
+}
+
+void Bitmap::savePNG(const std::string &filename) {
+    savePNG(filename, Vector2i((int) cols(), (int) rows()), reinterpret_cast<const float *>(data()),
+        sizeof(Color3f), sizeof(Color3f) * cols());
+}
+
+void Bitmap::saveEXR(const std::string &filename, const Vector2i &size, const float *data,
+        size_t pixelStride, size_t rowStride, const AOVBuffer *aovs, const EXRSettings &settings) {
+    cout << "Writing a " << size.x() << "x" << size.y()
          << " OpenEXR file to \"" << filename << "\"" << endl;
 
     std::string path = filename + ".exr";
 
-    Imf::Header header((int) cols(), (int) rows());
+    Imf::Header header(size.x(), size.y());
     header.insert("comments", Imf::StringAttribute("Generated by Nori"));
+    header.compression() = (Imf::Compression) settings.compression;
 
+    /* OpenEXR converts the floats when the file stores halfs */
+    Imf::PixelType type = settings.half ? Imf::HALF : Imf::FLOAT;
     Imf::ChannelList &channels = header.channels();
-    channels.insert("R", Imf::Channel(Imf::FLOAT));
-    channels.insert("G", Imf::Channel(Imf::FLOAT));
-    channels.insert("B", Imf::Channel(Imf::FLOAT));
+    channels.insert("R", Imf::Channel(type));
+    channels.insert("G", Imf::Channel(type));
+    channels.insert("B", Imf::Channel(type));
 
+    /* OpenEXR only reads from the frame buffer */
     Imf::FrameBuffer frameBuffer;
-    size_t compStride = sizeof(float),
-           pixelStride = 3 * compStride,
-           rowStride = pixelStride * cols();
-
-    char *ptr = reinterpret_cast<char *>(data());
+    size_t compStride = sizeof(float);
+    char *ptr = reinterpret_cast<char *>(const_cast<float *>(data));
     frameBuffer.insert("R", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride)); ptr += compStride;
     frameBuffer.insert("G", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride)); ptr += compStride;
     frameBuffer.insert("B", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride));
 
-    Imf::OutputFile file(path.c_str(), header);
+    /* Every output variable channel is a separate plane */
+    std::vector<float> planes;
+    if (aovs) {
+        if (aovs->getSize() != size)
+            throw NoriException("Bitmap::saveEXR(): the output variables have a different size!");
+        std::vector<std::string> names = aovs->getChannelNames();
+        planes = aovs->resolve();
+        for (size_t i=0; i<names.size(); ++i) {
+            /* Mesh IDs and sample counts would lose precision as halfs */
+            bool exact = endsWith(names[i], ".ID") || endsWith(names[i], ".N");
+            channels.insert(names[i], Imf::Channel(exact ? Imf::FLOAT : type));
+            frameBuffer.insert(names[i], Imf::Slice(Imf::FLOAT,
+                reinterpret_cast<char *>(planes.data() + i * size.x() * size.y()),
+                compStride, compStride * size.x()));
+        }
+    }
+
+    /* Compression uses OpenEXR's global thread pool */
+    Imf::OutputFile file(path.c_str(), header, Imf::globalThreadCount());
     file.setFrameBuffer(frameBuffer);
-    file.writePixels((int) rows());
+    file.writePixels(size.y());
 }
 
-void Bitmap::savePNG(const std::string &filename) {
-    cout << "Writing a " << cols() << "x" << rows()
+/// Convert a linear value to an 8 bit sRGB value using a lookup table
+static inline uint8_t toSRGB8(float value) {
+    static const int resolution = 65536;
+    static const std::vector<uint8_t> table = [] {
+        std::vector<uint8_t> result(resolution);
+        for (int i=0; i<resolution; ++i) {
+            float srgb = Color3f(i / (float) (resolution - 1)).toSRGB()[0];
+            result[i] = (uint8_t) clamp(255.f * srgb, 0.f, 255.f);
+        }
+        return result;
+    }();
+
+    /* Also maps NaNs to zero */
+    if (!(value > 0.0f))
+        return 0;
+    else if (value >= 1.0f)
+        return 255;
+    return table[(int) (value * (resolution - 1) + 0.5f)];
+}
+
+void Bitmap::savePNG(const std::string &filename, const Vector2i &size, const float *data,
+        size_t pixelStride, size_t rowStride) {
+    cout << "Writing a " << size.x() << "x" << size.y()
          << " PNG file to \"" << filename << "\"" << endl;
 
     std::string path = filename + ".png";
 
-    uint8_t *rgb8 = new uint8_t[3 * cols() * rows()];
-    uint8_t *dst = rgb8;
-    for (int i = 0; i < rows(); ++i) {
-        for (int j = 0; j < cols(); ++j) {
-            Color3f tonemapped = coeffRef(i, j).toSRGB();
-            dst[0] = (uint8_t) clamp(255.f * tonemapped[0], 0.f, 255.f);
-            dst[1] = (uint8_t) clamp(255.f * tonemapped[1], 0.f, 255.f);
-            dst[2] = (uint8_t) clamp(255.f * tonemapped[2], 0.f, 255.f);
+    std::unique_ptr<uint8_t[]> rgb8(new uint8_t[3 * (size_t) size.x() * size.y()]);
+    const char *base = reinterpret_cast<const char *>(data);
+    tbb::parallel_for(0, size.y(), [&](int y) {
+        const char *src = base + y * rowStride;
+        uint8_t *dst = rgb8.get() + 3 * (size_t) y * size.x();
+        for (int x = 0; x < size.x(); ++x) {
+            const float *pixel = reinterpret_cast<const float *>(src);
+            dst[0] = toSRGB8(pixel[0]);
+            dst[1] = toSRGB8(pixel[1]);
+            dst[2] = toSRGB8(pixel[2]);
+            src += pixelStride;
             dst += 3;
         }
-    }
+    });
 
-    int ret = stbi_write_png(path.c_str(), cols(), rows(), 3, rgb8, 3 * cols());
+    int ret = stbi_write_png(path.c_str(), size.x(), size.y(), 3, rgb8.get(), 3 * size.x());
     if (ret == 0) {
-        cout << "Bitmap::savePNG(): Could not save PNG file \"" << path << "%s\"" << endl;
+        cout << "Bitmap::savePNG(): Could not save PNG file \"" << path << "\"" << endl;
     }
-
-    delete[] rgb8;
 }
 
 NORI_NAMESPACE_END
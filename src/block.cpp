@@ -42,10 +42,15 @@ ImageBlock::ImageBlock(const Vector2i &size, const ReconstructionFilter *filter)
         m_weightsY = new float[weightSize];
         memset(m_weightsX, 0, sizeof(float) * weightSize);
         memset(m_weightsY, 0, sizeof(float) * weightSize);
+
+        /* Samples within a pixel reach at most this far */
+        m_footprintRadius = (int) std::floor(m_filterRadius + 0.5f);
+        m_footprint.resize(2*m_footprintRadius + 1, 2*m_footprintRadius + 1);
     }
 
     /* Allocate space for pixels and border regions */
     resize(size.y() + 2*m_borderSize, size.x() + 2*m_borderSize);
+    m_rowLocks.reset(new tbb::spin_mutex[(rows() + NORI_BLOCK_ROWS_PER_LOCK - 1) / NORI_BLOCK_ROWS_PER_LOCK]);
 }
 
 ImageBlock::~ImageBlock() {
@@ -56,12 +61,33 @@ ImageBlock::~ImageBlock() {
 
 Bitmap *ImageBlock::toBitmap() const {
     Bitmap *result = new Bitmap(m_size);
-    for (int y=0; y<m_size.y(); ++y)
+    tbb::parallel_for(0, m_size.y(), [&](int y) {
         for (int x=0; x<m_size.x(); ++x)
             result->coeffRef(y, x) = coeff(y + m_borderSize, x + m_borderSize).divideByFilterWeight();
+    });
     return result;
 }
 
+void ImageBlock::normalize() {
+    tbb::parallel_for(0, (int) rows(), [&](int y) {
+        for (int x=0; x<cols(); ++x) {
+            Color4f &value = coeffRef(y, x);
+            if (value.w() != 0)
+                value = Color4f(value.divideByFilterWeight());
+        }
+    });
+}
+
+void ImageBlock::saveEXR(const std::string &filename, const EXRSettings &settings) const {
+    Bitmap::saveEXR(filename, m_size, reinterpret_cast<const float *>(&coeff(m_borderSize, m_borderSize)),
+        sizeof(Color4f), sizeof(Color4f) * cols(), m_aovs.get(), settings);
+}
+
+void ImageBlock::savePNG(const std::string &filename) const {
+    Bitmap::savePNG(filename, m_size, reinterpret_cast<const float *>(&coeff(m_borderSize, m_borderSize)),
+        sizeof(Color4f), sizeof(Color4f) * cols());
+}
+
 void ImageBlock::fromBitmap(const Bitmap &bitmap) {
     if (bitmap.cols() != cols() || bitmap.rows() != rows())
         throw NoriException("Invalid bitmap dimensions!");
@@ -78,18 +104,105 @@ void ImageBlock::put(const Point2f &_pos, const Color3f &value) {
         return;
     }
 
+    if (m_deferred) {
+        m_samples.push_back(Sample { _pos, value });
+        return;
+    }
+
     /* Convert to pixel coordinates within the image block */
     Point2f pos(
         _pos.x() - 0.5f - (m_offset.x() - m_borderSize),
         _pos.y() - 0.5f - (m_offset.y() - m_borderSize)
     );
 
+    splat(pos, Color4f(value), data(), Point2i(0, 0), Vector2i((int) cols(), (int) rows()));
+}
+
+void ImageBlock::resolve() {
+    Point2i origin(0, 0);
+    Vector2i size((int) cols(), (int) rows());
+
+    for (const Sample &sample : m_samples) {
+        Point2f pos(
+            sample.position.x() - 0.5f - (m_offset.x() - m_borderSize),
+            sample.position.y() - 0.5f - (m_offset.y() - m_borderSize)
+        );
+        splat(pos, Color4f(sample.value), data(), origin, size);
+    }
+    m_samples.clear();
+}
+
+void ImageBlock::put(const Point2i &pixel, const Point2f *positions, const Color3f *values, size_t count) {
+    if (m_deferred) {
+        for (size_t i=0; i<count; ++i)
+            put(positions[i], values[i]);
+        return;
+    }
+
+    /* Block pixel at the upper left corner of the footprint */
+    int radius = m_footprintRadius;
+    Point2i origin(
+        pixel.x() - (m_offset.x() - m_borderSize) - radius,
+        pixel.y() - (m_offset.y() - m_borderSize) - radius
+    );
+    Vector2i size((int) m_footprint.cols(), (int) m_footprint.rows());
+
+    m_footprint.setConstant(Color4f());
+    for (size_t i=0; i<count; ++i) {
+        if (!values[i].isValid()) {
+            cerr << "Integrator: computed an invalid radiance value: " << values[i].toString() << endl;
+            continue;
+        }
+        Point2f pos(
+            positions[i].x() - 0.5f - (m_offset.x() - m_borderSize),
+            positions[i].y() - 0.5f - (m_offset.y() - m_borderSize)
+        );
+        splat(pos, Color4f(values[i]), m_footprint.data(), origin, size);
+    }
+
+    /* Add the footprint to the block (everything outside of the block and
+       its border has a weight of zero) */
+    BoundingBox2i bbox(origin, origin + size - Vector2i(1));
+    bbox.clip(BoundingBox2i(Point2i(0, 0), Point2i((int) cols() - 1, (int) rows() - 1)));
+    if (!bbox.isValid())
+        return;
+    Vector2i extents = bbox.max - bbox.min + Vector2i(1);
+    block(bbox.min.y(), bbox.min.x(), extents.y(), extents.x()) +=
+        m_footprint.block(bbox.min.y() - origin.y(), bbox.min.x() - origin.x(), extents.y(), extents.x());
+}
+
+/// Add a sample to a square of W x W pixels (loops are unrolled by the compiler)
+template <int W> static void splatFixed(Color4f *target, int stride, const Color4f &value,
+        const float *weightsX, const float *weightsY) {
+    for (int y=0; y<W; ++y) {
+        Color4f valueY = value * weightsY[y];
+        Color4f *row = target + y * stride;
+        for (int x=0; x<W; ++x)
+            row[x] += valueY * weightsX[x];
+    }
+}
+
+void ImageBlock::splat(const Point2f &pos, const Color4f &value, Color4f *target,
+        const Point2i &origin, const Vector2i &size) {
+    if (m_filterRadius <= 0.5f) {
+        /* Box-like filters: only the nearest pixel can receive a nonzero weight */
+        Point2i p((int) std::floor(pos.x() + 0.5f), (int) std::floor(pos.y() + 0.5f));
+        int ix = std::min((int) (std::abs(p.x() - pos.x()) * m_lookupFactor), NORI_FILTER_RESOLUTION),
+            iy = std::min((int) (std::abs(p.y() - pos.y()) * m_lookupFactor), NORI_FILTER_RESOLUTION);
+        p -= origin;
+        if (p.x() >= 0 && p.y() >= 0 && p.x() < size.x() && p.y() < size.y())
+            target[p.y() * size.x() + p.x()] += value * (m_filter[ix] * m_filter[iy]);
+        return;
+    }
+
     /* Compute the rectangle of pixels that will need to be updated */
     BoundingBox2i bbox(
         Point2i((int)  std::ceil(pos.x() - m_filterRadius), (int)  std::ceil(pos.y() - m_filterRadius)),
         Point2i((int) std::floor(pos.x() + m_filterRadius), (int) std::floor(pos.y() + m_filterRadius))
     );
-    bbox.clip(BoundingBox2i(Point2i(0, 0), Point2i((int) cols() - 1, (int) rows() - 1)));
+    bbox.clip(BoundingBox2i(origin, origin + size - Vector2i(1)));
+    if (!bbox.isValid())
+        return;
 
     /* Lookup values from the pre-rasterized filter */
     for (int x=bbox.min.x(), idx = 0; x<=bbox.max.x(); ++x)
@@ -97,9 +210,27 @@ void ImageBlock::put(const Point2f &_pos, const Color3f &value) {
     for (int y=bbox.min.y(), idx = 0; y<=bbox.max.y(); ++y)
         m_weightsY[idx++] = m_filter[(int) (std::abs(y-pos.y()) * m_lookupFactor)];
 
-    for (int y=bbox.min.y(), yr=0; y<=bbox.max.y(); ++y, ++yr) 
-        for (int x=bbox.min.x(), xr=0; x<=bbox.max.x(); ++x, ++xr) 
-            coeffRef(y, x) += Color4f(value) * m_weightsX[xr] * m_weightsY[yr];
+    int stride = size.x();
+    Color4f *base = target + (bbox.min.y() - origin.y()) * stride + (bbox.min.x() - origin.x());
+    Vector2i extents = bbox.max - bbox.min + Vector2i(1);
+
+    /* Fixed-size code paths for the footprints of common filter radii */
+    if (extents.x() == extents.y()) {
+        switch (extents.x()) {
+            case 2: splatFixed<2>(base, stride, value, m_weightsX, m_weightsY); return;
+            case 3: splatFixed<3>(base, stride, value, m_weightsX, m_weightsY); return;
+            case 4: splatFixed<4>(base, stride, value, m_weightsX, m_weightsY); return;
+            case 5: splatFixed<5>(base, stride, value, m_weightsX, m_weightsY); return;
+            default: break;
+        }
+    }
+
+    for (int y=0; y<extents.y(); ++y) {
+        Color4f valueY = value * m_weightsY[y];
+        Color4f *row = base + y * stride;
+        for (int x=0; x<extents.x(); ++x)
+            row[x] += valueY * m_weightsX[x];
+    }
 }
     
 void ImageBlock::put(ImageBlock &b) {
@@ -107,10 +238,46 @@ void ImageBlock::put(ImageBlock &b) {
         Vector2i::Constant(m_borderSize - b.getBorderSize());
     Vector2i size   = b.getSize()   + Vector2i(2*b.getBorderSize());
 
-    tbb::mutex::scoped_lock lock(m_mutex);
+    tbb::spin_rw_mutex::scoped_lock lock(m_mutex, false);
+
+    /* Output variables have no border, hence every pixel has a single owner */
+    if (m_aovs && b.m_aovs)
+        m_aovs->put(*b.m_aovs, b.getOffset() - m_offset, b.getSize());
+
+    /* Neighboring blocks reach up to one border width into the interior
+       of this block, hence only pixels that are farther away from the
+       edges are exclusively owned by it */
+    int margin = 2 * b.getBorderSize();
+    Vector2i coreSize = size - Vector2i::Constant(2 * margin);
+    if ((coreSize.array() <= 0).any()) {
+        margin = size.maxCoeff();
+        coreSize = Vector2i::Zero();
+    } else {
+        block(offset.y() + margin, offset.x() + margin, coreSize.y(), coreSize.x())
+            += b.block(margin, margin, coreSize.y(), coreSize.x());
+        if (margin == 0)
+            return;
+    }
 
-    block(offset.y(), offset.x(), size.y(), size.x()) 
-        += b.topLeftCorner(size.y(), size.x());
+    /* Add the surrounding band row by row under the lock of the row */
+    for (int y=0; y<size.y(); ++y) {
+        int row = offset.y() + y;
+        tbb::spin_mutex::scoped_lock rowLock(m_rowLocks[row / NORI_BLOCK_ROWS_PER_LOCK]);
+        if (y < margin || y >= size.y() - margin) {
+            block(row, offset.x(), 1, size.x()) += b.block(y, 0, 1, size.x());
+        } else {
+            block(row, offset.x(), 1, margin) += b.block(y, 0, 1, margin);
+            block(row, offset.x() + size.x() - margin, 1, margin)
+                += b.block(y, size.x() - margin, 1, margin);
+        }
+    }
+}
+
+void ImageBlock::setAOVs(const std::vector<AOVBuffer::EType> &types) {
+    if (types.empty())
+        m_aovs.reset();
+    else
+        m_aovs.reset(new AOVBuffer(Vector2i((int) cols(), (int) rows()) - Vector2i(2*m_borderSize), types));
 }
 
 std::string ImageBlock::toString() const {
@@ -118,49 +285,168 @@ std::string ImageBlock::toString() const {
         m_offset.toString(), m_size.toString());
 }
 
-BlockGenerator::BlockGenerator(const Vector2i &size, int blockSize)
-        : m_size(size), m_blockSize(blockSize) {
+BlockGenerator::BlockGenerator(const Vector2i &size, int blockSize, EOrder order, int tailSize,
+        int firstTile, int lastTile)
+        : m_size(size), m_blockSize(blockSize), m_firstTile(firstTile), m_lastTile(lastTile), m_next(0) {
+    if (blockSize <= 0)
+        throw NoriException("BlockGenerator: the block size must be positive!");
+
     m_numBlocks = Vector2i(
         (int) std::ceil(size.x() / (float) blockSize),
         (int) std::ceil(size.y() / (float) blockSize));
-    m_blocksLeft = m_numBlocks.x() * m_numBlocks.y();
-    m_direction = ERight;
-    m_block = Point2i(m_numBlocks / 2);
-    m_stepsLeft = 1;
-    m_numSteps = 1;
+    if (m_lastTile < 0)
+        m_lastTile = m_numBlocks.x() * m_numBlocks.y();
+    m_blocks.reserve(m_numBlocks.x() * m_numBlocks.y());
+
+    switch (order) {
+        case ESpiral: generateSpiral(); break;
+        case EHilbert: generateHilbert(); break;
+        case EMorton: generateMorton(); break;
+        case EScanline:
+            for (int y=0; y<m_numBlocks.y(); ++y)
+                for (int x=0; x<m_numBlocks.x(); ++x)
+                    append(Point2i(x, y));
+            break;
+    }
+
+    if (tailSize > 0)
+        splitTail(tailSize);
 }
 
 bool BlockGenerator::next(ImageBlock &block) {
-    tbb::mutex::scoped_lock lock(m_mutex);
-
-    if (m_blocksLeft == 0)
+    int index = m_next.fetch_add(1);
+    if (index >= (int) m_blocks.size())
         return false;
 
-    Point2i pos = m_block * m_blockSize;
-    block.setOffset(pos);
-    block.setSize((m_size - pos).cwiseMin(Vector2i::Constant(m_blockSize)));
+    block.setOffset(m_blocks[index].offset);
+    block.setSize(m_blocks[index].size);
+    return true;
+}
+
+void BlockGenerator::append(const Point2i &block) {
+    int index = block.y() * m_numBlocks.x() + block.x();
+    if (index < m_firstTile || index >= m_lastTile)
+        return;
+
+    Point2i pos = block * m_blockSize;
+    m_blocks.push_back(Block { pos, (m_size - pos).cwiseMin(Vector2i::Constant(m_blockSize)) });
+}
 
-    if (--m_blocksLeft == 0)
-        return true;
+void BlockGenerator::splitTail(int tailSize) {
+    size_t first = m_blocks.size() > (size_t) tailSize ? m_blocks.size() - tailSize : 0;
 
-    do {
-        switch (m_direction) {
-            case ERight: ++m_block.x(); break;
-            case EDown:  ++m_block.y(); break;
-            case ELeft:  --m_block.x(); break;
-            case EUp:    --m_block.y(); break;
+    while (first < m_blocks.size()) {
+        std::vector<Block> tail;
+        for (size_t i=first; i<m_blocks.size(); ++i) {
+            const Block &block = m_blocks[i];
+
+            /* Split into halves along the axes that are large enough */
+            Vector2i half(
+                block.size.x() >= 2 * NORI_MIN_BLOCK_SIZE ? (block.size.x() + 1) / 2 : block.size.x(),
+                block.size.y() >= 2 * NORI_MIN_BLOCK_SIZE ? (block.size.y() + 1) / 2 : block.size.y());
+            for (int y=0; y<block.size.y(); y += half.y())
+                for (int x=0; x<block.size.x(); x += half.x())
+                    tail.push_back(Block { block.offset + Vector2i(x, y),
+                        (block.size - Vector2i(x, y)).cwiseMin(half) });
         }
 
-        if (--m_stepsLeft == 0) {
-            m_direction = (m_direction + 1) % 4;
-            if (m_direction == ELeft || m_direction == ERight) 
-                ++m_numSteps;
-            m_stepsLeft = m_numSteps;
+        /* Stop once none of the blocks can be split anymore */
+        if (tail.size() == m_blocks.size() - first)
+            break;
+
+        m_blocks.resize(first);
+        m_blocks.insert(m_blocks.end(), tail.begin(), tail.end());
+        first = m_blocks.size() > (size_t) tailSize ? m_blocks.size() - tailSize : 0;
+    }
+}
+
+BlockGenerator::EOrder BlockGenerator::orderFromString(const std::string &name) {
+    std::string value = toLower(name);
+    if (value == "spiral")
+        return ESpiral;
+    else if (value == "scanline")
+        return EScanline;
+    else if (value == "hilbert")
+        return EHilbert;
+    else if (value == "morton")
+        return EMorton;
+    throw NoriException("Unknown block order \"%s\" (expected spiral, "
+        "scanline, hilbert or morton)!", name);
+}
+
+void BlockGenerator::generateSpiral() {
+    int blockCount = m_numBlocks.x() * m_numBlocks.y();
+    if (blockCount == 0)
+        return;
+
+    Point2i block(m_numBlocks / 2);
+    int direction = ERight, numSteps = 1, stepsLeft = 1, visited = 0;
+
+    while (true) {
+        append(block);
+        if (++visited == blockCount)
+            break;
+
+        do {
+            switch (direction) {
+                case ERight: ++block.x(); break;
+                case EDown:  ++block.y(); break;
+                case ELeft:  --block.x(); break;
+                case EUp:    --block.y(); break;
+            }
+
+            if (--stepsLeft == 0) {
+                direction = (direction + 1) % 4;
+                if (direction == ELeft || direction == ERight) 
+                    ++numSteps;
+                stepsLeft = numSteps;
+            }
+        } while ((block.array() < 0).any() ||
+                 (block.array() >= m_numBlocks.array()).any());
+    }
+}
+
+void BlockGenerator::generateHilbert() {
+    int n = 1;
+    while (n < m_numBlocks.maxCoeff())
+        n *= 2;
+
+    /* Walk the curve over the enclosing power-of-two grid and skip
+       the positions outside of the image */
+    for (int d=0; d<n*n; ++d) {
+        int x = 0, y = 0;
+        for (int s=1, t=d; s<n; s *= 2, t /= 4) {
+            int rx = 1 & (t / 2), ry = 1 & (t ^ rx);
+            if (ry == 0) {
+                if (rx == 1) {
+                    x = s - 1 - x;
+                    y = s - 1 - y;
+                }
+                std::swap(x, y);
+            }
+            x += s * rx;
+            y += s * ry;
         }
-    } while ((m_block.array() < 0).any() ||
-             (m_block.array() >= m_numBlocks.array()).any());
+        if (x < m_numBlocks.x() && y < m_numBlocks.y())
+            append(Point2i(x, y));
+    }
+}
 
-    return true;
+void BlockGenerator::generateMorton() {
+    int n = 1;
+    while (n < m_numBlocks.maxCoeff())
+        n *= 2;
+
+    for (int d=0; d<n*n; ++d) {
+        /* De-interleave the bits of the index */
+        int x = 0, y = 0;
+        for (int bit=0; (1 << (2*bit)) < n*n; ++bit) {
+            x |= ((d >> (2*bit)) & 1) << bit;
+            y |= ((d >> (2*bit + 1)) & 1) << bit;
+        }
+        if (x < m_numBlocks.x() && y < m_numBlocks.y())
+            append(Point2i(x, y));
+    }
 }
 
 NORI_NAMESPACE_END
@@ -0,0 +1,424 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/block.h>
+#include <nori/rfilter.h>
+#include <nori/bbox.h>
+#include <tbb/parallel_for.h>
+#include <pcg32.h>
+#include <memory>
+#include <limits>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Consistency tests of image blocks
+ *
+ * Splats random samples into a block, both one at a time and in batches
+ * of one pixel, and compares the result with the generic splatting loop
+ * over the tabulated filter (up to the rounding errors of the different
+ * order of the additions). This covers the fixed-size code paths of
+ * small footprints and the nearest-pixel path of box-like filters.
+ *
+ * Furthermore, the test merges the blocks of several passes over an image (including the
+ * smaller blocks at the tail of each pass) from many threads at once
+ * and compares the result with adding the blocks one after another. All
+ * values are small integers, so that the sums don't depend on the order
+ * of the additions and the images must be identical bit by bit. Block
+ * sizes below twice the border of the filter have no region that is
+ * merged without a lock.
+ *
+ * The test is repeated for every given reconstruction filter (by
+ * default: gaussian, mitchell, tent and box) and block size.
+ *
+ * Finally, the block generator must hand out every pixel exactly once
+ * in all block orders, also for non-square images whose size isn't a
+ * multiple of the block size, and for ranges of tiles (as rendered by
+ * "nori --tiles"). When the last blocks are split, no block may be
+ * smaller than \ref NORI_MIN_BLOCK_SIZE (unless its tile is) or cross the
+ * edge of a tile, and the last blocks must not be splittable anymore.
+ */
+class BlockTest : public NoriObject {
+public:
+    BlockTest(const PropertyList &propList) {
+        /* Size of the image that the blocks are merged into */
+        m_size.x() = propList.getInteger("width", 45);
+        m_size.y() = propList.getInteger("height", 29);
+
+        /* Block sizes of the merge test */
+        std::vector<std::string> blockSizes = tokenize(propList.getString("blockSizes", "3, 8, 13, 17, 32"));
+        for (auto blockSize : blockSizes)
+            m_blockSizes.push_back(toInt(blockSize));
+
+        /* Number of passes over the image, whose blocks are merged concurrently */
+        m_passes = propList.getInteger("passes", 4);
+
+        /* Numbers of blocks at the end of the generator tests that are split */
+        std::vector<std::string> tailSizes = tokenize(propList.getString("tailSizes", "0, 1, 8, 64"));
+        for (auto tailSize : tailSizes)
+            m_tailSizes.push_back(toInt(tailSize));
+
+        /* Number of samples per pixel of the splatting test */
+        m_sampleCount = propList.getInteger("sampleCount", 8);
+    }
+
+    virtual ~BlockTest() {
+        for (auto filter : m_filters)
+            delete filter;
+    }
+
+    void addChild(NoriObject *obj) {
+        switch (obj->getClassType()) {
+            case EReconstructionFilter:
+                m_filters.push_back(static_cast<ReconstructionFilter *>(obj));
+                break;
+
+            default:
+                throw NoriException("BlockTest::addChild(<%s>) is not supported!",
+                    classTypeName(obj->getClassType()));
+        }
+    }
+
+    /// Run the tests
+    void activate() {
+        if (m_filters.empty()) {
+            const char *names[] = { "gaussian", "mitchell", "tent", "box" };
+            for (auto name : names)
+                m_filters.push_back(static_cast<ReconstructionFilter *>(
+                    NoriObjectFactory::createInstance(name, PropertyList())));
+        }
+
+        int total = 0, passed = 0;
+
+        for (auto filter : m_filters) {
+            for (int blockSize : m_blockSizes) {
+                cout << "------------------------------------------------------" << endl;
+                cout << "Testing splatting into a " << blockSize << "x" << blockSize
+                     << " block with " << filter->toString() << " .. " << endl;
+                ++total;
+                if (testSplat(filter, blockSize))
+                    ++passed;
+            }
+            for (int blockSize : m_blockSizes) {
+                cout << "------------------------------------------------------" << endl;
+                cout << "Testing concurrent merges of " << blockSize << "x" << blockSize
+                     << " blocks with " << filter->toString() << " .. " << endl;
+                ++total;
+                if (testMerge(filter, blockSize))
+                    ++passed;
+            }
+        }
+
+        const char *orders[] = { "spiral", "scanline", "hilbert", "morton" };
+        for (auto order : orders) {
+            for (int blockSize : m_blockSizes) {
+                cout << "------------------------------------------------------" << endl;
+                cout << "Testing the " << order << " order of " << blockSize << "x"
+                     << blockSize << " blocks .. " << endl;
+                ++total;
+                if (testGenerator(BlockGenerator::orderFromString(order), blockSize))
+                    ++passed;
+            }
+        }
+
+        cout << "Passed " << passed << "/" << total << " tests." << endl;
+        if (passed < total)
+            throw std::runtime_error("Some tests failed :(");
+    }
+
+    std::string toString() const {
+        std::string blockSizes;
+        for (size_t i=0; i<m_blockSizes.size(); ++i)
+            blockSizes += (i > 0 ? ", " : "") + std::to_string(m_blockSizes[i]);
+        std::string tailSizes;
+        for (size_t i=0; i<m_tailSizes.size(); ++i)
+            tailSizes += (i > 0 ? ", " : "") + std::to_string(m_tailSizes[i]);
+        return tfm::format(
+            "BlockTest[\n"
+            "  size = %i x %i,\n"
+            "  blockSizes = {%s},\n"
+            "  tailSizes = {%s},\n"
+            "  passes = %i,\n"
+            "  sampleCount = %i\n"
+            "]",
+            m_size.x(), m_size.y(),
+            blockSizes,
+            tailSizes,
+            m_passes,
+            m_sampleCount
+        );
+    }
+
+    EClassType getClassType() const { return ETest; }
+private:
+    /// Splat samples one at a time and in batches and compare with the generic loop
+    bool testSplat(const ReconstructionFilter *filter, int blockSize) {
+        ImageBlock single(Vector2i(blockSize), filter), batched(Vector2i(blockSize), filter),
+                   reference(Vector2i(blockSize), filter);
+        Point2i offset(5, 3);
+        for (ImageBlock *block : { &single, &batched, &reference }) {
+            block->setOffset(offset);
+            block->clear();
+        }
+
+        /* Tabulate the filter like the image block */
+        float radius = filter->getRadius();
+        std::vector<float> table(NORI_FILTER_RESOLUTION + 1);
+        for (int i=0; i<NORI_FILTER_RESOLUTION; ++i)
+            table[i] = filter->eval((radius * i) / NORI_FILTER_RESOLUTION);
+        table[NORI_FILTER_RESOLUTION] = 0.0f;
+        float lookupFactor = NORI_FILTER_RESOLUTION / radius;
+        int border = reference.getBorderSize();
+
+        pcg32 random;
+        std::vector<Point2f> positions(m_sampleCount);
+        std::vector<Color3f> values(m_sampleCount);
+        for (int y=0; y<blockSize; ++y) {
+            for (int x=0; x<blockSize; ++x) {
+                Point2i pixel = offset + Vector2i(x, y);
+                for (int i=0; i<m_sampleCount; ++i) {
+                    /* Include the corner and the center, where the footprint
+                       touches the most and the fewest pixels */
+                    Vector2f sample(random.nextFloat(), random.nextFloat());
+                    if (i < 2)
+                        sample = Vector2f(0.5f * i);
+                    positions[i] = pixel.cast<float>() + sample;
+                    values[i] = Color3f(random.nextFloat(), random.nextFloat(), random.nextFloat());
+
+                    single.put(positions[i], values[i]);
+
+                    /* Generic loop over all pixels within the filter radius */
+                    Point2f pos = positions[i] - Vector2f(0.5f) - (offset - Vector2i(border)).cast<float>();
+                    BoundingBox2i bbox(
+                        Point2i((int)  std::ceil(pos.x() - radius), (int)  std::ceil(pos.y() - radius)),
+                        Point2i((int) std::floor(pos.x() + radius), (int) std::floor(pos.y() + radius))
+                    );
+                    bbox.clip(BoundingBox2i(Point2i(0, 0), Point2i((int) reference.cols() - 1, (int) reference.rows() - 1)));
+                    if (!bbox.isValid())
+                        continue;
+                    for (int py=bbox.min.y(); py<=bbox.max.y(); ++py) {
+                        for (int px=bbox.min.x(); px<=bbox.max.x(); ++px) {
+                            int ix = std::min((int) (std::abs(px - pos.x()) * lookupFactor), NORI_FILTER_RESOLUTION),
+                                iy = std::min((int) (std::abs(py - pos.y()) * lookupFactor), NORI_FILTER_RESOLUTION);
+                            reference.coeffRef(py, px) += Color4f(values[i]) * (table[ix] * table[iy]);
+                        }
+                    }
+                }
+                batched.put(pixel, positions.data(), values.data(), positions.size());
+            }
+        }
+
+        int errors = 0;
+        for (int y=0; y<reference.rows(); ++y) {
+            for (int x=0; x<reference.cols(); ++x) {
+                const Color4f &expected = reference.coeff(y, x);
+                for (const ImageBlock *block : { &single, &batched }) {
+                    const Color4f &value = block->coeff(y, x);
+                    if (((value - expected).abs() > 1e-5f * expected.abs().max(1.0f)).any()) {
+                        if (errors++ < 5)
+                            cout << "Pixel (" << x - border + offset.x() << ", " << y - border + offset.y()
+                                 << ") of the " << (block == &single ? "single" : "batched")
+                                 << " samples: expected " << expected.toString() << ", got "
+                                 << value.toString() << endl;
+                    }
+                }
+            }
+        }
+
+        if (errors > 0)
+            cout << errors << " values differ!" << endl;
+        cout << (errors == 0 ? "Accepted the splatted samples." : "Rejected the splatted samples.") << endl;
+        return errors == 0;
+    }
+
+    /// Merge the blocks of several passes concurrently and one after another
+    bool testMerge(const ReconstructionFilter *filter, int blockSize) {
+        /* Split the last blocks of the pass like the renderer does */
+        BlockGenerator generator(m_size, blockSize, BlockGenerator::ESpiral, 8);
+        std::vector<std::unique_ptr<ImageBlock>> blocks;
+        std::unique_ptr<ImageBlock> block(new ImageBlock(Vector2i(blockSize), filter));
+        std::vector<AOVBuffer::EType> aovs = { AOVBuffer::EAlbedo, AOVBuffer::EMeshID };
+        while (generator.next(*block)) {
+            blocks.push_back(std::move(block));
+            block.reset(new ImageBlock(Vector2i(blockSize), filter));
+        }
+
+        int border = blocks.empty() ? 0 : blocks[0]->getBorderSize();
+        cout << blocks.size() << " blocks, border " << border
+             << (blockSize < 2 * border ? " (no lock-free region)" : "") << endl;
+
+        ImageBlock concurrent(m_size, filter), serial(m_size, filter);
+        concurrent.clear();
+        serial.clear();
+        concurrent.setAOVs(aovs);
+        serial.setAOVs(aovs);
+
+        for (int pass=0; pass<m_passes; ++pass) {
+            for (size_t i=0; i<blocks.size(); ++i) {
+                ImageBlock &b = *blocks[i];
+                b.setAOVs(aovs);
+                b.clear();
+
+                pcg32 random;
+                random.seed((uint64_t) i, (uint64_t) pass);
+                Vector2i size = b.getSize() + Vector2i(2 * border);
+                for (int y=0; y<size.y(); ++y)
+                    for (int x=0; x<size.x(); ++x)
+                        b.coeffRef(y, x) = Color4f((float) random.nextUInt(256), (float) random.nextUInt(256),
+                            (float) random.nextUInt(256), (float) (random.nextUInt(16) + 1));
+
+                AOVRecord record;
+                for (int y=0; y<b.getSize().y(); ++y) {
+                    for (int x=0; x<b.getSize().x(); ++x) {
+                        record.albedo = Color3f((float) random.nextUInt(256));
+                        record.meshID = (int) random.nextUInt(8);
+                        b.getAOVs()->put(Point2i(x, y), record);
+                    }
+                }
+            }
+
+            /* The interiors of the blocks of a pass don't overlap */
+            tbb::parallel_for(0, (int) blocks.size(), [&](int i) {
+                concurrent.put(*blocks[i]);
+            });
+
+            /* Reference: add the whole region of every block, one after another */
+            for (auto &b : blocks) {
+                Vector2i size = b->getSize() + Vector2i(2 * border);
+                serial.block(b->getOffset().y(), b->getOffset().x(), size.y(), size.x())
+                    += b->block(0, 0, size.y(), size.x());
+                serial.getAOVs()->put(*b->getAOVs(), b->getOffset(), b->getSize());
+            }
+        }
+
+        int errors = 0;
+        for (int y=0; y<serial.rows(); ++y) {
+            for (int x=0; x<serial.cols(); ++x) {
+                if ((concurrent.coeff(y, x) != serial.coeff(y, x)).any()) {
+                    if (errors++ < 5)
+                        cout << "Pixel (" << x - serial.getBorderSize() << ", " << y - serial.getBorderSize()
+                             << "): expected " << serial.coeff(y, x).toString() << ", got "
+                             << concurrent.coeff(y, x).toString() << endl;
+                }
+            }
+        }
+        if (concurrent.getAOVs()->resolve() != serial.getAOVs()->resolve()) {
+            cout << "The output variables differ!" << endl;
+            ++errors;
+        }
+
+        if (errors > 0)
+            cout << errors << " values differ!" << endl;
+        cout << (errors == 0 ? "Accepted the merged image." : "Rejected the merged image.") << endl;
+        return errors == 0;
+    }
+
+    /// Check the blocks handed out for several images and ranges of tiles
+    bool testGenerator(BlockGenerator::EOrder order, int blockSize) {
+        /* The transposed image, a single row of blocks and a single pixel */
+        Vector2i sizes[] = { m_size, Vector2i(m_size.y(), m_size.x()),
+            Vector2i(5 * blockSize + 1, 1), Vector2i(1, 1) };
+
+        int errors = 0;
+        for (const Vector2i &size : sizes) {
+            int blockCount = ((size.x() + blockSize - 1) / blockSize) * ((size.y() + blockSize - 1) / blockSize);
+            int ranges[][2] = { { 0, -1 }, { blockCount / 3, 2 * blockCount / 3 + 1 } };
+            for (auto range : ranges)
+                for (int tailSize : m_tailSizes)
+                    errors += checkBlocks(size, blockSize, order, tailSize, range[0], range[1]);
+        }
+
+        if (errors > 0)
+            cout << errors << " errors!" << endl;
+        cout << (errors == 0 ? "Accepted the blocks." : "Rejected the blocks.") << endl;
+        return errors == 0;
+    }
+
+    /// Check that the blocks cover every pixel of the tiles [firstTile, lastTile) once; returns the number of errors
+    int checkBlocks(const Vector2i &size, int blockSize, BlockGenerator::EOrder order,
+            int tailSize, int firstTile, int lastTile) {
+        BlockGenerator generator(size, blockSize, order, tailSize, firstTile, lastTile);
+        Eigen::ArrayXXi coverage = Eigen::ArrayXXi::Zero(size.y(), size.x());
+        ImageBlock block(Vector2i(blockSize), nullptr);
+        std::string label = tfm::format("Image %ix%i, tiles [%i, %i), tail %i",
+            size.x(), size.y(), firstTile, lastTile, tailSize);
+
+        int blockCount = 0, errors = 0;
+        while (generator.next(block)) {
+            ++blockCount;
+            Point2i offset = block.getOffset();
+            Vector2i blockExtents = block.getSize();
+            if ((blockExtents.array() <= 0).any() || (offset.array() < 0).any() ||
+                ((offset + blockExtents).array() > size.array()).any()) {
+                if (errors++ < 5)
+                    cout << label << ": " << block.toString() << " lies outside of the image!" << endl;
+                continue;
+            }
+            coverage.block(offset.y(), offset.x(), blockExtents.y(), blockExtents.x()) += 1;
+
+            /* Split blocks stay within their tile and are only smaller
+               than the minimum size where the tile itself is */
+            Point2i tile = offset / blockSize;
+            Vector2i tileExtents = (size - tile * blockSize).cwiseMin(Vector2i::Constant(blockSize));
+            Vector2i minExtents = tileExtents.cwiseMin(Vector2i::Constant(NORI_MIN_BLOCK_SIZE));
+            if ((((offset + blockExtents - Vector2i(1)) / blockSize).array() != tile.array()).any() ||
+                (blockExtents.array() < minExtents.array()).any() ||
+                (tailSize == 0 && (offset != tile * blockSize || blockExtents != tileExtents))) {
+                if (errors++ < 5)
+                    cout << label << ": invalid " << block.toString() << endl;
+            }
+
+            /* The blocks at the end can't be split any further */
+            if (blockCount > generator.getBlockCount() - tailSize &&
+                (blockExtents.array() >= 2 * NORI_MIN_BLOCK_SIZE).any()) {
+                if (errors++ < 5)
+                    cout << label << ": " << block.toString() << " at the end wasn't split!" << endl;
+            }
+        }
+        if (blockCount != generator.getBlockCount()) {
+            cout << label << ": handed out " << blockCount << " of "
+                 << generator.getBlockCount() << " blocks!" << endl;
+            ++errors;
+        }
+
+        int tilesPerRow = (size.x() + blockSize - 1) / blockSize;
+        int end = lastTile < 0 ? std::numeric_limits<int>::max() : lastTile;
+        for (int y=0; y<size.y(); ++y) {
+            for (int x=0; x<size.x(); ++x) {
+                int tile = (y / blockSize) * tilesPerRow + x / blockSize;
+                int expected = tile >= firstTile && tile < end ? 1 : 0;
+                if (coverage(y, x) != expected) {
+                    if (errors++ < 5)
+                        cout << label << ": pixel (" << x << ", " << y << ") was handed out "
+                             << coverage(y, x) << " times, expected " << expected << endl;
+                }
+            }
+        }
+        return errors;
+    }
+
+    Vector2i m_size;
+    std::vector<int> m_blockSizes;
+    std::vector<int> m_tailSizes;
+    int m_passes;
+    int m_sampleCount;
+    std::vector<ReconstructionFilter *> m_filters;
+};
+
+NORI_REGISTER_CLASS(BlockTest, "blocktest");
+NORI_NAMESPACE_END
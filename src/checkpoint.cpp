@@ -0,0 +1,207 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/checkpoint.h>
+#include <nori/bitmap.h>
+#include <ImfInputFile.h>
+#include <ImfOutputFile.h>
+#include <ImfChannelList.h>
+#include <ImfStringAttribute.h>
+#include <ImfIntAttribute.h>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+NORI_NAMESPACE_BEGIN
+
+/// Register the slices of a checkpoint, whose data window starts at (-border, -border)
+static void setupFrameBuffer(Imf::FrameBuffer &frameBuffer, float *pixels,
+        PixelStatistics *statistics, int width, int borderSize) {
+    size_t origin = (size_t) borderSize * (size_t) width + (size_t) borderSize;
+
+    size_t compStride = sizeof(float),
+           pixelStride = 4 * compStride,
+           rowStride = pixelStride * width;
+    char *ptr = reinterpret_cast<char *>(pixels) + origin * pixelStride;
+    frameBuffer.insert("R", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride)); ptr += compStride;
+    frameBuffer.insert("G", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride)); ptr += compStride;
+    frameBuffer.insert("B", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride)); ptr += compStride;
+    frameBuffer.insert("W", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride));
+
+    if (statistics) {
+        pixelStride = sizeof(PixelStatistics);
+        rowStride = pixelStride * width;
+        ptr = reinterpret_cast<char *>(statistics) + origin * pixelStride;
+        frameBuffer.insert("N", Imf::Slice(Imf::UINT,
+            ptr + offsetof(PixelStatistics, sampleCount), pixelStride, rowStride));
+        frameBuffer.insert("skipped", Imf::Slice(Imf::UINT,
+            ptr + offsetof(PixelStatistics, skippedCount), pixelStride, rowStride));
+        frameBuffer.insert("mean", Imf::Slice(Imf::FLOAT,
+            ptr + offsetof(PixelStatistics, mean), pixelStride, rowStride));
+        frameBuffer.insert("m2", Imf::Slice(Imf::FLOAT,
+            ptr + offsetof(PixelStatistics, m2), pixelStride, rowStride));
+    }
+}
+
+RenderCheckpoint::RenderCheckpoint(const ImageBlock &block, const std::vector<PixelStatistics> &statistics,
+        uint32_t sampleCount, const std::string &samplerInfo)
+    : m_size(block.getSize()), m_borderSize(block.getBorderSize()),
+      m_sampleCount(sampleCount), m_samplerInfo(samplerInfo) {
+    m_pixels.resize(4 * getPixelCount());
+
+    block.lock();
+    memcpy(m_pixels.data(), block.data(), sizeof(float) * m_pixels.size());
+    block.unlock();
+
+    if (!statistics.empty()) {
+        int width = m_size.x() + 2 * m_borderSize;
+        m_statistics.resize(getPixelCount());
+        for (int y=0; y<m_size.y(); ++y)
+            std::copy(statistics.begin() + (size_t) y * m_size.x(),
+                      statistics.begin() + (size_t) (y + 1) * m_size.x(),
+                      m_statistics.begin() + (size_t) (y + m_borderSize) * width + m_borderSize);
+    }
+}
+
+RenderCheckpoint::RenderCheckpoint(const std::string &filename) {
+    Imf::InputFile file(filename.c_str());
+    const Imf::Header &header = file.header();
+
+    const Imf::StringAttribute *samplerInfo =
+        header.findTypedAttribute<Imf::StringAttribute>("nori.sampler");
+    const Imf::IntAttribute *sampleCount =
+        header.findTypedAttribute<Imf::IntAttribute>("nori.sampleCount");
+    if (!samplerInfo || !sampleCount)
+        throw NoriException("\"%s\" is not a render checkpoint!", filename);
+    m_samplerInfo = samplerInfo->value();
+    m_sampleCount = (uint32_t) sampleCount->value();
+
+    Imath::Box2i displayWindow = header.displayWindow(),
+                 dataWindow = header.dataWindow();
+    m_size = Vector2i(displayWindow.max.x - displayWindow.min.x + 1,
+                      displayWindow.max.y - displayWindow.min.y + 1);
+    m_borderSize = -dataWindow.min.x;
+    if (displayWindow.min.x != 0 || displayWindow.min.y != 0 ||
+        dataWindow.min.y != -m_borderSize ||
+        dataWindow.max.x != m_size.x() - 1 + m_borderSize ||
+        dataWindow.max.y != m_size.y() - 1 + m_borderSize)
+        throw NoriException("\"%s\": unexpected data window!", filename);
+
+    cout << "Reading a " << m_size.x() << "x" << m_size.y() << " checkpoint with "
+         << m_sampleCount << " spp from \"" << filename << "\"" << endl;
+
+    m_pixels.resize(4 * getPixelCount());
+    if (header.channels().findChannel("N"))
+        m_statistics.resize(getPixelCount());
+
+    Imf::FrameBuffer frameBuffer;
+    setupFrameBuffer(frameBuffer, m_pixels.data(),
+        m_statistics.empty() ? nullptr : m_statistics.data(),
+        m_size.x() + 2 * m_borderSize, m_borderSize);
+    file.setFrameBuffer(frameBuffer);
+    file.readPixels(dataWindow.min.y, dataWindow.max.y);
+}
+
+void RenderCheckpoint::save(const std::string &filename) const {
+    int border = m_borderSize;
+    Imath::Box2i displayWindow(Imath::V2i(0, 0),
+        Imath::V2i(m_size.x() - 1, m_size.y() - 1));
+    Imath::Box2i dataWindow(Imath::V2i(-border, -border),
+        Imath::V2i(m_size.x() - 1 + border, m_size.y() - 1 + border));
+
+    Imf::Header header(displayWindow, dataWindow);
+    header.insert("comments", Imf::StringAttribute("Nori render checkpoint"));
+    header.insert("nori.sampler", Imf::StringAttribute(m_samplerInfo));
+    header.insert("nori.sampleCount", Imf::IntAttribute((int) m_sampleCount));
+
+    Imf::ChannelList &channels = header.channels();
+    channels.insert("R", Imf::Channel(Imf::FLOAT));
+    channels.insert("G", Imf::Channel(Imf::FLOAT));
+    channels.insert("B", Imf::Channel(Imf::FLOAT));
+    channels.insert("W", Imf::Channel(Imf::FLOAT));
+    if (!m_statistics.empty()) {
+        channels.insert("N", Imf::Channel(Imf::UINT));
+        channels.insert("skipped", Imf::Channel(Imf::UINT));
+        channels.insert("mean", Imf::Channel(Imf::FLOAT));
+        channels.insert("m2", Imf::Channel(Imf::FLOAT));
+    }
+
+    /* OpenEXR only reads from the frame buffer */
+    Imf::FrameBuffer frameBuffer;
+    setupFrameBuffer(frameBuffer, const_cast<float *>(m_pixels.data()),
+        m_statistics.empty() ? nullptr : const_cast<PixelStatistics *>(m_statistics.data()),
+        m_size.x() + 2 * border, border);
+
+    std::string tempName = filename + ".tmp";
+    {
+        Imf::OutputFile file(tempName.c_str(), header);
+        file.setFrameBuffer(frameBuffer);
+        file.writePixels(m_size.y() + 2 * border);
+    }
+
+    if (std::rename(tempName.c_str(), filename.c_str()) != 0)
+        throw NoriException("Unable to replace the checkpoint \"%s\"!", filename);
+}
+
+void RenderCheckpoint::restore(ImageBlock &block, std::vector<PixelStatistics> &statistics) const {
+    if (block.getSize() != m_size || block.getBorderSize() != m_borderSize)
+        throw NoriException("The checkpoint has a different image or filter size (%ix%i, border %i)!",
+            m_size.x(), m_size.y(), m_borderSize);
+    if (statistics.empty() != m_statistics.empty())
+        throw NoriException(m_statistics.empty() ? "The checkpoint was not rendered adaptively!"
+            : "The checkpoint was rendered adaptively!");
+
+    block.lock();
+    memcpy(reinterpret_cast<float *>(block.data()), m_pixels.data(), sizeof(float) * m_pixels.size());
+    block.unlock();
+
+    if (!statistics.empty()) {
+        int width = m_size.x() + 2 * m_borderSize;
+        for (int y=0; y<m_size.y(); ++y) {
+            auto row = m_statistics.begin() + (size_t) (y + m_borderSize) * width + m_borderSize;
+            std::copy(row, row + m_size.x(), statistics.begin() + (size_t) y * m_size.x());
+        }
+    }
+}
+
+void RenderCheckpoint::add(const RenderCheckpoint &other) {
+    if (other.m_size != m_size || other.m_borderSize != m_borderSize)
+        throw NoriException("Unable to add a checkpoint with a different image or filter size (%ix%i, border %i)!",
+            other.m_size.x(), other.m_size.y(), other.m_borderSize);
+    if (other.m_samplerInfo != m_samplerInfo)
+        throw NoriException("Unable to add a checkpoint that was rendered with a different sampler!");
+
+    Eigen::Map<Eigen::ArrayXf>(m_pixels.data(), m_pixels.size()) +=
+        Eigen::Map<const Eigen::ArrayXf>(other.m_pixels.data(), other.m_pixels.size());
+    m_statistics.clear();
+    m_sampleCount = std::max(m_sampleCount, other.m_sampleCount);
+}
+
+Bitmap *RenderCheckpoint::toBitmap() const {
+    Bitmap *result = new Bitmap(m_size);
+    int width = m_size.x() + 2 * m_borderSize;
+    for (int y=0; y<m_size.y(); ++y) {
+        for (int x=0; x<m_size.x(); ++x) {
+            const float *pixel = &m_pixels[4 * ((size_t) (y + m_borderSize) * width + x + m_borderSize)];
+            result->coeffRef(y, x) = Color4f(pixel[0], pixel[1], pixel[2], pixel[3]).divideByFilterWeight();
+        }
+    }
+    return result;
+}
+
+NORI_NAMESPACE_END
@@ -0,0 +1,272 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/checkpoint.h>
+#include <nori/rfilter.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/integrator.h>
+#include <nori/bitmap.h>
+#include <cstdio>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Consistency test of render checkpoints
+ *
+ * Writes an image block (including its border) and the statistics of
+ * adaptive sampling to a checkpoint file, reads it back and verifies
+ * that every value is restored at the same position.
+ *
+ * When a scene is given, it is also rendered in one run and as two
+ * partial images (the blocks before and after "splitTile"), which must
+ * add up to the same image when merged like "nori merge" does.
+ */
+class CheckpointTest : public NoriObject {
+public:
+    CheckpointTest(const PropertyList &propList) {
+        /* Size of the image block, which should not be square */
+        m_size.x() = propList.getInteger("width", 7);
+        m_size.y() = propList.getInteger("height", 5);
+
+        /* Temporary file that receives the checkpoints */
+        m_filename = propList.getString("filename", "checkpointtest.exr");
+
+        /* Block size of the renders and first block of the second partial image */
+        m_blockSize = propList.getInteger("blockSize", 8);
+        m_splitTile = propList.getInteger("splitTile", 3);
+    }
+
+    virtual ~CheckpointTest() {
+        delete m_filter;
+        delete m_scene;
+    }
+
+    void addChild(NoriObject *obj) {
+        switch (obj->getClassType()) {
+            case EReconstructionFilter:
+                if (m_filter)
+                    throw NoriException("CheckpointTest: tried to register multiple reconstruction filters!");
+                m_filter = static_cast<ReconstructionFilter *>(obj);
+                break;
+
+            case EScene:
+                if (m_scene)
+                    throw NoriException("CheckpointTest: tried to register multiple scenes!");
+                m_scene = static_cast<Scene *>(obj);
+                break;
+
+            default:
+                throw NoriException("CheckpointTest::addChild(<%s>) is not supported!",
+                    classTypeName(obj->getClassType()));
+        }
+    }
+
+    /// Run the tests
+    void activate() {
+        /* The default filter has a border of two pixels */
+        if (!m_filter)
+            m_filter = static_cast<ReconstructionFilter *>(
+                NoriObjectFactory::createInstance("gaussian", PropertyList()));
+
+        int total = 0, passed = 0;
+
+        cout << "------------------------------------------------------" << endl;
+        cout << "Testing a checkpoint round trip with statistics .. " << endl;
+        ++total;
+        if (testRoundTrip(true))
+            ++passed;
+
+        cout << "------------------------------------------------------" << endl;
+        cout << "Testing a checkpoint round trip without statistics .. " << endl;
+        ++total;
+        if (testRoundTrip(false))
+            ++passed;
+
+        std::remove(m_filename.c_str());
+
+        if (m_scene) {
+            cout << "------------------------------------------------------" << endl;
+            cout << "Testing a merge of two partial renders .. " << endl;
+            ++total;
+            if (testMerge())
+                ++passed;
+        }
+
+        cout << "Passed " << passed << "/" << total << " tests." << endl;
+        if (passed < total)
+            throw std::runtime_error("Some tests failed :(");
+    }
+
+    std::string toString() const {
+        return tfm::format(
+            "CheckpointTest[\n"
+            "  size = %i x %i,\n"
+            "  filename = \"%s\",\n"
+            "  blockSize = %i,\n"
+            "  splitTile = %i\n"
+            "]",
+            m_size.x(), m_size.y(),
+            m_filename,
+            m_blockSize,
+            m_splitTile
+        );
+    }
+
+    EClassType getClassType() const { return ETest; }
+private:
+    /// Save and load a checkpoint filled with a different value per pixel
+    bool testRoundTrip(bool withStatistics) {
+        ImageBlock block(m_size, m_filter);
+        int border = block.getBorderSize();
+        cout << "Block size " << m_size.x() << "x" << m_size.y()
+             << ", border " << border << endl;
+
+        for (int y=0; y<block.rows(); ++y)
+            for (int x=0; x<block.cols(); ++x)
+                block.coeffRef(y, x) = pattern(x, y);
+
+        std::vector<PixelStatistics> statistics;
+        if (withStatistics) {
+            statistics.resize((size_t) m_size.x() * m_size.y());
+            for (size_t i=0; i<statistics.size(); ++i) {
+                statistics[i].sampleCount = (uint32_t) (3 * i + 2);
+                statistics[i].skippedCount = (uint32_t) (i % 3);
+                statistics[i].mean = 0.5f * i;
+                statistics[i].m2 = 0.25f * i + 1;
+            }
+        }
+
+        RenderCheckpoint(block, statistics, 17, "TestSampler").save(m_filename);
+        RenderCheckpoint checkpoint(m_filename);
+
+        bool success = true;
+        if (checkpoint.getSampleCount() != 17 || checkpoint.getSamplerInfo() != "TestSampler") {
+            cout << "The sample count or sampler description differs!" << endl;
+            success = false;
+        }
+
+        ImageBlock restored(m_size, m_filter);
+        restored.clear();
+        std::vector<PixelStatistics> restoredStatistics(statistics.size());
+        checkpoint.restore(restored, restoredStatistics);
+
+        int errors = 0;
+        for (int y=0; y<block.rows(); ++y) {
+            for (int x=0; x<block.cols(); ++x) {
+                if ((restored.coeff(y, x) != block.coeff(y, x)).any()) {
+                    if (errors++ < 5)
+                        cout << "Pixel (" << x - border << ", " << y - border << "): expected "
+                             << block.coeff(y, x).toString() << ", got "
+                             << restored.coeff(y, x).toString() << endl;
+                }
+            }
+        }
+        for (size_t i=0; i<statistics.size(); ++i) {
+            const PixelStatistics &a = statistics[i], &b = restoredStatistics[i];
+            if (a.sampleCount != b.sampleCount || a.skippedCount != b.skippedCount ||
+                a.mean != b.mean || a.m2 != b.m2) {
+                if (errors++ < 5)
+                    cout << "Statistics of pixel " << i << " differ!" << endl;
+            }
+        }
+        if (errors > 0) {
+            cout << errors << " values differ!" << endl;
+            success = false;
+        }
+
+        cout << (success ? "Accepted the checkpoint." : "Rejected the checkpoint.") << endl;
+        return success;
+    }
+
+    /// Merge the blocks [0, splitTile) and [splitTile, end) of the scene and compare with a single run
+    bool testMerge() {
+        const Camera *camera = m_scene->getCamera();
+        Vector2i size = camera->getOutputSize();
+        m_scene->getIntegrator()->preprocess(m_scene);
+
+        RenderSettings settings;
+        settings.blockSize = m_blockSize;
+
+        ImageBlock full(size, camera->getReconstructionFilter());
+        full.clear();
+        Renderer(m_scene, full, settings).render();
+        std::unique_ptr<Bitmap> reference(full.toBitmap());
+
+        std::string stem = m_filename;
+        size_t lastdot = stem.find_last_of(".");
+        if (lastdot != std::string::npos)
+            stem.erase(lastdot, std::string::npos);
+        std::string partNames[2] = { stem + "_part0.exr", stem + "_part1.exr" };
+
+        for (int i=0; i<2; ++i) {
+            RenderSettings partSettings = settings;
+            partSettings.partial = true;
+            partSettings.firstTile = i == 0 ? 0 : m_splitTile;
+            partSettings.lastTile = i == 0 ? m_splitTile : -1;
+
+            ImageBlock part(size, camera->getReconstructionFilter());
+            part.clear();
+            Renderer renderer(m_scene, part, partSettings);
+            renderer.render();
+            renderer.savePartial(partNames[i]);
+        }
+
+        RenderCheckpoint merged(partNames[0]);
+        merged.add(RenderCheckpoint(partNames[1]));
+        std::unique_ptr<Bitmap> result(merged.toBitmap());
+        for (int i=0; i<2; ++i)
+            std::remove(partNames[i].c_str());
+
+        /* The blocks overlap in their borders, which are summed in a different order */
+        int errors = 0;
+        for (int y=0; y<size.y(); ++y) {
+            for (int x=0; x<size.x(); ++x) {
+                const Color3f &a = reference->coeff(y, x), &b = result->coeff(y, x);
+                float tolerance = 1e-4f * std::max(1.0f, a.maxCoeff());
+                if (((a - b).abs() > tolerance).any()) {
+                    if (errors++ < 5)
+                        cout << "Pixel (" << x << ", " << y << "): expected "
+                             << a.toString() << ", got " << b.toString() << endl;
+                }
+            }
+        }
+
+        if (errors > 0)
+            cout << errors << " pixels differ!" << endl;
+        cout << (errors == 0 ? "Accepted the merged image." : "Rejected the merged image.") << endl;
+        return errors == 0;
+    }
+
+    /// Distinct value of a pixel (given in block coordinates)
+    static Color4f pattern(int x, int y) {
+        float value = (float) (100 * y + x);
+        return Color4f(value, value + 0.25f, value + 0.5f, 1.0f + 0.125f * x);
+    }
+
+    Vector2i m_size;
+    std::string m_filename;
+    int m_blockSize;
+    int m_splitTile;
+    ReconstructionFilter *m_filter = nullptr;
+    Scene *m_scene = nullptr;
+};
+
+NORI_REGISTER_CLASS(CheckpointTest, "checkpointtest");
+NORI_NAMESPACE_END
@@ -21,6 +21,7 @@
 #include <Eigen/LU>
 #include <filesystem/resolver.h>
 #include <iomanip>
+#include <thread>
 
 #if defined(PLATFORM_LINUX)
 #include <malloc.h>
@@ -128,6 +129,10 @@ std::vector<std::string> tokenize(const std::string &string, const std::string &
     return tokens;
 }
 
+int getCoreCount() {
+    return std::max(1, (int) std::thread::hardware_concurrency());
+}
+
 std::string timeString(double time, bool precise) {
     if (std::isnan(time) || std::isinf(time))
         return "inf";
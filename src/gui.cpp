@@ -92,8 +92,9 @@ NoriScreen::~NoriScreen() {
 }
 
 void NoriScreen::drawContents() {
-    /* Reload the partially rendered image onto the GPU */
-    m_block.lock();
+    /* Reload the partially rendered image onto the GPU. This doesn't lock
+       the block, since stalling the rendering threads would be worse than
+       showing a few pixels that are updated during the upload */
     int borderSize = m_block.getBorderSize();
     const Vector2i &size = m_block.getSize();
     glActiveTexture(GL_TEXTURE0);
@@ -103,7 +104,6 @@ void NoriScreen::drawContents() {
             0, GL_RGBA, GL_FLOAT, (uint8_t *) m_block.data() +
             (borderSize * m_block.cols() + borderSize) * sizeof(Color4f));
     glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-    m_block.unlock();
 
     glViewport(0, GLsizei(36 * mPixelRatio), GLsizei(mPixelRatio*size[0]),
          GLsizei(mPixelRatio*size[1]));
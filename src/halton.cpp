@@ -0,0 +1,96 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/sampler.h>
+#include <nori/lowdiscrepancy.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * Halton sampling with random-digit scrambling
+ *
+ * Dimension \a d of the samples of a pixel is the radical inverse of the
+ * sample index in the base given by the \a d-th prime. Every digit is
+ * offset by a random amount (modulo the base), which breaks up the
+ * correlation between the higher dimensions of the plain Halton sequence
+ * while keeping its stratification. The offsets are derived from the
+ * pixel and dimension, so that neighboring pixels use different scrambles.
+ * Beyond the tabulated primes, the dimensions wrap around with new offsets.
+ */
+class Halton : public Sampler {
+public:
+    Halton(const PropertyList &propList) {
+        m_sampleCount = (size_t) propList.getInteger("sampleCount", 1);
+        m_seed = (uint32_t) propList.getInteger("seed", 0);
+    }
+
+    virtual ~Halton() { }
+
+    std::unique_ptr<Sampler> clone() const {
+        std::unique_ptr<Halton> cloned(new Halton());
+        cloned->m_sampleCount = m_sampleCount;
+        cloned->m_seed = m_seed;
+        return std::move(cloned);
+    }
+
+    void prepare(const ImageBlock &) { /* No-op for this sampler */ }
+
+    float next1D() {
+        return sample(m_dimension++);
+    }
+
+    Point2f next2D() {
+        float x = sample(m_dimension++);
+        float y = sample(m_dimension++);
+        return Point2f(x, y);
+    }
+
+    std::string toString() const {
+        return tfm::format("Halton[sampleCount=%i, seed=%i]", m_sampleCount, m_seed);
+    }
+protected:
+    Halton() { }
+
+    /// Scrambled radical inverse of the current sample index
+    float sample(uint32_t dimension) const {
+        uint32_t base = LowDiscrepancy::prime(dimension % LowDiscrepancy::PrimeCount);
+        float invBase = 1.0f / base, invBaseN = invBase;
+        float result = 0.0f;
+        uint32_t index = m_sampleIndex;
+
+        /* The digit offsets are the base-b digits of a single hash. The digits
+           below take about 24 bits of it, plus at most 11 for the last one */
+        uint64_t offsets = LowDiscrepancy::hash(m_pixelSeed, dimension);
+
+        /* Also scramble the (zero) digits beyond the last one of the
+           index, until they no longer affect the float result */
+        while (invBaseN > 1e-7f) {
+            uint32_t digit = index % base;
+            uint32_t offset = (uint32_t) (offsets % base);
+            result += ((digit + offset) % base) * invBaseN;
+            index /= base;
+            offsets /= base;
+            invBaseN *= invBase;
+        }
+        return std::min(result, OneMinusEpsilon);
+    }
+
+};
+
+NORI_REGISTER_CLASS(Halton, "halton");
+NORI_NAMESPACE_END
@@ -17,7 +17,6 @@
 */
 
 #include <nori/sampler.h>
-#include <nori/block.h>
 #include <pcg32.h>
 
 NORI_NAMESPACE_BEGIN
@@ -29,11 +28,16 @@ NORI_NAMESPACE_BEGIN
  * This class is essentially just a wrapper around the pcg32 pseudorandom
  * number generator. For more details on what sample generators do in
  * general, refer to the \ref Sampler class.
+ *
+ * The generator is reseeded for every pixel sample from a hash of the
+ * pixel coordinates and the sample index, so that the random numbers of
+ * a sample do not depend on the ones consumed by other samples.
  */
 class Independent : public Sampler {
 public:
     Independent(const PropertyList &propList) {
         m_sampleCount = (size_t) propList.getInteger("sampleCount", 1);
+        m_seed = (uint32_t) propList.getInteger("seed", 0);
     }
 
     virtual ~Independent() { }
@@ -41,19 +45,22 @@ public:
     std::unique_ptr<Sampler> clone() const {
         std::unique_ptr<Independent> cloned(new Independent());
         cloned->m_sampleCount = m_sampleCount;
+        cloned->m_seed = m_seed;
         cloned->m_random = m_random;
         return std::move(cloned);
     }
 
-    void prepare(const ImageBlock &block) {
-        m_random.seed(
-            block.getOffset().x(),
-            block.getOffset().y()
-        );
+    void prepare(const ImageBlock &) { /* No-op for this sampler */ }
+
+    void generate(const Point2i &pixel, uint32_t sampleIndex = 0) {
+        Sampler::generate(pixel, sampleIndex);
+        m_random.seed(LowDiscrepancy::hash(m_pixelSeed, m_sampleIndex));
     }
 
-    void generate() { /* No-op for this sampler */ }
-    void advance()  { /* No-op for this sampler */ }
+    void advance() {
+        Sampler::advance();
+        m_random.seed(LowDiscrepancy::hash(m_pixelSeed, m_sampleIndex));
+    }
 
     float next1D() {
         return m_random.nextFloat();
@@ -67,7 +74,7 @@ public:
     }
 
     std::string toString() const {
-        return tfm::format("Independent[sampleCount=%i]", m_sampleCount);
+        return tfm::format("Independent[sampleCount=%i, seed=%i]", m_sampleCount, m_seed);
     }
 protected:
     Independent() { }
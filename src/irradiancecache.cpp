@@ -0,0 +1,214 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/irradiancecache.h>
+#include <Eigen/Geometry>
+#include <limits>
+
+NORI_NAMESPACE_BEGIN
+
+/// Octree nodes store every record whose validity region overlaps them
+struct IrradianceCache::Node {
+    std::vector<Record> records;
+    std::unique_ptr<Node> children[8];
+};
+
+/// Maximum depth of the octree
+static const int IrradianceCacheMaxDepth = 20;
+
+IrradianceCache::IrradianceCache(const BoundingBox3f &bbox, float accuracy,
+        float minSpacing, float maxSpacing)
+    : m_accuracy(accuracy), m_root(new Node()) {
+    /* Use a cube, so that the nodes remain cubes as well */
+    float size = bbox.getExtents().maxCoeff() * 1.01f;
+    m_bbox.min = bbox.getCenter() - Vector3f(size * 0.5f);
+    m_bbox.max = bbox.getCenter() + Vector3f(size * 0.5f);
+    m_minRadius = minSpacing * size;
+    m_maxRadius = maxSpacing * size;
+}
+
+IrradianceCache::~IrradianceCache() { }
+
+bool IrradianceCache::lookup(const Point3f &p, const Normal3f &n, Color3f &result) const {
+    tbb::spin_rw_mutex::scoped_lock lock(m_mutex, false);
+
+    Color3f sum(0.0f);
+    float weightSum = 0.0f;
+    const Node *node = m_root.get();
+    BoundingBox3f bounds = m_bbox;
+
+    while (node) {
+        for (const Record &r : node->records) {
+            Vector3f d = p - r.p;
+            float dist = d.norm();
+
+            /* Reject records in front of the query point */
+            if (d.dot(n + r.n) * 0.5f < -0.05f * r.radius)
+                continue;
+
+            float error = dist / r.radius + std::sqrt(std::max(0.0f, 1.0f - n.dot(r.n)));
+            if (error >= m_accuracy)
+                continue;
+
+            float weight = 1.0f / std::max(error, 1e-4f);
+            Vector3f rot = r.n.cross(n);
+            Color3f value;
+            for (int c = 0; c < 3; ++c)
+                value[c] = r.value[c] + rot.dot(r.rotGradient[c]) + d.dot(r.transGradient[c]);
+            sum += weight * value.max(Color3f(0.0f));
+            weightSum += weight;
+        }
+
+        /* Descend into the child containing p */
+        Point3f center = bounds.getCenter();
+        int child = 0;
+        for (int i = 0; i < 3; ++i) {
+            if (p[i] > center[i]) {
+                child |= 1 << i;
+                bounds.min[i] = center[i];
+            } else {
+                bounds.max[i] = center[i];
+            }
+        }
+        node = node->children[child].get();
+    }
+
+    if (weightSum == 0)
+        return false;
+    result = sum / weightSum;
+    return true;
+}
+
+void IrradianceCache::insert(const Record &record) {
+    /* Region in which the record can be used (error < accuracy) */
+    float radius = record.radius * m_accuracy;
+    BoundingBox3f extent(record.p - Vector3f(radius), record.p + Vector3f(radius));
+
+    tbb::spin_rw_mutex::scoped_lock lock(m_mutex, true);
+    insert(m_root.get(), m_bbox, record, extent, 2 * radius, 0);
+    m_recordCount++;
+}
+
+void IrradianceCache::insert(Node *node, const BoundingBox3f &bounds, const Record &record,
+        const BoundingBox3f &extent, float size, int depth) {
+    Point3f center = bounds.getCenter();
+    if (depth == IrradianceCacheMaxDepth || bounds.getExtents().x() * 0.5f < size) {
+        node->records.push_back(record);
+        return;
+    }
+
+    for (int child = 0; child < 8; ++child) {
+        BoundingBox3f childBounds;
+        for (int i = 0; i < 3; ++i) {
+            childBounds.min[i] = (child & (1 << i)) ? center[i] : bounds.min[i];
+            childBounds.max[i] = (child & (1 << i)) ? bounds.max[i] : center[i];
+        }
+        if (!childBounds.overlaps(extent))
+            continue;
+        if (!node->children[child])
+            node->children[child].reset(new Node());
+        insert(node->children[child].get(), childBounds, record, extent, size, depth + 1);
+    }
+}
+
+Vector3f IrradianceCache::sampleStratum(int j, int k, int M, int N, const Point2f &sample) {
+    float sin2Theta = (j + sample.x()) / M;
+    float cosTheta = std::sqrt(std::max(0.0f, 1.0f - sin2Theta));
+    float sinTheta = std::sqrt(sin2Theta);
+    float phi = 2 * M_PI * (k + sample.y()) / N;
+    return Vector3f(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+}
+
+IrradianceCache::Record IrradianceCache::createRecord(const Point3f &p, const Frame &frame,
+        int M, int N, const Color3f *L, const float *dist) const {
+    Record record;
+    record.p = p;
+    record.n = frame.n;
+    record.value = Color3f(0.0f);
+
+    float invDistSum = 0.0f;
+    Vector3f rotGradient[3], transGradient[3];
+    for (int c = 0; c < 3; ++c)
+        rotGradient[c] = transGradient[c] = Vector3f(0.0f);
+
+    for (int k = 0; k < N; ++k) {
+        float phi = 2 * M_PI * (k + 0.5f) / N, phiMinus = 2 * M_PI * k / N;
+        /* Tangent directions: u at the stratum center, v perpendicular to it,
+           and vMinus perpendicular to the boundary with stratum k-1 */
+        Vector3f u(std::cos(phi), std::sin(phi), 0.0f),
+                 v(-std::sin(phi), std::cos(phi), 0.0f),
+                 vMinus(-std::sin(phiMinus), std::cos(phiMinus), 0.0f);
+        int kPrev = (k + N - 1) % N;
+
+        for (int j = 0; j < M; ++j) {
+            const Color3f &l = L[j * N + k];
+            float r = dist[j * N + k];
+            record.value += l;
+            invDistSum += 1.0f / r;
+
+            float sinThetaMinus = std::sqrt((float) j / M),
+                  sinThetaPlus = std::sqrt((float) (j + 1) / M);
+            float tanTheta = std::tan(std::asin(std::sqrt((j + 0.5f) / M)));
+
+            /* Change across the boundary between polar strata j-1 and j */
+            if (j > 0) {
+                float cos2ThetaMinus = 1.0f - sinThetaMinus * sinThetaMinus;
+                float rMin = std::min(r, dist[(j - 1) * N + k]);
+                float factor = 2 * M_PI / N * sinThetaMinus * cos2ThetaMinus / rMin;
+                Color3f delta = l - L[(j - 1) * N + k];
+                for (int c = 0; c < 3; ++c)
+                    transGradient[c] += u * (factor * delta[c]);
+            }
+
+            /* Change across the boundary between azimuthal strata k-1 and k */
+            float rMin = std::min(r, dist[j * N + kPrev]);
+            float factor = (sinThetaPlus - sinThetaMinus) / rMin;
+            Color3f delta = l - L[j * N + kPrev];
+            for (int c = 0; c < 3; ++c) {
+                transGradient[c] += vMinus * (factor * delta[c]);
+                rotGradient[c] -= v * (tanTheta * l[c]);
+            }
+        }
+    }
+
+    /* The record stores the average radiance (irradiance / pi) */
+    float invCount = 1.0f / (M * N);
+    record.value *= invCount;
+    float maxGradient = 0.0f;
+    for (int c = 0; c < 3; ++c) {
+        record.rotGradient[c] = frame.toWorld(rotGradient[c] * invCount);
+        record.transGradient[c] = frame.toWorld(transGradient[c] * INV_PI);
+        maxGradient = std::max(maxGradient, record.transGradient[c].norm());
+    }
+
+    /* Harmonic mean distance, clamped and limited by the gradient magnitude */
+    float radius = invDistSum > 0 ? (M * N) / invDistSum : std::numeric_limits<float>::infinity();
+    if (maxGradient > 0)
+        radius = std::min(radius, record.value.maxCoeff() / maxGradient);
+    record.radius = clamp(radius, m_minRadius, m_maxRadius);
+    return record;
+}
+
+std::string IrradianceCache::toString() const {
+    return tfm::format(
+        "IrradianceCache[accuracy=%f, minRadius=%f, maxRadius=%f, records=%i]",
+        m_accuracy, m_minRadius, m_maxRadius, m_recordCount
+    );
+}
+
+NORI_NAMESPACE_END
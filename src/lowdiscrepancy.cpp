@@ -0,0 +1,87 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/lowdiscrepancy.h>
+
+NORI_NAMESPACE_BEGIN
+
+namespace {
+    /// Sobol generator matrices in the form of 32 direction numbers per dimension
+    struct SobolMatrices {
+        uint32_t v[LowDiscrepancy::SobolDimensions][32];
+
+        SobolMatrices() {
+            /* Primitive polynomial degree s, coefficients a, and initial
+               direction numbers m (Joe and Kuo) of the second dimension */
+            static const uint32_t s[] = { 1 }, a[] = { 0 };
+            static const uint32_t m[][1] = { { 1 } };
+
+            /* The first dimension is the van der Corput sequence */
+            for (int i = 0; i < 32; ++i)
+                v[0][i] = 1u << (31 - i);
+
+            for (int d = 1; d < LowDiscrepancy::SobolDimensions; ++d) {
+                uint32_t sd = s[d - 1], ad = a[d - 1];
+                for (uint32_t i = 0; i < sd; ++i)
+                    v[d][i] = m[d - 1][i] << (31 - i);
+                for (uint32_t i = sd; i < 32; ++i) {
+                    v[d][i] = v[d][i - sd] ^ (v[d][i - sd] >> sd);
+                    for (uint32_t k = 1; k < sd; ++k)
+                        v[d][i] ^= ((ad >> (sd - 1 - k)) & 1) * v[d][i - k];
+                }
+            }
+        }
+    };
+
+    struct PrimeTable {
+        uint32_t p[LowDiscrepancy::PrimeCount];
+
+        PrimeTable() {
+            int count = 0;
+            for (uint32_t n = 2; count < LowDiscrepancy::PrimeCount; ++n) {
+                bool isPrime = true;
+                for (int i = 0; i < count && p[i] * p[i] <= n; ++i) {
+                    if (n % p[i] == 0) {
+                        isPrime = false;
+                        break;
+                    }
+                }
+                if (isPrime)
+                    p[count++] = n;
+            }
+        }
+    };
+}
+
+uint32_t LowDiscrepancy::sobol(uint32_t index, int dim) {
+    static const SobolMatrices matrices;
+    const uint32_t *v = matrices.v[dim];
+    uint32_t result = 0;
+    for (int i = 0; index != 0; index >>= 1, ++i) {
+        if (index & 1)
+            result ^= v[i];
+    }
+    return result;
+}
+
+uint32_t LowDiscrepancy::prime(int i) {
+    static const PrimeTable table;
+    return table.p[i];
+}
+
+NORI_NAMESPACE_END
@@ -24,136 +24,597 @@
 #include <nori/bitmap.h>
 #include <nori/sampler.h>
 #include <nori/integrator.h>
+#include <nori/render.h>
+#include <nori/samplefile.h>
+#include <nori/rfilter.h>
+#include <nori/tilewriter.h>
+#include <nori/checkpoint.h>
+#include <nori/server.h>
+#if defined(NORI_GUI)
 #include <nori/gui.h>
-#include <tbb/parallel_for.h>
-#include <tbb/blocked_range.h>
+#endif
 #include <filesystem/resolver.h>
+#include <ImfThreading.h>
+#include <nori/mesh.h>
+#include <tbb/mutex.h>
+#include <sys/stat.h>
+#include <map>
+#include <chrono>
 #include <thread>
+#include <atomic>
+#include <exception>
 
 using namespace nori;
 
-static void renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block) {
+static void render(Scene *scene, const std::string &filename, const std::string &partialSuffix,
+        const RenderSettings &settings, const EXRSettings &exrSettings, bool headless, bool stream) {
     const Camera *camera = scene->getCamera();
-    const Integrator *integrator = scene->getIntegrator();
-
-    Point2i offset = block.getOffset();
-    Vector2i size  = block.getSize();
-
-    /* Clear the block contents */
-    block.clear();
-
-    /* For each pixel and pixel sample sample */
-    for (int y=0; y<size.y(); ++y) {
-        for (int x=0; x<size.x(); ++x) {
-            for (uint32_t i=0; i<sampler->getSampleCount(); ++i) {
-                Point2f pixelSample = Point2f((float) (x + offset.x()), (float) (y + offset.y())) + sampler->next2D();
-                Point2f apertureSample = sampler->next2D();
+    Vector2i outputSize = camera->getOutputSize();
+    scene->getIntegrator()->preprocess(scene);
 
-                /* Sample a ray from the camera */
-                Ray3f ray;
-                Color3f value = camera->sampleRay(ray, pixelSample, apertureSample);
+    /* Determine the filename of the output bitmap */
+    std::string outputName = filename;
+    size_t lastdot = outputName.find_last_of(".");
+    if (lastdot != std::string::npos)
+        outputName.erase(lastdot, std::string::npos);
 
-                /* Compute the incident radiance */
-                value *= integrator->Li(scene, sampler, ray);
+    if (stream) {
+        /* Write the finished tiles directly into a tiled OpenEXR file
+           without allocating the whole image (no PNG is written) */
+        TileWriter writer(outputName + ".exr", outputSize, settings.blockSize,
+            camera->getReconstructionFilter(), settings.aovs, exrSettings);
+        Renderer renderer(scene, writer, settings);
 
-                /* Store in the image block */
-                block.put(pixelSample, value);
-            }
-        }
+        cout << "Rendering .. ";
+        cout.flush();
+        Timer timer;
+        renderer.render();
+        writer.finish();
+        cout << "done. (took " << timer.elapsedString() << ")" << endl;
+        return;
     }
-}
-
-static void render(Scene *scene, const std::string &filename) {
-    const Camera *camera = scene->getCamera();
-    Vector2i outputSize = camera->getOutputSize();
-    scene->getIntegrator()->preprocess(scene);
-
-    /* Create a block generator (i.e. a work scheduler) */
-    BlockGenerator blockGenerator(outputSize, NORI_BLOCK_SIZE);
 
     /* Allocate memory for the entire output image and clear it */
     ImageBlock result(outputSize, camera->getReconstructionFilter());
     result.clear();
 
-    /* Create a window that visualizes the partially rendered result */
-    nanogui::init();
-    NoriScreen *screen = new NoriScreen(result);
+    Renderer renderer(scene, result, settings);
 
-    /* Do the following in parallel and asynchronously */
-    std::thread render_thread([&] {
+    auto renderImage = [&] {
         cout << "Rendering .. ";
         cout.flush();
         Timer timer;
 
-        tbb::blocked_range<int> range(0, blockGenerator.getBlockCount());
+        renderer.render();
+
+        cout << "done. (took " << timer.elapsedString() << ")" << endl;
+    };
 
-        auto map = [&](const tbb::blocked_range<int> &range) {
-            /* Allocate memory for a small image block to be rendered
-               by the current thread */
-            ImageBlock block(Vector2i(NORI_BLOCK_SIZE),
-                camera->getReconstructionFilter());
+    if (headless) {
+        /* Render directly using the thread pool, without a window */
+        renderImage();
+    } else {
+#if defined(NORI_GUI)
+        /* Create a window that visualizes the partially rendered result */
+        nanogui::init();
+        NoriScreen *screen = new NoriScreen(result);
 
-            /* Create a clone of the sampler for the current thread */
-            std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
+        /* Do the following in parallel and asynchronously */
+        std::thread render_thread(renderImage);
 
-            for (int i=range.begin(); i<range.end(); ++i) {
-                /* Request an image block from the block generator */
-                blockGenerator.next(block);
+        /* Enter the application main loop */
+        nanogui::mainloop();
 
-                /* Inform the sampler about the block to be rendered */
-                sampler->prepare(block);
+        /* Closing the window ends a progressive render after the current pass */
+        renderer.stop();
 
-                /* Render all contained pixels */
-                renderBlock(scene, sampler.get(), block);
+        /* Shut down the user interface */
+        render_thread.join();
 
-                /* The image block has been processed. Now add it to
-                   the "big" block that represents the entire image */
-                result.put(block);
+        delete screen;
+        nanogui::shutdown();
+#endif
+    }
+
+    if (settings.partial) {
+        /* Keep the unnormalized sums, which "nori merge" adds to the other parts */
+        std::string partialName = outputName + partialSuffix + ".exr";
+        cout << "Writing the partial image to \"" << partialName << "\"" << endl;
+        renderer.savePartial(partialName);
+        return;
+    }
+
+    /* Normalize the rendered image block in place, which
+       avoids copying it into a separate bitmap */
+    result.normalize();
+
+    /* Save using the OpenEXR format (with output variables as further layers) */
+    result.saveEXR(outputName, exrSettings);
+
+    /* Save tonemapped (sRGB) output using the PNG format */
+    result.savePNG(outputName);
+}
+
+static void renderCameras(Scene *scene, const std::string &filename, std::pair<int, int> range,
+        const RenderSettings &settings, const EXRSettings &exrSettings) {
+    const std::vector<Camera *> &cameras = scene->getCameras();
+    int cameraCount = (int) cameras.size();
+    if (range.second < 0)
+        range = std::make_pair(0, cameraCount);
+    if (range.second > cameraCount)
+        throw NoriException("Invalid camera range %i:%i (the scene has %i cameras)",
+            range.first, range.second, cameraCount);
+    if (settings.partial || !settings.checkpointFilename.empty() || !settings.sampleFilename.empty())
+        throw NoriException("Checkpoints, sample files and partial images "
+            "can only be used when rendering a single camera!");
+
+    /* Every camera is written to <scene>_<index>.exr/png */
+    std::string outputName = filename;
+    size_t lastdot = outputName.find_last_of(".");
+    if (lastdot != std::string::npos)
+        outputName.erase(lastdot, std::string::npos);
+
+    /* Concurrent renders would report their progress at the same time */
+    RenderSettings frameSettings = settings;
+    frameSettings.showProgress = false;
+
+    /* Integrators that need the full image render the scene's active camera, and
+       they are preprocessed for each of them, as are those whose preprocessing
+       learns from the camera's view. The others are preprocessed once */
+    Integrator *integrator = scene->getIntegrator();
+    bool concurrent = !integrator->requiresFullImage() && !integrator->preprocessDependsOnCamera();
+    if (concurrent) {
+        scene->selectCamera((size_t) range.first);
+        integrator->preprocess(scene);
+    }
+
+    std::atomic<int> next(range.first);
+    std::atomic<bool> failed(false);
+    std::exception_ptr error;
+    tbb::mutex mutex;
+
+    auto renderFrames = [&] {
+        try {
+            for (int i = next++; i < range.second && !failed; i = next++) {
+                const Camera *camera = cameras[i];
+                if (!concurrent) {
+                    scene->selectCamera((size_t) i);
+                    integrator->preprocess(scene);
+                }
+
+                ImageBlock result(camera->getOutputSize(), camera->getReconstructionFilter());
+                result.clear();
+
+                Timer timer;
+                Renderer renderer(scene, result, frameSettings, camera);
+                renderer.render();
+
+                std::string name = tfm::format("%s_%03i", outputName, i);
+                result.normalize();
+                result.saveEXR(name, exrSettings);
+                result.savePNG(name);
+
+                tbb::mutex::scoped_lock lock(mutex);
+                cout << "Rendered camera " << i << " to \"" << name << ".exr\" (took "
+                     << timer.elapsedString() << ")" << endl;
             }
-        };
+        } catch (...) {
+            tbb::mutex::scoped_lock lock(mutex);
+            if (!failed)
+                error = std::current_exception();
+            failed = true;
+        }
+    };
+
+    cout << "Rendering cameras " << range.first << " to " << range.second - 1 << " .." << endl;
+    Timer timer;
+    if (concurrent) {
+        /* Keep two frames in flight: their blocks share the thread pool, so
+           the next frame keeps all cores busy while the last blocks of the
+           previous one are rendered and while its output is being written */
+        std::thread thread(renderFrames);
+        renderFrames();
+        thread.join();
+    } else {
+        renderFrames();
+    }
+    scene->selectCamera(0);
+
+    if (error)
+        std::rethrow_exception(error);
+    cout << "Rendered " << range.second - range.first << " cameras. (took "
+         << timer.elapsedString() << ")" << endl;
+}
+
+#if defined(NORI_GUI)
+/// Return the modification time and size of a file (zero if it doesn't exist)
+static std::pair<time_t, off_t> fileStatus(const std::string &filename) {
+    struct stat status;
+    if (stat(filename.c_str(), &status) != 0)
+        return std::make_pair((time_t) 0, (off_t) 0);
+    return std::make_pair(status.st_mtime, status.st_size);
+}
 
-        /// Uncomment the following line for single threaded rendering
-        // map(range);
+/// Return the status of the scene file and of the files of its meshes
+static std::map<std::string, std::pair<time_t, off_t>> watchedFiles(
+        const std::string &filename, const Scene *scene) {
+    std::map<std::string, std::pair<time_t, off_t>> files;
+    files[filename] = fileStatus(filename);
+    for (const Mesh *mesh : scene->getMeshes())
+        files[mesh->getName()] = fileStatus(mesh->getName());
+    return files;
+}
 
-        /// Default: parallel rendering
-        tbb::parallel_for(range, map);
+/**
+ * Render a scene in the preview window and restart whenever the scene
+ * file or one of its meshes is modified. Unchanged meshes and, if the
+ * geometry didn't change, the BVH are reused when reloading the scene
+ */
+static void watch(std::unique_ptr<NoriObject> &root, const std::string &filename,
+        RenderSettings settings) {
+    if (settings.partial || !settings.checkpointFilename.empty() || !settings.sampleFilename.empty())
+        throw NoriException("Checkpoints, sample files and partial images "
+            "can't be used when watching a scene!");
+
+    /* Render in passes of one sample per pixel, so that
+       an edit interrupts the current render quickly */
+    if (settings.passSampleCount == 0)
+        settings.passSampleCount = 1;
+
+    Scene *scene = static_cast<Scene *>(root.get());
+    const Camera *camera = scene->getCamera();
 
-        cout << "done. (took " << timer.elapsedString() << ")" << endl;
-    });
+    /* The window keeps showing the same image block, hence the image
+       size and the reconstruction filter can't change */
+    ImageBlock result(camera->getOutputSize(), camera->getReconstructionFilter());
+    result.clear();
+
+    std::atomic<bool> closed(false), changed(false);
+    Renderer *renderer = nullptr;
+    tbb::mutex mutex;
+    std::map<std::string, std::pair<time_t, off_t>> files = watchedFiles(filename, scene);
+
+    /* Poll the files and interrupt the render after the current pass
+       when one of them was modified */
+    auto pollFiles = [&] {
+        while (!closed) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            tbb::mutex::scoped_lock lock(mutex);
+            if (changed)
+                continue;
+            for (const auto &file : files) {
+                if (fileStatus(file.first) != file.second) {
+                    changed = true;
+                    if (renderer)
+                        renderer->stop();
+                    break;
+                }
+            }
+        }
+    };
+
+    auto renderScene = [&] {
+        bool valid = true;
+        while (!closed) {
+            if (valid) {
+                cout << "Rendering .. " << endl;
+                Timer timer;
+                scene->getIntegrator()->preprocess(scene);
+                result.clear();
+
+                Renderer current(scene, result, settings);
+                {
+                    tbb::mutex::scoped_lock lock(mutex);
+                    renderer = &current;
+                }
+                if (!changed && !closed)
+                    current.render();
+                {
+                    tbb::mutex::scoped_lock lock(mutex);
+                    renderer = nullptr;
+                }
+                cout << (changed ? "Interrupted" : "Finished") << " rendering after "
+                     << current.getRenderedSampleCount() << " spp. (took "
+                     << timer.elapsedString() << ")" << endl;
+            }
+
+            /* Wait for an edit (or for the window to be closed) */
+            while (!closed && !changed)
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            if (closed)
+                break;
+
+            cout << "Reloading \"" << filename << "\" .." << endl;
+            Timer timer;
+            std::pair<time_t, off_t> sceneStatus = fileStatus(filename);
+            try {
+                /* Once activated, the new version owns the reused meshes,
+                   even if it can't be rendered. A version that fails to load
+                   leaves them to the previous one, which isn't rendered
+                   anymore either way (the next reload retries) */
+                valid = false;
+                std::unique_ptr<NoriObject> object(loadFromXML(filename, scene));
+                if (object->getClassType() != NoriObject::EScene)
+                    throw NoriException("\"%s\" does not describe a scene!", filename);
+                root = std::move(object);
+                scene = static_cast<Scene *>(root.get());
+                if (scene->getCamera()->getOutputSize() != result.getSize())
+                    throw NoriException("The image size can't change while watching a scene!");
+                valid = true;
+                cout << "Reloaded the scene. (took " << timer.elapsedString() << ")" << endl;
+            } catch (const std::exception &e) {
+                cerr << "Error: " << e.what() << endl;
+            }
+
+            /* Edits made while loading are detected, since the status of
+               the scene file was determined before */
+            tbb::mutex::scoped_lock lock(mutex);
+            files = watchedFiles(filename, scene);
+            files[filename] = sceneStatus;
+            changed = false;
+        }
+    };
+
+    nanogui::init();
+    NoriScreen *screen = new NoriScreen(result);
+    std::thread renderThread(renderScene), pollThread(pollFiles);
 
-    /* Enter the application main loop */
     nanogui::mainloop();
 
-    /* Shut down the user interface */
-    render_thread.join();
+    /* Closing the window ends the current render after its pass */
+    closed = true;
+    {
+        tbb::mutex::scoped_lock lock(mutex);
+        if (renderer)
+            renderer->stop();
+    }
+    renderThread.join();
+    pollThread.join();
 
     delete screen;
     nanogui::shutdown();
+}
+#endif
+
+static void refilter(const std::string &filename, const std::string &filterFilename,
+        const EXRSettings &exrSettings) {
+    /* Use the default filter of cameras unless another one is specified */
+    std::unique_ptr<NoriObject> filter;
+    if (filterFilename.empty()) {
+        filter.reset(NoriObjectFactory::createInstance("gaussian", PropertyList()));
+    } else {
+        filter.reset(loadFromXML(filterFilename));
+        if (filter->getClassType() != NoriObject::EReconstructionFilter)
+            throw NoriException("\"%s\" does not describe a reconstruction filter!", filterFilename);
+    }
 
-    /* Now turn the rendered image block into
-       a properly normalized bitmap */
-    std::unique_ptr<Bitmap> bitmap(result.toBitmap());
+    ImageBlock result(SampleFile::readSize(filename),
+        static_cast<const ReconstructionFilter *>(filter.get()));
+    result.clear();
+
+    cout << "Reconstructing \"" << filename << "\" .. ";
+    cout.flush();
+    Timer timer;
+    SampleFile::read(filename, result);
+    cout << "done. (took " << timer.elapsedString() << ")" << endl;
 
-    /* Determine the filename of the output bitmap */
     std::string outputName = filename;
     size_t lastdot = outputName.find_last_of(".");
     if (lastdot != std::string::npos)
         outputName.erase(lastdot, std::string::npos);
+    result.normalize();
+    result.saveEXR(outputName, exrSettings);
+    result.savePNG(outputName);
+}
 
-    /* Save using the OpenEXR format */
-    bitmap->saveEXR(outputName);
+static void merge(const std::vector<std::string> &args, const EXRSettings &exrSettings) {
+    if (args.size() < 3)
+        throw NoriException("Syntax: nori merge <output.exr> <partial.exr> [<partial.exr> ..]");
 
-    /* Save tonemapped (sRGB) output using the PNG format */
+    /* Sum the partial images one after another */
+    RenderCheckpoint result(args[2]);
+    for (size_t i = 3; i < args.size(); ++i)
+        result.add(RenderCheckpoint(args[i]));
+    std::unique_ptr<Bitmap> bitmap(result.toBitmap());
+
+    std::string outputName = args[1];
+    size_t lastdot = outputName.find_last_of(".");
+    if (lastdot != std::string::npos)
+        outputName.erase(lastdot, std::string::npos);
+    bitmap->saveEXR(outputName, nullptr, exrSettings);
     bitmap->savePNG(outputName);
 }
 
+/// Parse a range of the form "a:b"
+static std::pair<int, int> parseRange(const std::string &str) {
+    std::vector<std::string> tokens = tokenize(str, ":", true);
+    if (tokens.size() != 2)
+        throw NoriException("Invalid range \"%s\", expected <first>:<end>", str);
+    std::pair<int, int> range(toInt(tokens[0]), toInt(tokens[1]));
+    if (range.first < 0 || range.second <= range.first)
+        throw NoriException("Invalid range \"%s\"", str);
+    return range;
+}
+
+static void printSyntax(const char *program) {
+    cerr << "Syntax: " << program << " [options] <scene.xml>" << endl
+         << "        " << program << " [--filter <rfilter.xml>] <image.samples>" << endl
+         << "        " << program << " merge <output.exr> <partial.exr> [<partial.exr> ..]" << endl
+         << "        " << program << " [options] server <socket>" << endl
+         << "                         Keep scenes loaded and render the jobs sent to" << endl
+         << "                         the given UNIX domain socket, one per line:" << endl
+         << "                         <scene.xml> output=<image.exr> [camera=<file.xml>]" << endl
+         << "                         [lookat=ox,oy,oz,tx,ty,tz,ux,uy,uz] [fov=<degrees>]" << endl
+         << "                         [width=<pixels>] [height=<pixels>] [spp=<count>]" << endl
+         << "Options:" << endl
+         << "  --spp <count>          Number of samples per pixel (the upper bound" << endl
+         << "                         when sampling adaptively)" << endl
+         << "  --pass-spp <count>     Render progressively, adding passes with the" << endl
+         << "                         given number of samples per pixel" << endl
+         << "  --time-budget <secs>   Render progressively and don't start passes" << endl
+         << "                         that would exceed the given time" << endl
+         << "  --adaptive <error>     Sample adaptively until the relative error of" << endl
+         << "                         every pixel is below the given threshold" << endl
+         << "  --checkpoint <file>    Periodically save the state of a progressive" << endl
+         << "                         render to the given OpenEXR file" << endl
+         << "  --checkpoint-interval <secs>" << endl
+         << "                         Time between two checkpoints (default: 300)" << endl
+         << "  --resume               Continue the render stored in the checkpoint" << endl
+         << "  --headless             Render without opening a window and report" << endl
+         << "                         the progress on the console" << endl
+         << "  --watch                Restart rendering in the window whenever the" << endl
+         << "                         scene file or one of its meshes is modified" << endl
+         << "  --block-size <pixels>  Size of the image blocks (default: 32)" << endl
+         << "  --block-order <order>  Order of the image blocks: spiral (default)," << endl
+         << "                         scanline, hilbert or morton" << endl
+         << "  --deferred-filter      Apply the reconstruction filter once per block" << endl
+         << "  --keep-samples <file>  Store the raw samples, which allows changing" << endl
+         << "                         the filter later on by passing the file to nori" << endl
+         << "  --filter <file.xml>    Reconstruction filter applied to a sample file" << endl
+         << "                         (default: gaussian)" << endl
+         << "  --aov <names>          Comma-separated output variables written as" << endl
+         << "                         layers of the OpenEXR file: albedo, normal," << endl
+         << "                         depth, meshId and sampleCount (not with" << endl
+         << "                         --resume or partial images)" << endl
+         << "  --stream               Write finished tiles directly into a tiled" << endl
+         << "                         OpenEXR file instead of keeping the whole" << endl
+         << "                         image in memory (single pass, no PNG)" << endl
+         << "  --exr-compression <method>" << endl
+         << "                         Compression of OpenEXR files: none, rle, zips," << endl
+         << "                         zip (default), piz, pxr24, b44, b44a, dwaa, dwab" << endl
+         << "  --exr-half             Store OpenEXR files with 16 bit floats" << endl
+         << "  --tiles <first>:<end>  Only render the given range of blocks (in" << endl
+         << "                         scanline order) and write an unnormalized" << endl
+         << "                         partial image for \"nori merge\"" << endl
+         << "  --samples <first>:<end>" << endl
+         << "                         Only render the given range of sample indices" << endl
+         << "                         and write a partial image (see --tiles)" << endl
+         << "  --cameras <first>:<end>" << endl
+         << "                         Render the given range of the scene's cameras" << endl
+         << "                         to <scene>_<index>.exr (default: all of them" << endl
+         << "                         when the scene has more than one camera)" << endl;
+}
+
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        cerr << "Syntax: " << argv[0] << " <scene.xml>" << endl;
+    RenderSettings settings;
+    std::vector<std::string> args;
+    std::string filename, filterFilename, partialSuffix;
+#if defined(NORI_GUI)
+    bool headless = false;
+#else
+    bool headless = true;
+#endif
+    bool stream = false, watchScene = false;
+    std::pair<int, int> cameraRange(0, -1);
+    EXRSettings exrSettings;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--spp" && i + 1 < argc)
+                settings.sampleCount = (uint32_t) toUInt(argv[++i]);
+            else if (arg == "--pass-spp" && i + 1 < argc)
+                settings.passSampleCount = (uint32_t) toUInt(argv[++i]);
+            else if (arg == "--time-budget" && i + 1 < argc)
+                settings.timeBudget = toFloat(argv[++i]);
+            else if (arg == "--adaptive" && i + 1 < argc)
+                settings.adaptiveThreshold = toFloat(argv[++i]);
+            else if (arg == "--checkpoint" && i + 1 < argc)
+                settings.checkpointFilename = argv[++i];
+            else if (arg == "--checkpoint-interval" && i + 1 < argc)
+                settings.checkpointInterval = toFloat(argv[++i]);
+            else if (arg == "--resume")
+                settings.resume = true;
+            else if (arg == "--headless")
+                headless = true;
+            else if (arg == "--stream")
+                stream = true;
+            else if (arg == "--watch")
+                watchScene = true;
+            else if (arg == "--exr-compression" && i + 1 < argc)
+                exrSettings.compression = EXRSettings::compressionFromString(argv[++i]);
+            else if (arg == "--exr-half")
+                exrSettings.half = true;
+            else if (arg == "--block-size" && i + 1 < argc)
+                settings.blockSize = toInt(argv[++i]);
+            else if (arg == "--block-order" && i + 1 < argc)
+                settings.blockOrder = BlockGenerator::orderFromString(argv[++i]);
+            else if (arg == "--deferred-filter")
+                settings.deferredFilter = true;
+            else if (arg == "--keep-samples" && i + 1 < argc)
+                settings.sampleFilename = argv[++i];
+            else if (arg == "--filter" && i + 1 < argc)
+                filterFilename = argv[++i];
+            else if (arg == "--aov" && i + 1 < argc) {
+                for (const std::string &name : tokenize(argv[++i], ","))
+                    settings.aovs.push_back(AOVBuffer::typeFromString(name));
+            }
+            else if (arg == "--tiles" && i + 1 < argc) {
+                std::pair<int, int> range = parseRange(argv[++i]);
+                settings.firstTile = range.first;
+                settings.lastTile = range.second;
+                settings.partial = true;
+                partialSuffix += tfm::format("_tiles%i-%i", range.first, range.second);
+            }
+            else if (arg == "--samples" && i + 1 < argc) {
+                std::pair<int, int> range = parseRange(argv[++i]);
+                settings.firstSample = (uint32_t) range.first;
+                settings.sampleCount = (uint32_t) range.second;
+                settings.partial = true;
+                partialSuffix += tfm::format("_samples%i-%i", range.first, range.second);
+            }
+            else if (arg == "--cameras" && i + 1 < argc)
+                cameraRange = parseRange(argv[++i]);
+            else if (arg.compare(0, 2, "--") != 0)
+                args.push_back(arg);
+            else
+                throw NoriException("Invalid argument \"%s\"", arg);
+        }
+    } catch (const std::exception &e) {
+        cerr << "Fatal error: " << e.what() << endl;
+        printSyntax(argv[0]);
         return -1;
     }
 
-    filesystem::path path(argv[1]);
+    if (args.empty() || (args.size() > 1 && args[0] != "merge" && args[0] != "server") ||
+        (args[0] == "server" && args.size() != 2)) {
+        printSyntax(argv[0]);
+        return -1;
+    }
+    filename = args[0];
+
+    /* Let OpenEXR compress and decompress using all cores */
+    Imf::setGlobalThreadCount(getCoreCount());
+
+    if (filename == "merge") {
+        try {
+            merge(args, exrSettings);
+        } catch (const std::exception &e) {
+            cerr << "Fatal error: " << e.what() << endl;
+            return -1;
+        }
+        return 0;
+    }
+
+    if (filename == "server") {
+        try {
+            RenderServer server(args[1], settings, exrSettings);
+            server.run();
+        } catch (const std::exception &e) {
+            cerr << "Fatal error: " << e.what() << endl;
+            return -1;
+        }
+        return 0;
+    }
+
+    /* The preview window needs the whole image */
+    if (stream)
+        headless = true;
+
+    /* Without a window, report the progress on the console */
+    settings.showProgress = headless;
+
+    filesystem::path path(filename);
 
     try {
         if (path.extension() == "xml") {
@@ -162,14 +623,36 @@ int main(int argc, char **argv) {
                resources (OBJ files, textures) using relative paths */
             getFileResolver()->prepend(path.parent_path());
 
-            std::unique_ptr<NoriObject> root(loadFromXML(argv[1]));
+            std::unique_ptr<NoriObject> root(loadFromXML(filename));
 
             /* When the XML root object is a scene, start rendering it .. */
-            if (root->getClassType() == NoriObject::EScene)
-                render(static_cast<Scene *>(root.get()), argv[1]);
+            if (root->getClassType() == NoriObject::EScene) {
+                Scene *scene = static_cast<Scene *>(root.get());
+                if (watchScene) {
+                    /* Interactively render the scene while it is being edited */
+#if defined(NORI_GUI)
+                    if (headless || stream)
+                        throw NoriException("Watching a scene requires the preview window!");
+                    watch(root, filename, settings);
+#else
+                    throw NoriException("Watching a scene is not available in this build of Nori!");
+#endif
+                } else if (scene->getCameras().size() > 1 || cameraRange.second >= 0) {
+                    /* .. or all of its cameras, reusing the meshes and the BVH */
+                    if (stream)
+                        throw NoriException("Streaming supports a single camera only!");
+                    renderCameras(scene, filename, cameraRange, settings, exrSettings);
+                } else {
+                    render(scene, filename, partialSuffix, settings, exrSettings, headless, stream);
+                }
+            }
+        } else if (path.extension() == "samples") {
+            /* Reconstruct an image from its raw samples */
+            refilter(filename, filterFilename, exrSettings);
         } else if (path.extension() == "exr") {
             /* Alternatively, provide a basic OpenEXR image viewer */
-            Bitmap bitmap(argv[1]);
+#if defined(NORI_GUI)
+            Bitmap bitmap(filename);
             ImageBlock block(Vector2i((int) bitmap.cols(), (int) bitmap.rows()), nullptr);
             block.fromBitmap(bitmap);
             nanogui::init();
@@ -177,9 +660,12 @@ int main(int argc, char **argv) {
             nanogui::mainloop();
             delete screen;
             nanogui::shutdown();
+#else
+            throw NoriException("The image viewer is not available in this build of Nori!");
+#endif
         } else {
-            cerr << "Fatal error: unknown file \"" << argv[1]
-                 << "\", expected an extension of type .xml or .exr" << endl;
+            cerr << "Fatal error: unknown file \"" << filename
+                 << "\", expected an extension of type .xml, .samples or .exr" << endl;
         }
     } catch (const std::exception &e) {
         cerr << "Fatal error: " << e.what() << endl;
@@ -40,18 +40,13 @@ void Mesh::activate() {
             NoriObjectFactory::createInstance("diffuse", PropertyList()));
     }
 	if (m_emitter) {
-		int triangleCount = getTriangleCount();
+		/* Area-proportional triangle distribution. normalize() also builds
+		   an alias table, so picking a triangle is O(1) per emitter sample */
+		uint32_t triangleCount = getTriangleCount();
 		m_dpdf = new DiscretePDF(triangleCount);
-		m_surfaceArea = 0;
-		std::vector<float> sav;
-		for (auto i = 0; i < triangleCount; i++) {
-			float sa = surfaceArea(i);
-			m_surfaceArea += sa;
-			sav.push_back(sa);
-		}
-		for (auto i = 0; i < triangleCount; i++)
-			m_dpdf->append(sav.at(i) / m_surfaceArea);
-		m_dpdf->normalize();
+		for (uint32_t i = 0; i < triangleCount; i++)
+			m_dpdf->append(surfaceArea(i));
+		m_surfaceArea = m_dpdf->normalize();
 	}
 }
 
@@ -103,10 +98,10 @@ bool Mesh::rayIntersect(uint32_t index, const Ray3f &ray, float &u, float &v, fl
 }
 
 SampleOnMesh Mesh::samplePosition(Point2f &sample) const {
+	/* Select a triangle and rescale the consumed dimension for reuse */
 	float ux = sample.x();
+	size_t triIndex = m_dpdf->sampleReuse(ux);
 	float uy = sample.y();
-	float u = ux + uy > 1.f ? ux + uy - 1.f : ux + uy;
-	int triIndex = m_dpdf->sample(u);
 	uint32_t i0 = m_F(0, triIndex), i1 = m_F(1, triIndex), i2 = m_F(2, triIndex);
 	const Point3f p0 = m_V.col(i0), p1 = m_V.col(i1), p2 = m_V.col(i2);
 	float alpha = 1 - std::sqrt(1 - ux);
@@ -162,6 +157,15 @@ void Mesh::addChild(NoriObject *obj) {
     }
 }
 
+void Mesh::clearChildren() {
+    delete m_bsdf;
+    delete m_emitter;
+    delete m_dpdf;
+    m_bsdf = nullptr;
+    m_emitter = nullptr;
+    m_dpdf = nullptr;
+}
+
 std::string Mesh::toString() const {
     return tfm::format(
         "Mesh[\n"
@@ -142,6 +142,11 @@ public:
         return true;
     }
 
+    Color3f getAlbedo() const {
+        /* Diffuse base plus the (energy-conserving) specular lobe */
+        return m_kd + Color3f(m_ks);
+    }
+
     std::string toString() const {
         return tfm::format(
             "Microfacet[\n"
@@ -18,14 +18,20 @@
 
 #include <nori/parser.h>
 #include <nori/proplist.h>
+#include <nori/scene.h>
+#include <filesystem/resolver.h>
 #include <Eigen/Geometry>
 #include <pugixml.hpp>
+#include <sys/stat.h>
 #include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
 #include <set>
 
 NORI_NAMESPACE_BEGIN
 
-NoriObject *loadFromXML(const std::string &filename) {
+NoriObject *loadFromXML(const std::string &filename, Scene *previous) {
     /* Load the XML file using 'pugi' (a tiny self-contained XML parser implemented in C++) */
     pugi::xml_document doc;
     pugi::xml_parse_result result = doc.load_file(filename.c_str());
@@ -127,6 +133,44 @@ NoriObject *loadFromXML(const std::string &filename) {
                                 filename, *attrs.begin(), node.name(), offset(node.offset_debug()));
     };
 
+    /* Helper function to describe the element of a mesh without its child
+       objects (BSDF, emitter), including the modification time and size of
+       every file it refers to. Meshes with the same description are identical */
+    auto signature = [&](const pugi::xml_node &node) -> std::string {
+        std::ostringstream oss;
+        oss << node.attribute("type").value() << "\n";
+        for (const pugi::xml_node &ch : node.children()) {
+            auto it = tags.find(ch.name());
+            if (it != tags.end() && (int) it->second < NoriObject::EClassTypeCount)
+                continue;
+            ch.print(oss, "", pugi::format_raw);
+            oss << "\n";
+            if (it != tags.end() && it->second == EString) {
+                filesystem::path path = getFileResolver()->resolve(ch.attribute("value").value());
+                struct stat status;
+                if (path.is_file() && stat(path.str().c_str(), &status) == 0)
+                    oss << path.str() << " " << (long long) status.st_mtime
+                        << " " << (long long) status.st_size << "\n";
+            }
+        }
+        return oss.str();
+    };
+
+    /* Meshes of the previous version of the scene, by their signature */
+    std::unordered_multimap<std::string, Mesh *> reusableMeshes;
+    if (previous) {
+        for (Mesh *mesh : previous->getMeshes())
+            reusableMeshes.emplace(mesh->getSignature(), mesh);
+    }
+
+    /* When parsing fails, the objects created so far are deleted, except for the
+       reused meshes that aren't part of a scene yet (the previous version owns them) */
+    std::unordered_set<const NoriObject *> reusedMeshes;
+    auto discard = [&](NoriObject *object) {
+        if (reusedMeshes.count(object) == 0)
+            delete object;
+    };
+
     Eigen::Affine3f transform;
 
     /* Helper function to parse a Nori XML node (recursive) */
@@ -175,22 +219,53 @@ NoriObject *loadFromXML(const std::string &filename) {
 
         PropertyList propList;
         std::vector<NoriObject *> children;
-        for (pugi::xml_node &ch: node.children()) {
-            NoriObject *child = parseTag(ch, propList, tag);
-            if (child)
-                children.push_back(child);
+        try {
+            for (pugi::xml_node &ch: node.children()) {
+                NoriObject *child = parseTag(ch, propList, tag);
+                if (child)
+                    children.push_back(child);
+            }
+        } catch (...) {
+            for (auto ch: children)
+                discard(ch);
+            throw;
         }
 
         NoriObject *result = nullptr;
+        size_t attached = 0;
+        auto discardAll = [&] {
+            for (size_t i = attached; i < children.size(); ++i)
+                discard(children[i]);
+            if (result)
+                discard(result);
+        };
+
         try {
             if (currentIsObject) {
                 check_attributes(node, { "type" });
 
-                /* This is an object, first instantiate it */
-                result = NoriObjectFactory::createInstance(
-                    node.attribute("type").value(),
-                    propList
-                );
+                /* This is an object, first instantiate it (or reuse
+                   an unchanged mesh of the previous version of the scene) */
+                std::string meshSignature;
+                if (tag == EMesh) {
+                    meshSignature = signature(node);
+                    auto it = reusableMeshes.find(meshSignature);
+                    if (it != reusableMeshes.end()) {
+                        Mesh *mesh = it->second;
+                        reusableMeshes.erase(it);
+                        reusedMeshes.insert(mesh);
+                        mesh->clearChildren();
+                        result = mesh;
+                    }
+                }
+
+                if (!result)
+                    result = NoriObjectFactory::createInstance(
+                        node.attribute("type").value(),
+                        propList
+                    );
+                if (tag == EMesh)
+                    static_cast<Mesh *>(result)->setSignature(meshSignature);
 
                 if (result->getClassType() != (int) tag) {
                     throw NoriException(
@@ -201,10 +276,16 @@ NoriObject *loadFromXML(const std::string &filename) {
                         result->toString());
                 }
 
+                /* The meshes (and possibly the BVH) of the previous
+                   version are taken over when the scene is activated */
+                if (tag == EScene && previous)
+                    static_cast<Scene *>(result)->setPreviousVersion(previous);
+
                 /* Add all children */
                 for (auto ch: children) {
                     result->addChild(ch);
                     ch->setParent(result);
+                    ++attached;
                 }
 
                 /* Activate / configure the object */
@@ -305,8 +386,12 @@ NoriObject *loadFromXML(const std::string &filename) {
                 };
             }
         } catch (const NoriException &e) {
+            discardAll();
             throw NoriException("Error while parsing \"%s\": %s (at %s)", filename,
                                 e.what(), offset(node.offset_debug()));
+        } catch (...) {
+            discardAll();
+            throw;
         }
 
         return result;
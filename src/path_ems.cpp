@@ -3,6 +3,7 @@
 #include <nori/sampler.h>
 #include <nori/emitter.h>
 #include <nori/bsdf.h>
+#include <nori/aov.h>
 
 NORI_NAMESPACE_BEGIN
 
@@ -15,13 +16,21 @@ public:
 		return Li(scene, sampler, ray, 0, &indirectFlag);
 	}
 
-	Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray, int depth, bool *indirect) const {
+	Color3f LiAOV(const Scene *scene, Sampler *sampler, const Ray3f &ray, AOVRecord &record) const {
+		bool indirectFlag = false;
+		return Li(scene, sampler, ray, 0, &indirectFlag, &record);
+	}
+
+	Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray, int depth, bool *indirect,
+			AOVRecord *record = nullptr) const {
 		if (depth >= 3)
 			return Color3f(0.0f);
 
 		Intersection its;
 		if (!scene->rayIntersect(ray, its))
 			return Color3f(0.0f);
+		if (record)
+			record->setSurface(its);
 
 		Color3f li(0.0f);
 		if (its.mesh->isEmitter()) {
@@ -0,0 +1,594 @@
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/sampler.h>
+#include <nori/camera.h>
+#include <nori/emitter.h>
+#include <nori/bsdf.h>
+#include <nori/aov.h>
+#include <nori/atomic.h>
+#include <nori/timer.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <pcg32.h>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Directional quadtree over the sphere of directions
+ *
+ * Directions are mapped to the unit square via cylindrical coordinates
+ * (cos(theta), phi), which preserves area, so a density on the square
+ * corresponds to a density on the sphere up to a constant factor 4*pi.
+ * Every node stores the energy of its four quadrants; during training,
+ * these sums are accumulated from many threads using atomic additions.
+ */
+class DTree {
+public:
+	DTree() : m_nodes(1) { }
+
+	/// Map a (normalized) world space direction to the unit square
+	static Point2f dirToSquare(const Vector3f &d) {
+		float cosTheta = clamp(d.z(), -1.0f, 1.0f);
+		float phi = std::atan2(d.y(), d.x());
+		if (phi < 0)
+			phi += 2 * M_PI;
+		return Point2f(clamp((cosTheta + 1) * 0.5f, 0.0f, OneMinusEpsilon),
+			clamp(phi * INV_TWOPI, 0.0f, OneMinusEpsilon));
+	}
+
+	/// Inverse of \ref dirToSquare()
+	static Vector3f squareToDir(const Point2f &p) {
+		float cosTheta = 2 * p.x() - 1;
+		float sinTheta = std::sqrt(std::max(0.0f, 1 - cosTheta * cosTheta));
+		float phi = 2 * M_PI * p.y();
+		return Vector3f(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+	}
+
+	/// Total energy recorded in the tree
+	float getTotal() const { return m_nodes[0].total(); }
+
+	size_t getNodeCount() const { return m_nodes.size(); }
+
+	/// Splat \c value into all nodes containing the point \c p (thread-safe)
+	void record(Point2f p, float value) {
+		uint32_t node = 0;
+		while (true) {
+			int q = quadrant(p);
+			atomicAdd(m_nodes[node].sum[q], value);
+			if (m_nodes[node].child[q] == 0)
+				break;
+			node = m_nodes[node].child[q];
+		}
+	}
+
+	/// Density of \ref sample() with respect to area on the unit square
+	float pdf(Point2f p) const {
+		float result = 1.0f;
+		uint32_t node = 0;
+		while (true) {
+			const QuadNode &n = m_nodes[node];
+			float total = n.total();
+			if (total <= 0)
+				break;
+			int q = quadrant(p);
+			result *= 4 * n.sum[q].load(std::memory_order_relaxed) / total;
+			if (n.child[q] == 0)
+				break;
+			node = n.child[q];
+		}
+		return result;
+	}
+
+	/// Sample a point on the unit square proportionally to the recorded energy
+	Point2f sample(Point2f u) const {
+		Point2f origin(0.0f);
+		float size = 1.0f;
+		uint32_t node = 0;
+		while (true) {
+			const QuadNode &n = m_nodes[node];
+			float s[4];
+			for (int i = 0; i < 4; ++i)
+				s[i] = n.sum[i].load(std::memory_order_relaxed);
+			float total = s[0] + s[1] + s[2] + s[3];
+			if (total <= 0)
+				break;
+
+			/* Choose a column, then a row within it (sample reuse) */
+			int q = 0;
+			float pLeft = (s[0] + s[2]) / total;
+			if (u.x() < pLeft) {
+				u.x() = u.x() / pLeft;
+			} else {
+				u.x() = (u.x() - pLeft) / (1 - pLeft);
+				q = 1;
+			}
+			float pTop = s[q] / (s[q] + s[q + 2]);
+			if (u.y() < pTop) {
+				u.y() = u.y() / pTop;
+			} else {
+				u.y() = (u.y() - pTop) / (1 - pTop);
+				q += 2;
+			}
+			u = Point2f(std::min(u.x(), OneMinusEpsilon), std::min(u.y(), OneMinusEpsilon));
+
+			size *= 0.5f;
+			origin += Vector2f((q & 1) * size, (q >> 1) * size);
+			if (n.child[q] == 0)
+				break;
+			node = n.child[q];
+		}
+		return origin + Vector2f(u * size);
+	}
+
+	/**
+	 * \brief Rebuild the structure of this tree from the energy recorded in \c prev
+	 *
+	 * Quadrants holding more than \c threshold of the total energy are
+	 * subdivided (up to \c maxDepth levels), all others become leaves.
+	 * The sums of the new tree are reset to zero.
+	 */
+	void refineFrom(const DTree &prev, float threshold, int maxDepth) {
+		m_nodes.clear();
+		float energy[4];
+		for (int i = 0; i < 4; ++i)
+			energy[i] = prev.m_nodes[0].sum[i].load(std::memory_order_relaxed);
+		build(prev, 0, energy, prev.getTotal(), threshold, 1, maxDepth);
+	}
+
+private:
+	struct QuadNode {
+		std::atomic<float> sum[4];
+		/// Child node indices (0 denotes a leaf, since the root is never a child)
+		uint32_t child[4];
+
+		QuadNode() {
+			for (int i = 0; i < 4; ++i) {
+				sum[i].store(0.0f, std::memory_order_relaxed);
+				child[i] = 0;
+			}
+		}
+
+		QuadNode(const QuadNode &other) { *this = other; }
+
+		QuadNode &operator=(const QuadNode &other) {
+			for (int i = 0; i < 4; ++i) {
+				sum[i].store(other.sum[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+				child[i] = other.child[i];
+			}
+			return *this;
+		}
+
+		float total() const {
+			return sum[0].load(std::memory_order_relaxed) + sum[1].load(std::memory_order_relaxed) +
+				sum[2].load(std::memory_order_relaxed) + sum[3].load(std::memory_order_relaxed);
+		}
+	};
+
+	/// Determine the quadrant of \c p and rescale it to the quadrant
+	static int quadrant(Point2f &p) {
+		int q = 0;
+		if (p.x() >= 0.5f) { p.x() = p.x() * 2 - 1; q |= 1; } else p.x() *= 2;
+		if (p.y() >= 0.5f) { p.y() = p.y() * 2 - 1; q |= 2; } else p.y() *= 2;
+		return q;
+	}
+
+	uint32_t build(const DTree &prev, int prevNode, const float energy[4], float total,
+			float threshold, int depth, int maxDepth) {
+		uint32_t index = static_cast<uint32_t>(m_nodes.size());
+		m_nodes.emplace_back();
+		if (total <= 0 || depth >= maxDepth)
+			return index;
+
+		for (int q = 0; q < 4; ++q) {
+			if (energy[q] / total <= threshold)
+				continue;
+			/* Descend into the existing subtree, or split a leaf evenly */
+			float childEnergy[4];
+			int childPrev = -1;
+			if (prevNode >= 0 && prev.m_nodes[prevNode].child[q] != 0) {
+				childPrev = prev.m_nodes[prevNode].child[q];
+				for (int i = 0; i < 4; ++i)
+					childEnergy[i] = prev.m_nodes[childPrev].sum[i].load(std::memory_order_relaxed);
+			} else {
+				for (int i = 0; i < 4; ++i)
+					childEnergy[i] = energy[q] * 0.25f;
+			}
+			uint32_t child = build(prev, childPrev, childEnergy, total, threshold, depth + 1, maxDepth);
+			m_nodes[index].child[q] = child;
+		}
+		return index;
+	}
+
+	std::vector<QuadNode> m_nodes;
+};
+
+/**
+ * \brief Spatial binary tree over the scene bounding box, whose leaves
+ * each hold a directional distribution that is being learned (\c building)
+ * and the one learned during the previous pass (\c sampling)
+ */
+class STree {
+public:
+	struct Leaf {
+		DTree building, sampling;
+		std::atomic<uint32_t> samples;
+
+		Leaf() : samples(0) { }
+	};
+
+	void init(const BoundingBox3f &bbox) {
+		/* Slightly enlarge the box so that all intersections fall inside */
+		Vector3f extents = bbox.getExtents();
+		float size = extents.maxCoeff() * 1.01f;
+		m_bbox.min = bbox.getCenter() - Vector3f(size * 0.5f);
+		m_bbox.max = bbox.getCenter() + Vector3f(size * 0.5f);
+		m_nodes.assign(1, Node());
+		m_leaves.clear();
+		m_leaves.emplace_back(new Leaf());
+	}
+
+	/// Return the leaf containing the point \c p
+	Leaf *lookup(const Point3f &p) const {
+		Vector3f x = (p - m_bbox.min).cwiseQuotient(m_bbox.max - m_bbox.min);
+		uint32_t node = 0;
+		while (!m_nodes[node].isLeaf()) {
+			const Node &n = m_nodes[node];
+			float &c = x[n.axis];
+			c = clamp(c, 0.0f, 1.0f);
+			if (c < 0.5f) {
+				c *= 2;
+				node = n.child[0];
+			} else {
+				c = c * 2 - 1;
+				node = n.child[1];
+			}
+		}
+		return m_leaves[m_nodes[node].leaf].get();
+	}
+
+	/// Split leaves which received more than \c threshold samples
+	void refineSpatial(uint32_t threshold) {
+		std::vector<uint32_t> stack;
+		for (uint32_t i = 0; i < m_nodes.size(); ++i)
+			if (m_nodes[i].isLeaf())
+				stack.push_back(i);
+
+		while (!stack.empty()) {
+			uint32_t node = stack.back();
+			stack.pop_back();
+			Leaf *leaf = m_leaves[m_nodes[node].leaf].get();
+			uint32_t samples = leaf->samples.load();
+			if (samples <= threshold)
+				continue;
+
+			/* Both halves start out with a copy of the parent distribution */
+			uint32_t leafIndex[2] = { m_nodes[node].leaf, static_cast<uint32_t>(m_leaves.size()) };
+			m_leaves.emplace_back(new Leaf());
+			Leaf *sibling = m_leaves.back().get();
+			sibling->building = leaf->building;
+			sibling->sampling = leaf->sampling;
+			leaf->samples = samples / 2;
+			sibling->samples = samples / 2;
+
+			uint8_t axis = static_cast<uint8_t>((m_nodes[node].axis + 1) % 3);
+			for (int i = 0; i < 2; ++i) {
+				Node child;
+				child.axis = axis;
+				child.leaf = leafIndex[i];
+				m_nodes[node].child[i] = static_cast<uint32_t>(m_nodes.size());
+				m_nodes.push_back(child);
+				stack.push_back(m_nodes[node].child[i]);
+			}
+		}
+	}
+
+	/// Promote the learned distributions and prepare new ones for the next pass
+	void refineDirectional(float threshold, int maxDepth) {
+		tbb::parallel_for(tbb::blocked_range<size_t>(0, m_leaves.size()),
+			[&](const tbb::blocked_range<size_t> &range) {
+				for (size_t i = range.begin(); i != range.end(); ++i) {
+					Leaf *leaf = m_leaves[i].get();
+					leaf->sampling = leaf->building;
+					leaf->building.refineFrom(leaf->sampling, threshold, maxDepth);
+					leaf->samples = 0;
+				}
+			}
+		);
+	}
+
+	size_t getLeafCount() const { return m_leaves.size(); }
+
+	size_t getMemoryUsage() const {
+		size_t result = m_nodes.size() * sizeof(Node);
+		for (const auto &leaf : m_leaves)
+			result += sizeof(Leaf) + (leaf->building.getNodeCount() +
+				leaf->sampling.getNodeCount()) * 4 * (sizeof(float) + sizeof(uint32_t));
+		return result;
+	}
+
+private:
+	struct Node {
+		/// Child node indices (0 denotes a leaf)
+		uint32_t child[2] = { 0, 0 };
+		uint32_t leaf = 0;
+		/// Axis along which the node is split
+		uint8_t axis = 0;
+
+		bool isLeaf() const { return child[0] == 0; }
+	};
+
+	BoundingBox3f m_bbox;
+	std::vector<Node> m_nodes;
+	std::vector<std::unique_ptr<Leaf>> m_leaves;
+};
+
+/**
+ * \brief Path tracer with guiding ("Practical Path Guiding", Mueller et al. 2017)
+ *
+ * During preprocessing, a number of training passes with doubling sample
+ * counts learn the incident radiance in an SD-tree. Rendering then draws
+ * scattering directions from a one-sample mixture of BSDF sampling and
+ * the learned distribution; emitters are also sampled explicitly and
+ * combined with the mixture using MIS.
+ */
+class PathGuidedIntegrator : public Integrator {
+public:
+	/// Upper bound for the path length, which bounds the training records per path
+	static const int MaxPathDepth = 64;
+
+	PathGuidedIntegrator(const PropertyList &props) {
+		m_maxDepth = props.getInteger("maxDepth", 5);
+		/* Training passes, the k-th one using 2^k samples per pixel */
+		m_trainingPasses = props.getInteger("trainingPasses", 5);
+		/* Probability of sampling the BSDF rather than the guiding distribution */
+		m_bsdfSamplingFraction = props.getFloat("bsdfSamplingFraction", 0.5f);
+		/* Spatial refinement: samples per leaf (scaled by sqrt(spp)) */
+		m_spatialThreshold = props.getInteger("spatialThreshold", 12000);
+		/* Directional refinement: fraction of energy per quadtree node */
+		m_directionalThreshold = props.getFloat("directionalThreshold", 0.01f);
+
+		if (m_maxDepth < 1 || m_maxDepth > MaxPathDepth)
+			throw NoriException("PathGuidedIntegrator: maxDepth must be in [1, %i]!", (int) MaxPathDepth);
+		if (m_trainingPasses < 0)
+			throw NoriException("PathGuidedIntegrator: trainingPasses must be non-negative!");
+		if (m_bsdfSamplingFraction < 0 || m_bsdfSamplingFraction > 1)
+			throw NoriException("PathGuidedIntegrator: bsdfSamplingFraction must be in [0, 1]!");
+	}
+
+	void preprocess(const Scene *scene) {
+		m_sdTree.init(scene->getBoundingBox());
+		if (m_trainingPasses == 0 || scene->getEmitterMeshes().empty())
+			return;
+
+		const Camera *camera = scene->getCamera();
+		const Vector2i &size = camera->getOutputSize();
+
+		cout << "Training the guiding distribution (" << m_trainingPasses << " passes) .. ";
+		cout.flush();
+		Timer timer;
+
+		for (int pass = 0; pass < m_trainingPasses; ++pass) {
+			uint32_t spp = 1u << pass;
+			tbb::parallel_for(tbb::blocked_range<int>(0, size.y()),
+				[&](const tbb::blocked_range<int> &range) {
+					TrainingRandom random;
+					for (int y = range.begin(); y != range.end(); ++y) {
+						random.rng.seed(static_cast<uint64_t>(y), static_cast<uint64_t>(pass));
+						for (int x = 0; x < size.x(); ++x) {
+							for (uint32_t i = 0; i < spp; ++i) {
+								Point2f pixelSample = Point2f((float) x, (float) y) + random.next2D();
+								Ray3f ray;
+								camera->sampleRay(ray, pixelSample, random.next2D());
+								trace(scene, random, ray, true);
+							}
+						}
+					}
+				}
+			);
+
+			m_sdTree.refineSpatial(static_cast<uint32_t>(m_spatialThreshold * std::sqrt((float) spp)));
+			m_sdTree.refineDirectional(m_directionalThreshold, 20);
+		}
+
+		cout << "done (took " << timer.elapsedString() << " and "
+			<< memString(m_sdTree.getMemoryUsage()) << ", "
+			<< m_sdTree.getLeafCount() << " spatial leaves)." << endl;
+	}
+
+	bool preprocessDependsOnCamera() const {
+		return m_trainingPasses > 0;
+	}
+
+	Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const {
+		return trace(scene, *sampler, ray, false);
+	}
+
+	Color3f LiAOV(const Scene *scene, Sampler *sampler, const Ray3f &ray, AOVRecord &record) const {
+		return trace(scene, *sampler, ray, false, &record);
+	}
+
+	std::string toString() const {
+		return tfm::format(
+			"PathGuidedIntegrator[\n"
+			"  maxDepth = %i,\n"
+			"  trainingPasses = %i,\n"
+			"  bsdfSamplingFraction = %f,\n"
+			"  spatialThreshold = %i,\n"
+			"  directionalThreshold = %f\n"
+			"]",
+			m_maxDepth, m_trainingPasses, m_bsdfSamplingFraction,
+			m_spatialThreshold, m_directionalThreshold
+		);
+	}
+private:
+	/// Random number source of the training passes
+	struct TrainingRandom {
+		pcg32 rng;
+
+		float next1D() { return rng.nextFloat(); }
+		Point2f next2D() { return Point2f(rng.nextFloat(), rng.nextFloat()); }
+	};
+
+	/// Training record of a scattering event along the current path
+	struct Record {
+		STree::Leaf *leaf;
+		Vector3f dir;
+		Color3f radiance;
+		Color3f throughput;
+		float pdf;
+	};
+
+	/// Solid angle density of the BSDF/guiding mixture
+	float mixturePdf(const BSDF *bsdf, const STree::Leaf *leaf, float alpha,
+			const BSDFQueryRecord &bRec, const Vector3f &dir) const {
+		float pdf = alpha * bsdf->pdf(bRec);
+		if (alpha < 1)
+			pdf += (1 - alpha) * leaf->sampling.pdf(DTree::dirToSquare(dir)) * INV_FOURPI;
+		return pdf;
+	}
+
+	/**
+	 * \brief Trace a path starting with \c ray and return its radiance
+	 * estimate. With \c train set, the incident radiance observed at every
+	 * vertex is splatted into the SD-tree. The first surface is stored in
+	 * \c record (if given).
+	 */
+	template <typename Random> Color3f trace(const Scene *scene, Random &random, Ray3f ray, bool train,
+			AOVRecord *record = nullptr) const {
+		const std::vector<Mesh *> &emitters = scene->getEmitterMeshes();
+		float emitterPdf = emitters.empty() ? 0.f : 1.f / static_cast<float>(emitters.size());
+
+		Record records[MaxPathDepth];
+		int recordCount = 0;
+
+		Color3f li(0.0f), throughput(1.0f);
+		float prevPdf = 0.f;
+		bool prevDelta = true;
+		Point3f prevP = ray.o;
+
+		auto addContribution = [&](const Color3f &value) {
+			li += value;
+			if (train)
+				for (int r = 0; r < recordCount; ++r)
+					records[r].radiance += value / records[r].throughput;
+		};
+
+		for (int depth = 0; ; ++depth) {
+			Intersection its;
+			if (!scene->rayIntersect(ray, its))
+				break;
+			if (record && depth == 0)
+				record->setSurface(its);
+
+			if (its.mesh->isEmitter()) {
+				/* MIS against explicit emitter sampling at the previous vertex */
+				float weight = 1.f;
+				if (!prevDelta) {
+					Vector3f d = its.p - prevP;
+					float dist2 = d.squaredNorm();
+					float cosLight = std::abs(its.shFrame.n.dot(d / std::sqrt(dist2)));
+					float pLight = emitterPdf / its.mesh->getSurfaceArea() * dist2 / cosLight;
+					weight = prevPdf / (prevPdf + pLight);
+				}
+				addContribution(throughput * its.mesh->getEmitter()->le() * weight);
+			}
+			if (depth >= m_maxDepth)
+				break;
+
+			const BSDF *bsdf = its.mesh->getBSDF();
+			Vector3f wo = its.shFrame.toLocal(-ray.d);
+			bool smooth = bsdf->isDiffuse();
+			STree::Leaf *leaf = m_sdTree.lookup(its.p);
+			float alpha = smooth && leaf->sampling.getTotal() > 0 ? m_bsdfSamplingFraction : 1.f;
+
+			/* Explicit emitter sampling */
+			if (smooth && !emitters.empty()) {
+				float uEmitter = random.next1D();
+				Point2f positionSample = random.next2D();
+				size_t index = std::min(static_cast<size_t>(uEmitter * emitters.size()), emitters.size() - 1);
+				const Emitter *emitter = emitters[index]->getEmitter();
+				SampleOnEmitter soe = emitter->sample(positionSample);
+
+				Vector3f dir = soe.position - its.p;
+				float dist2 = dir.squaredNorm();
+				Vector3f d = dir / std::sqrt(dist2);
+				float cosLight = soe.normal.dot(-d);
+				if (cosLight > 0 && !scene->rayIntersect(Ray3f(its.p, dir, Epsilon, 1.f - Epsilon))) {
+					float pLight = emitterPdf * soe.probabilityDensity * dist2 / cosLight;
+					BSDFQueryRecord bRec(wo, its.shFrame.toLocal(d), ESolidAngle);
+					Color3f f = bsdf->eval(bRec);
+					float pScatter = mixturePdf(bsdf, leaf, alpha, bRec, d);
+					float weight = pLight / (pLight + pScatter);
+					addContribution(throughput * f * std::abs(Frame::cosTheta(bRec.wo)) *
+						emitter->le() * weight / pLight);
+					if (train) {
+						leaf->building.record(DTree::dirToSquare(d), emitter->le().getLuminance() / pLight);
+						leaf->samples.fetch_add(1, std::memory_order_relaxed);
+					}
+				}
+			}
+
+			/* Sample the next direction */
+			Vector3f dir;
+			Color3f weight;
+			float pdf = 0.f;
+			if (!smooth) {
+				BSDFQueryRecord bRec(wo);
+				weight = bsdf->sample(bRec, random.next2D());
+				dir = its.shFrame.toWorld(bRec.wo);
+			} else {
+				if (random.next1D() < alpha) {
+					BSDFQueryRecord bRec(wo);
+					if (bsdf->sample(bRec, random.next2D()).isZero())
+						break;
+					dir = its.shFrame.toWorld(bRec.wo);
+				} else {
+					dir = DTree::squareToDir(leaf->sampling.sample(random.next2D()));
+				}
+				BSDFQueryRecord bRec(wo, its.shFrame.toLocal(dir), ESolidAngle);
+				pdf = mixturePdf(bsdf, leaf, alpha, bRec, dir);
+				if (pdf <= 0)
+					break;
+				weight = bsdf->eval(bRec) * std::abs(Frame::cosTheta(bRec.wo)) / pdf;
+			}
+			if (weight.isZero())
+				break;
+			throughput *= weight;
+
+			/* Russian roulette */
+			if (depth >= 3) {
+				float q = std::min(throughput.maxCoeff(), 0.95f);
+				if (random.next1D() >= q)
+					break;
+				throughput /= q;
+			}
+
+			if (train && smooth)
+				records[recordCount++] = Record { leaf, dir, Color3f(0.0f), throughput, pdf };
+
+			prevPdf = pdf;
+			prevDelta = !smooth;
+			prevP = its.p;
+			ray = Ray3f(its.p, dir);
+		}
+
+		for (int r = 0; r < recordCount; ++r) {
+			const Record &record = records[r];
+			record.leaf->building.record(DTree::dirToSquare(record.dir),
+				record.radiance.getLuminance() / record.pdf);
+			record.leaf->samples.fetch_add(1, std::memory_order_relaxed);
+		}
+		return li;
+	}
+
+	int m_maxDepth;
+	int m_trainingPasses;
+	float m_bsdfSamplingFraction;
+	int m_spatialThreshold;
+	float m_directionalThreshold;
+	STree m_sdTree;
+};
+
+NORI_REGISTER_CLASS(PathGuidedIntegrator, "path_guided")
+NORI_NAMESPACE_END
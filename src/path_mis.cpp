@@ -3,25 +3,40 @@
 #include <nori/sampler.h>
 #include <nori/emitter.h>
 #include <nori/bsdf.h>
+#include <nori/aov.h>
 
 NORI_NAMESPACE_BEGIN
 
 class PathMisIntegrator : public Integrator {
 public:
-	PathMisIntegrator(const PropertyList &props) {}
+	PathMisIntegrator(const PropertyList &props) {
+		/* Number of unshadowed candidate light samples per shadow ray.
+		   A value of zero selects plain light sampling combined with MIS */
+		m_risCandidates = props.getInteger("risCandidates", 0);
+		if (m_risCandidates < 0)
+			throw NoriException("PathMisIntegrator: risCandidates must be non-negative!");
+	}
 
 	Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const {
 		SampleOnEmitter soe;
 		return Li(scene, sampler, ray, 0, soe);
 	}
 
-	Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray, int depth, SampleOnEmitter &soeFlag) const {
+	Color3f LiAOV(const Scene *scene, Sampler *sampler, const Ray3f &ray, AOVRecord &record) const {
+		SampleOnEmitter soe;
+		return Li(scene, sampler, ray, 0, soe, &record);
+	}
+
+	Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray, int depth, SampleOnEmitter &soeFlag,
+			AOVRecord *record = nullptr) const {
 		if (depth >= 3)
 			return Color3f(0.0f);
 
 		Intersection its;
 		if (!scene->rayIntersect(ray, its))
 			return Color3f(0.0f);
+		if (record)
+			record->setSurface(its);
 
 		Color3f li(0.0f);
 		if (its.mesh->isEmitter()) {
@@ -50,39 +65,43 @@ public:
 		}
 		else {
 			// direct illumination part
-			std::vector<Mesh *> meshes = scene->getMeshes();
-			for (auto itr = meshes.cbegin(); itr != meshes.cend(); itr++) {
-				Mesh *curMesh = *itr;
-				if (curMesh->isEmitter()) {
-					const Emitter *curEmitter = curMesh->getEmitter();
-					Color3f lr(0.0f);
-					for (size_t i = 0; i < sampler->getSampleCount(); i++) {
-						Point2f sample = sampler->next2D();
-						SampleOnEmitter soe = curEmitter->sample(sample);
-						Vector3f dir = soe.position - its.p;
-						Ray3f tRay(its.p, dir);
-						Intersection tIst;
-						if (scene->rayIntersect(tRay, tIst)
-							&& tIst.p.isApprox(soe.position)
-							&& soe.normal.dot(-dir) > 0) {
-							BSDFQueryRecord bsdfQueryRecord(
-								its.shFrame.toLocal(dir),
-								its.shFrame.toLocal(-ray.d),
-								ESolidAngle
-							);
-							Color3f fr = bsdf->eval(bsdfQueryRecord);
-							float gxy =
-								std::abs(its.shFrame.n.dot(dir.normalized())) *
-								std::abs(soe.normal.dot(-dir.normalized())) /
-								dir.dot(dir);
-							// multiple importance sample weight when sample on light
-							float pBSDF = bsdf->pdf(bsdfQueryRecord);
-							pBSDF /= dir.dot(dir);
-							float wLight = soe.probabilityDensity / (soe.probabilityDensity + pBSDF);
-							lr += wLight * gxy * fr * soe.lightEnergy;
+			if (m_risCandidates > 0)
+				li += directRIS(scene, sampler, ray, its, bsdf);
+			else {
+				std::vector<Mesh *> meshes = scene->getMeshes();
+				for (auto itr = meshes.cbegin(); itr != meshes.cend(); itr++) {
+					Mesh *curMesh = *itr;
+					if (curMesh->isEmitter()) {
+						const Emitter *curEmitter = curMesh->getEmitter();
+						Color3f lr(0.0f);
+						for (size_t i = 0; i < sampler->getSampleCount(); i++) {
+							Point2f sample = sampler->next2D();
+							SampleOnEmitter soe = curEmitter->sample(sample);
+							Vector3f dir = soe.position - its.p;
+							Ray3f tRay(its.p, dir);
+							Intersection tIst;
+							if (scene->rayIntersect(tRay, tIst)
+								&& tIst.p.isApprox(soe.position)
+								&& soe.normal.dot(-dir) > 0) {
+								BSDFQueryRecord bsdfQueryRecord(
+									its.shFrame.toLocal(dir),
+									its.shFrame.toLocal(-ray.d),
+									ESolidAngle
+								);
+								Color3f fr = bsdf->eval(bsdfQueryRecord);
+								float gxy =
+									std::abs(its.shFrame.n.dot(dir.normalized())) *
+									std::abs(soe.normal.dot(-dir.normalized())) /
+									dir.dot(dir);
+								// multiple importance sample weight when sample on light
+								float pBSDF = bsdf->pdf(bsdfQueryRecord);
+								pBSDF /= dir.dot(dir);
+								float wLight = soe.probabilityDensity / (soe.probabilityDensity + pBSDF);
+								lr += wLight * gxy * fr * soe.lightEnergy;
+							}
 						}
+						li += (lr / static_cast<float>(sampler->getSampleCount()));
 					}
-					li += (lr / static_cast<float>(sampler->getSampleCount()));
 				}
 			}
 			// indirect illumination part
@@ -99,8 +118,11 @@ public:
 				Vector3f dir = soe.position - its.p;
 				pBSDF /= dir.dot(dir);
 				float wBSDF = 1.f;
-				if (soe.probabilityDensity != 0)
-					wBSDF = pBSDF / (pBSDF + soe.probabilityDensity);
+				if (soe.probabilityDensity != 0) {
+					/* The RIS estimator has no tractable light density, so
+					   emitters are accounted for by it exclusively */
+					wBSDF = m_risCandidates > 0 ? 0.f : pBSDF / (pBSDF + soe.probabilityDensity);
+				}
 				lii += wBSDF * sampleRslt * liRslt;
 			}
 			li += lii / static_cast<float>(sampler->getSampleCount());
@@ -109,9 +131,77 @@ public:
 		return li;
 	}
 
+	/**
+	 * \brief Direct illumination via resampled importance sampling
+	 *
+	 * Draws \c m_risCandidates light samples without testing visibility,
+	 * resamples one of them proportionally to its unshadowed contribution
+	 * (BSDF * G * Le) and only traces a shadow ray for that one.
+	 */
+	Color3f directRIS(const Scene *scene, Sampler *sampler, const Ray3f &ray,
+			const Intersection &its, const BSDF *bsdf) const {
+		const std::vector<Mesh *> &emitters = scene->getEmitterMeshes();
+		if (emitters.empty())
+			return Color3f(0.0f);
+		float emitterPdf = 1.f / static_cast<float>(emitters.size());
+		Vector3f wo = its.shFrame.toLocal(-ray.d);
+
+		Color3f lr(0.0f);
+		for (size_t i = 0; i < sampler->getSampleCount(); i++) {
+			/* Stream the candidates through a single-entry weighted reservoir */
+			float weightSum = 0.f, chosenTarget = 0.f;
+			Color3f chosenValue(0.0f);
+			Vector3f chosenDir;
+			for (int m = 0; m < m_risCandidates; m++) {
+				float uEmitter = sampler->next1D();
+				Point2f sample = sampler->next2D();
+				float uSelect = sampler->next1D();
+
+				size_t index = std::min(static_cast<size_t>(uEmitter * emitters.size()), emitters.size() - 1);
+				const Emitter *emitter = emitters[index]->getEmitter();
+				SampleOnEmitter soe = emitter->sample(sample);
+
+				Vector3f dir = soe.position - its.p;
+				float dist2 = dir.squaredNorm();
+				Vector3f d = dir / std::sqrt(dist2);
+				float cosLight = soe.normal.dot(-d);
+				if (cosLight <= 0)
+					continue;
+
+				BSDFQueryRecord bsdfQueryRecord(its.shFrame.toLocal(d), wo, ESolidAngle);
+				Color3f value = bsdf->eval(bsdfQueryRecord) * emitter->le() *
+					std::abs(its.shFrame.n.dot(d)) * cosLight / dist2;
+				float target = value.getLuminance();
+				if (!(target > 0))
+					continue;
+
+				float weight = target / (emitterPdf * soe.probabilityDensity);
+				weightSum += weight;
+				if (uSelect * weightSum < weight) {
+					chosenTarget = target;
+					chosenValue = value;
+					chosenDir = dir;
+				}
+			}
+
+			if (chosenTarget == 0.f)
+				continue;
+
+			/* A single shadow ray for the resampled candidate */
+			Ray3f shadowRay(its.p, chosenDir, Epsilon, 1.f - Epsilon);
+			if (scene->rayIntersect(shadowRay))
+				continue;
+
+			lr += chosenValue * (weightSum / (static_cast<float>(m_risCandidates) * chosenTarget));
+		}
+		return lr / static_cast<float>(sampler->getSampleCount());
+	}
+
 	std::string toString() const {
-		return std::string("PathMisIntegrator[]");
+		return tfm::format("PathMisIntegrator[risCandidates=%i]", m_risCandidates);
 	}
+private:
+	int m_risCandidates;
 };
 
 NORI_REGISTER_CLASS(PathMisIntegrator, "path_mis")
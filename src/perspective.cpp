@@ -78,6 +78,15 @@ public:
         m_sampleToCamera = Transform( 
             Eigen::DiagonalMatrix<float, 3>(Vector3f(-0.5f, -0.5f * aspect, 1.0f)) *
             Eigen::Translation<float, 3>(-1.0f, -1.0f/aspect, 0.0f) * perspective).inverse();
+        m_cameraToSample = m_sampleToCamera.inverse();
+        m_worldToCamera = m_cameraToWorld.inverse();
+
+        /* Area of the image plane at distance 1 (needed to normalize importance) */
+        Point3f pMin = m_sampleToCamera * Point3f(0.0f, 0.0f, 0.0f),
+                pMax = m_sampleToCamera * Point3f(1.0f, 1.0f, 0.0f);
+        pMin /= pMin.z();
+        pMax /= pMax.z();
+        m_imagePlaneArea = std::abs((pMax.x() - pMin.x()) * (pMax.y() - pMin.y()));
 
         /* If no reconstruction filter was assigned, instantiate a Gaussian filter */
         if (!m_rfilter)
@@ -108,6 +117,37 @@ public:
         return Color3f(1.0f);
     }
 
+    Color3f sampleImportance(const Point3f &ref, Point2f &samplePosition,
+            Vector3f &wi, float &dist, float &pdf) const {
+        Point3f origin = m_cameraToWorld * Point3f(0, 0, 0);
+        wi = origin - ref;
+        dist = wi.norm();
+        wi /= dist;
+
+        /* Project onto the image plane */
+        Vector3f local = m_worldToCamera * Vector3f(-wi);
+        if (local.z() <= 0 || dist * local.z() < m_nearClip || dist * local.z() > m_farClip)
+            return Color3f(0.0f);
+        Point3f sample = m_cameraToSample * Point3f(local / local.z());
+        samplePosition = Point2f(sample.x() * m_outputSize.x(), sample.y() * m_outputSize.y());
+        if (samplePosition.x() < 0 || samplePosition.x() >= m_outputSize.x() ||
+            samplePosition.y() < 0 || samplePosition.y() >= m_outputSize.y())
+            return Color3f(0.0f);
+
+        /* Pinhole camera: the position is deterministic, so the solid angle
+           density at 'ref' is the inverse of the geometric term */
+        float cosTheta = local.z();
+        pdf = dist * dist / cosTheta;
+        return Color3f(importance(cosTheta));
+    }
+
+    void pdfRay(const Ray3f &ray, float &pdfPos, float &pdfDir) const {
+        float cosTheta = (m_worldToCamera * ray.d).normalized().z();
+        pdfPos = 1.0f;
+        pdfDir = cosTheta <= 0 ? 0.0f :
+            1.0f / (m_imagePlaneArea * cosTheta * cosTheta * cosTheta);
+    }
+
     void addChild(NoriObject *obj) {
         switch (obj->getClassType()) {
             case EReconstructionFilter:
@@ -141,9 +181,22 @@ public:
         );
     }
 private:
+    /**
+     * Importance emitted along a direction forming angle theta with the
+     * optical axis. Normalized so that it integrates to one over the image
+     * plane (i.e. it does not yet account for the size of a pixel)
+     */
+    float importance(float cosTheta) const {
+        float cos2Theta = cosTheta * cosTheta;
+        return 1.0f / (m_imagePlaneArea * cos2Theta * cos2Theta);
+    }
+
     Vector2f m_invOutputSize;
     Transform m_sampleToCamera;
+    Transform m_cameraToSample;
     Transform m_cameraToWorld;
+    Transform m_worldToCamera;
+    float m_imagePlaneArea;
     float m_fov;
     float m_nearClip;
     float m_farClip;
@@ -0,0 +1,231 @@
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/sampler.h>
+#include <nori/emitter.h>
+#include <nori/bsdf.h>
+#include <nori/warp.h>
+#include <nori/kdtree.h>
+#include <nori/timer.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <pcg32.h>
+
+NORI_NAMESPACE_BEGIN
+
+/// Payload of a photon stored in the photon map (the position lives in the kd-tree)
+struct Photon {
+	/// Direction the photon arrived from (pointing away from the surface)
+	Vector3f wi;
+	/// Power carried by the photon
+	Color3f power;
+};
+
+class PhotonMapper : public Integrator {
+public:
+	/// Photon paths traced by a single parallel work item
+	static const size_t PhotonsPerChunk = 4096;
+
+	/// Upper bound for the number of neighbors used in k-NN density estimates
+	static const int MaxNeighbors = 256;
+
+	PhotonMapper(const PropertyList &props) {
+		/* Number of photon paths emitted from the light sources */
+		m_photonCount = props.getInteger("photonCount", 1000000);
+		/* Lookup radius of the density estimate (0: derive from the scene size) */
+		m_photonRadius = props.getFloat("photonRadius", 0.0f);
+		/* Use the k nearest photons within the lookup radius (0: all of them) */
+		m_neighbors = props.getInteger("photonNeighbors", 0);
+
+		if (m_photonCount <= 0)
+			throw NoriException("PhotonMapper: photonCount must be positive!");
+		if (m_photonRadius < 0)
+			throw NoriException("PhotonMapper: photonRadius must be non-negative!");
+		if (m_neighbors < 0 || m_neighbors > MaxNeighbors)
+			throw NoriException("PhotonMapper: photonNeighbors must be in [0, %i]!", (int) MaxNeighbors);
+	}
+
+	void preprocess(const Scene *scene) {
+		const std::vector<Mesh *> &emitters = scene->getEmitterMeshes();
+		if (emitters.empty())
+			throw NoriException("PhotonMapper: the scene contains no emitters!");
+
+		if (m_photonRadius == 0)
+			m_photonRadius = scene->getBoundingBox().getExtents().norm() / 500.0f;
+
+		cout << "Shooting " << m_photonCount << " photons .. ";
+		cout.flush();
+		Timer timer;
+
+		/* Trace photon paths in fixed-size chunks with independent random
+		   number streams, so that the result does not depend on scheduling
+		   (but on the seed of the sampler, which decorrelates renderings) */
+		uint64_t seed = scene->getSampler()->getSeed();
+		size_t chunkCount = (m_photonCount + PhotonsPerChunk - 1) / PhotonsPerChunk;
+		std::vector<std::vector<Point3f>> chunkPositions(chunkCount);
+		std::vector<std::vector<Photon>> chunkPhotons(chunkCount);
+		float invCount = 1.0f / static_cast<float>(m_photonCount);
+
+		tbb::parallel_for(tbb::blocked_range<size_t>(0, chunkCount),
+			[&](const tbb::blocked_range<size_t> &range) {
+				for (size_t c = range.begin(); c != range.end(); ++c) {
+					pcg32 rng;
+					rng.seed(c, seed);
+					size_t begin = c * PhotonsPerChunk,
+						end = std::min(begin + PhotonsPerChunk, static_cast<size_t>(m_photonCount));
+					for (size_t i = begin; i < end; ++i)
+						tracePhoton(scene, rng, invCount, chunkPositions[c], chunkPhotons[c]);
+				}
+			}
+		);
+
+		size_t stored = 0;
+		for (size_t c = 0; c < chunkCount; ++c)
+			stored += chunkPhotons[c].size();
+		std::vector<Point3f> positions;
+		std::vector<Photon> photons;
+		positions.reserve(stored);
+		photons.reserve(stored);
+		for (size_t c = 0; c < chunkCount; ++c) {
+			positions.insert(positions.end(), chunkPositions[c].begin(), chunkPositions[c].end());
+			photons.insert(photons.end(), chunkPhotons[c].begin(), chunkPhotons[c].end());
+		}
+
+		m_photonMap.build(positions, photons);
+
+		cout << "done (took " << timer.elapsedString() << " and "
+			<< memString(m_photonMap.getMemoryUsage())
+			<< ", " << m_photonMap.size() << " photons stored)." << endl;
+	}
+
+	Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &_ray) const {
+		Color3f li(0.0f), throughput(1.0f);
+		Ray3f ray(_ray);
+
+		/* Follow specular chains until the first diffuse surface,
+		   where the photon map provides the reflected radiance */
+		for (int depth = 0; ; depth++) {
+			Intersection its;
+			if (!scene->rayIntersect(ray, its))
+				break;
+
+			if (its.mesh->isEmitter())
+				li += throughput * its.mesh->getEmitter()->le();
+
+			const BSDF *bsdf = its.mesh->getBSDF();
+			Vector3f wo = its.shFrame.toLocal(-ray.d);
+			if (bsdf->isDiffuse()) {
+				li += throughput * estimateRadiance(its, bsdf, wo);
+				break;
+			}
+
+			BSDFQueryRecord bsdfQueryRecord(wo);
+			Color3f f = bsdf->sample(bsdfQueryRecord, sampler->next2D());
+			if (f.isZero())
+				break;
+			throughput *= f;
+
+			if (depth >= 3) {
+				if (sampler->next1D() >= 0.95f)
+					break;
+				throughput /= 0.95f;
+			}
+			ray = Ray3f(its.p, its.shFrame.toWorld(bsdfQueryRecord.wo));
+		}
+		return li;
+	}
+
+	std::string toString() const {
+		return tfm::format(
+			"PhotonMapper[\n"
+			"  photonCount = %i,\n"
+			"  photonRadius = %f,\n"
+			"  photonNeighbors = %i\n"
+			"]",
+			m_photonCount, m_photonRadius, m_neighbors
+		);
+	}
+private:
+	/// Trace a single photon path and record its interactions with diffuse surfaces
+	void tracePhoton(const Scene *scene, pcg32 &rng, float invCount,
+			std::vector<Point3f> &positions, std::vector<Photon> &photons) const {
+		const std::vector<Mesh *> &emitters = scene->getEmitterMeshes();
+		size_t index = std::min(static_cast<size_t>(rng.nextFloat() * emitters.size()), emitters.size() - 1);
+		const Emitter *emitter = emitters[index]->getEmitter();
+
+		Point2f positionSample(rng.nextFloat(), rng.nextFloat());
+		SampleOnEmitter soe = emitter->sample(positionSample);
+		Frame frame(soe.normal);
+		Vector3f local = Warp::squareToCosineHemisphere(Point2f(rng.nextFloat(), rng.nextFloat()));
+
+		/* Le * cos / (pdf(emitter) * pdf(position) * cos / pi) */
+		Color3f power = emitter->le() * M_PI * static_cast<float>(emitters.size())
+			/ soe.probabilityDensity * invCount;
+		Ray3f ray(soe.position, frame.toWorld(local));
+
+		for (int depth = 0; ; depth++) {
+			Intersection its;
+			if (!scene->rayIntersect(ray, its))
+				break;
+
+			const BSDF *bsdf = its.mesh->getBSDF();
+			if (bsdf->isDiffuse()) {
+				positions.push_back(its.p);
+				photons.push_back(Photon { -ray.d.normalized(), power });
+			}
+
+			BSDFQueryRecord bsdfQueryRecord(its.shFrame.toLocal(-ray.d));
+			Color3f f = bsdf->sample(bsdfQueryRecord, Point2f(rng.nextFloat(), rng.nextFloat()));
+			if (f.isZero())
+				break;
+
+			/* Russian roulette based on the throughput of the bounce */
+			float q = 1.0f;
+			if (depth >= 3) {
+				q = std::min(f.maxCoeff(), 0.95f);
+				if (rng.nextFloat() >= q)
+					break;
+			}
+			power *= f / q;
+			ray = Ray3f(its.p, its.shFrame.toWorld(bsdfQueryRecord.wo));
+		}
+	}
+
+	/// Density estimate of the radiance reflected towards \c wo
+	Color3f estimateRadiance(const Intersection &its, const BSDF *bsdf, const Vector3f &wo) const {
+		Color3f sum(0.0f);
+		float radius2 = m_photonRadius * m_photonRadius;
+
+		auto accumulate = [&](uint32_t index) {
+			const Photon &photon = m_photonMap[index];
+			BSDFQueryRecord bsdfQueryRecord(its.shFrame.toLocal(photon.wi), wo, ESolidAngle);
+			sum += bsdf->eval(bsdfQueryRecord) * photon.power;
+		};
+
+		if (m_neighbors > 0) {
+			PointKDTree<Photon>::SearchResult results[MaxNeighbors];
+			size_t found = m_photonMap.nearest(its.p, m_photonRadius, m_neighbors, results);
+			/* With a full result set, the estimate adapts to the farthest neighbor */
+			if (found == static_cast<size_t>(m_neighbors))
+				radius2 = results[0].dist2;
+			for (size_t i = 0; i < found; ++i)
+				accumulate(results[i].index);
+		}
+		else {
+			m_photonMap.search(its.p, m_photonRadius, [&](uint32_t index, float) {
+				accumulate(index);
+			});
+		}
+
+		if (radius2 == 0)
+			return Color3f(0.0f);
+		return sum / (M_PI * radius2);
+	}
+
+	int m_photonCount;
+	float m_photonRadius;
+	int m_neighbors;
+	PointKDTree<Photon> m_photonMap;
+};
+
+NORI_REGISTER_CLASS(PhotonMapper, "photonmapper")
+NORI_NAMESPACE_END
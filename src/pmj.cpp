@@ -0,0 +1,263 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/sampler.h>
+#include <nori/lowdiscrepancy.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <pcg32.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * Progressive multi-jittered (0, 2) sampling
+ *
+ * Implements the pmj02 sequences of Christensen et al. ("Progressive
+ * Multi-Jittered Sample Sequences", EGSR 2018): every prefix whose length
+ * is a power of two is stratified in all elementary intervals of that
+ * size, so the samples can be consumed progressively.
+ *
+ * Generating the sequences is too costly to do per pixel, hence a number
+ * of independent tables are created up front. In the rare case that the
+ * randomized construction gets stuck, a table is filled with Owen-scrambled
+ * Sobol points instead, which share the stratification properties. Every pixel and dimension
+ * picks one of them and applies a random binary digital shift (XOR of the
+ * fixed point coordinates), which preserves the stratification.
+ */
+class PMJ : public Sampler {
+public:
+    PMJ(const PropertyList &propList) {
+        m_sampleCount = (size_t) propList.getInteger("sampleCount", 1);
+        m_seed = (uint32_t) propList.getInteger("seed", 0);
+        int tableCount = propList.getInteger("tableCount", 32);
+        if (tableCount <= 0)
+            throw NoriException("PMJ: tableCount must be positive!");
+
+        /* Samples beyond the table size are taken from the following table */
+        m_tableSize = 1;
+        while (m_tableSize < m_sampleCount && m_tableSize < MaxTableSize)
+            m_tableSize *= 2;
+        m_tableCount = (uint32_t) tableCount;
+        m_tables.reset(new uint32_t[2 * m_tableSize * m_tableCount]);
+
+        tbb::parallel_for(tbb::blocked_range<uint32_t>(0, m_tableCount),
+            [&](const tbb::blocked_range<uint32_t> &range) {
+                for (uint32_t t = range.begin(); t != range.end(); ++t)
+                    generateTable(t, m_tables.get() + 2 * m_tableSize * t);
+            }
+        );
+    }
+
+    virtual ~PMJ() { }
+
+    std::unique_ptr<Sampler> clone() const {
+        std::unique_ptr<PMJ> cloned(new PMJ());
+        cloned->m_sampleCount = m_sampleCount;
+        cloned->m_seed = m_seed;
+        cloned->m_tableSize = m_tableSize;
+        cloned->m_tableCount = m_tableCount;
+        cloned->m_shared = m_shared ? m_shared : this;
+        return std::move(cloned);
+    }
+
+    void prepare(const ImageBlock &) { /* No-op for this sampler */ }
+
+    float next1D() {
+        uint64_t seed = LowDiscrepancy::hash(m_pixelSeed, m_dimension++);
+        const uint32_t *p = point(seed);
+        return LowDiscrepancy::toFloat(p[0] ^ (uint32_t) LowDiscrepancy::hash(seed, 1));
+    }
+
+    Point2f next2D() {
+        uint64_t seed = LowDiscrepancy::hash(m_pixelSeed, m_dimension++);
+        const uint32_t *p = point(seed);
+        return Point2f(
+            LowDiscrepancy::toFloat(p[0] ^ (uint32_t) LowDiscrepancy::hash(seed, 1)),
+            LowDiscrepancy::toFloat(p[1] ^ (uint32_t) LowDiscrepancy::hash(seed, 2))
+        );
+    }
+
+    std::string toString() const {
+        return tfm::format("PMJ[sampleCount=%i, seed=%i, tableCount=%i]",
+            m_sampleCount, m_seed, m_tableCount);
+    }
+protected:
+    PMJ() { }
+
+    /// Largest table (the generation cost grows quadratically with it)
+    static const uint32_t MaxTableSize = 1024;
+
+    /// Restarts of the greedy construction before falling back to scrambled Sobol points
+    static const int MaxAttempts = 16;
+
+    /// Table entry (fixed point x and y) of the current sample for the given seed
+    const uint32_t *point(uint64_t seed) const {
+        const uint32_t *tables = (m_shared ? m_shared : this)->m_tables.get();
+        uint32_t table = (uint32_t) ((seed >> 32) + m_sampleIndex / m_tableSize) % m_tableCount;
+        uint32_t index = m_sampleIndex % m_tableSize;
+        return tables + 2 * (m_tableSize * table + index);
+    }
+
+    /**
+     * \brief Generate a pmj02 sequence of \c m_tableSize points
+     *
+     * The sequence is extended from \a n to \a 2n points by placing one new
+     * point in a subquadrant left free by the existing points (diagonally
+     * opposite ones when \a n is a power of 4, the remaining ones
+     * otherwise). Within the subquadrant, the new point is put into strata
+     * that keep all elementary intervals of area <tt>1/2n</tt> occupied by
+     * exactly one point.
+     */
+    void generateTable(uint32_t tableIndex, uint32_t *result) const {
+        pcg32 rng;
+        rng.seed(m_seed, tableIndex);
+
+        for (int attempt = 0; attempt < MaxAttempts; ++attempt) {
+            if (generateTable(rng, result))
+                return;
+        }
+
+        /* The greedy construction can get stuck. Owen-scrambled Sobol points
+           are a (0, 2) sequence as well, so fall back to those rather than
+           letting the scene fail to load depending on the seed */
+        uint32_t seedX = rng.nextUInt(), seedY = rng.nextUInt();
+        for (uint32_t i = 0; i < m_tableSize; ++i) {
+            result[2 * i] = LowDiscrepancy::nestedUniformScramble(LowDiscrepancy::sobol(i, 0), seedX);
+            result[2 * i + 1] = LowDiscrepancy::nestedUniformScramble(LowDiscrepancy::sobol(i, 1), seedY);
+        }
+    }
+
+    bool generateTable(pcg32 &rng, uint32_t *result) const {
+        /* Coordinates are kept in 32 bit fixed point, so that strata are exact */
+        std::vector<uint32_t> x(m_tableSize), y(m_tableSize);
+        x[0] = rng.nextUInt();
+        y[0] = rng.nextUInt();
+
+        std::vector<uint8_t> occupied;
+        for (uint32_t n = 1, log2n = 0; n < m_tableSize; n *= 2, ++log2n) {
+            /* Grid of cells that contain n points each; cells are split into
+               subquadrants, half of which are already occupied */
+            bool powerOf4 = (log2n % 2) == 0;
+            uint32_t log2Grid = powerOf4 ? log2n / 2 : (log2n - 1) / 2;
+            uint32_t m = log2n + 1, strata = 2 * n;
+
+            /* Occupancy of all elementary intervals of area 1 / (2n) */
+            occupied.assign((m + 1) * strata, 0);
+            auto cell = [&](uint32_t shape, uint32_t sx, uint32_t sy) {
+                return shape * strata + ((sx >> (m - shape)) << (m - shape)) + (sy >> shape);
+            };
+            auto mark = [&](uint32_t px, uint32_t py) {
+                uint32_t sx = px >> (32 - m), sy = py >> (32 - m);
+                for (uint32_t shape = 0; shape <= m; ++shape)
+                    occupied[cell(shape, sx, sy)] = 1;
+            };
+            for (uint32_t i = 0; i < n; ++i)
+                mark(x[i], y[i]);
+
+            for (uint32_t i = 0; i < n; ++i) {
+                /* Cell and subquadrant of the existing point */
+                uint32_t cx = subquadrant(x[i], log2Grid) >> 1, cy = subquadrant(y[i], log2Grid) >> 1;
+                uint32_t qx = subquadrant(x[i], log2Grid) & 1, qy = subquadrant(y[i], log2Grid) & 1;
+
+                uint32_t target[2][2];
+                int targetCount = 0;
+                if (powerOf4) {
+                    target[targetCount][0] = 1 - qx; target[targetCount++][1] = 1 - qy;
+                } else {
+                    /* Two points per cell occupy diagonal subquadrants; each of
+                       them spawns a point into one of the other two */
+                    bool flipX = rng.nextUInt() & 1;
+                    target[targetCount][0] = flipX ? 1 - qx : qx;
+                    target[targetCount++][1] = flipX ? qy : 1 - qy;
+                    target[targetCount][0] = flipX ? qx : 1 - qx;
+                    target[targetCount++][1] = flipX ? 1 - qy : qy;
+                }
+
+                bool found = false;
+                for (int t = 0; t < targetCount && !found; ++t) {
+                    uint32_t subX = 2 * cx + target[t][0], subY = 2 * cy + target[t][1];
+                    if (!powerOf4 && subquadrantUsed(x, y, n, i, log2Grid, subX, subY))
+                        continue;
+                    found = place(rng, occupied, m, log2Grid, subX, subY, cell, x[n + i], y[n + i]);
+                }
+                if (!found)
+                    return false;
+                mark(x[n + i], y[n + i]);
+            }
+        }
+
+        for (uint32_t i = 0; i < m_tableSize; ++i) {
+            result[2 * i] = x[i];
+            result[2 * i + 1] = y[i];
+        }
+        return true;
+    }
+
+    /// Index of the subquadrant containing a coordinate (for a grid of 2^log2Grid cells)
+    static uint32_t subquadrant(uint32_t v, uint32_t log2Grid) {
+        return v >> (31 - log2Grid);
+    }
+
+    /// Check whether a point added before \c i during this extension occupies the subquadrant
+    static bool subquadrantUsed(const std::vector<uint32_t> &x, const std::vector<uint32_t> &y,
+            uint32_t n, uint32_t i, uint32_t log2Grid, uint32_t subX, uint32_t subY) {
+        for (uint32_t j = 0; j < i; ++j) {
+            if (subquadrant(x[n + j], log2Grid) == subX && subquadrant(y[n + j], log2Grid) == subY)
+                return true;
+        }
+        return false;
+    }
+
+    /// Find a position within the subquadrant whose elementary intervals are all free
+    template <typename CellFunctor>
+    static bool place(pcg32 &rng, const std::vector<uint8_t> &occupied,
+            uint32_t m, uint32_t log2Grid, uint32_t subX, uint32_t subY, CellFunctor cell,
+            uint32_t &px, uint32_t &py) {
+        uint32_t perSub = 1u << (m - log2Grid - 1);
+        uint32_t offsetX = rng.nextUInt(perSub), offsetY = rng.nextUInt(perSub);
+        for (uint32_t i = 0; i < perSub; ++i) {
+            uint32_t sx = subX * perSub + (i + offsetX) % perSub;
+            if (occupied[cell(m, sx, 0)])
+                continue;
+            for (uint32_t j = 0; j < perSub; ++j) {
+                uint32_t sy = subY * perSub + (j + offsetY) % perSub;
+                bool free = true;
+                for (uint32_t shape = 0; shape <= m && free; ++shape)
+                    free = !occupied[cell(shape, sx, sy)];
+                if (free) {
+                    /* Jitter uniformly within the chosen strata */
+                    uint32_t mask = (1u << (32 - m)) - 1;
+                    px = (sx << (32 - m)) | (rng.nextUInt() & mask);
+                    py = (sy << (32 - m)) | (rng.nextUInt() & mask);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+private:
+    uint32_t m_tableSize = 1;
+    uint32_t m_tableCount = 1;
+    /// Tables of the instance created by the parser (shared by all clones)
+    std::unique_ptr<uint32_t[]> m_tables;
+    const PMJ *m_shared = nullptr;
+};
+
+NORI_REGISTER_CLASS(PMJ, "pmj");
+NORI_NAMESPACE_END
@@ -0,0 +1,186 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/render.h>
+#include <nori/samplefile.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/integrator.h>
+#include <nori/bitmap.h>
+#include <cstdio>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Consistency tests of deferred image reconstruction
+ *
+ * Renders the first camera of a scene with immediate splatting and with
+ * deferred reconstruction of every block, which must yield the same image.
+ *
+ * Afterwards, the raw samples of the first camera are stored in a sample
+ * file (like "nori --keep-samples") and reconstructed (like "nori
+ * refilter") with the filters of both cameras. The cameras only differ in
+ * their filters, hence the results must match direct renders of them.
+ */
+class ReconstructionTest : public NoriObject {
+public:
+    ReconstructionTest(const PropertyList &propList) {
+        /* Temporary file that receives the samples */
+        m_filename = propList.getString("filename", "reconstructiontest.samples");
+
+        /* Block size of the renders */
+        m_blockSize = propList.getInteger("blockSize", 8);
+    }
+
+    virtual ~ReconstructionTest() {
+        delete m_scene;
+    }
+
+    void addChild(NoriObject *obj) {
+        switch (obj->getClassType()) {
+            case EScene:
+                if (m_scene)
+                    throw NoriException("ReconstructionTest: tried to register multiple scenes!");
+                m_scene = static_cast<Scene *>(obj);
+                break;
+
+            default:
+                throw NoriException("ReconstructionTest::addChild(<%s>) is not supported!",
+                    classTypeName(obj->getClassType()));
+        }
+    }
+
+    /// Run the tests
+    void activate() {
+        if (!m_scene)
+            throw NoriException("ReconstructionTest: a scene is required!");
+        if (m_scene->getCameras().size() != 2)
+            throw NoriException("ReconstructionTest: the scene must have two cameras!");
+        if (m_scene->getCameras()[0]->getOutputSize() != m_scene->getCameras()[1]->getOutputSize())
+            throw NoriException("ReconstructionTest: the cameras must have the same output size!");
+
+        m_scene->getIntegrator()->preprocess(m_scene);
+
+        int total = 0, passed = 0;
+
+        cout << "------------------------------------------------------" << endl;
+        cout << "Testing deferred reconstruction of the blocks .. " << endl;
+        ++total;
+        if (testDeferred())
+            ++passed;
+
+        cout << "------------------------------------------------------" << endl;
+        cout << "Testing a reconstruction from stored samples with another filter .. " << endl;
+        ++total;
+        if (testRefilter())
+            ++passed;
+
+        cout << "Passed " << passed << "/" << total << " tests." << endl;
+        if (passed < total)
+            throw std::runtime_error("Some tests failed :(");
+    }
+
+    std::string toString() const {
+        return tfm::format(
+            "ReconstructionTest[\n"
+            "  filename = \"%s\",\n"
+            "  blockSize = %i\n"
+            "]",
+            m_filename,
+            m_blockSize
+        );
+    }
+
+    EClassType getClassType() const { return ETest; }
+private:
+    /// Render the first camera with immediate and deferred splatting
+    bool testDeferred() {
+        RenderSettings settings;
+        settings.blockSize = m_blockSize;
+        std::unique_ptr<Bitmap> reference(render(m_scene->getCameras()[0], settings));
+
+        settings.deferredFilter = true;
+        std::unique_ptr<Bitmap> deferred(render(m_scene->getCameras()[0], settings));
+
+        return compare(*reference, *deferred);
+    }
+
+    /// Store the samples of the first camera and reconstruct them with both filters
+    bool testRefilter() {
+        const Camera *cameras[2] = { m_scene->getCameras()[0], m_scene->getCameras()[1] };
+
+        RenderSettings settings;
+        settings.blockSize = m_blockSize;
+        std::unique_ptr<Bitmap> reference(render(cameras[1], settings));
+
+        settings.sampleFilename = m_filename;
+        std::unique_ptr<Bitmap> image(render(cameras[0], settings));
+
+        /* The filter of the render reproduces its image, and the other
+           filter the render of the second camera */
+        bool success = true;
+        for (int i=0; i<2; ++i) {
+            ImageBlock result(SampleFile::readSize(m_filename), cameras[i]->getReconstructionFilter());
+            result.clear();
+            SampleFile::read(m_filename, result);
+            std::unique_ptr<Bitmap> refiltered(result.toBitmap());
+            if (!compare(i == 0 ? *image : *reference, *refiltered))
+                success = false;
+        }
+        std::remove(m_filename.c_str());
+
+        return success;
+    }
+
+    /// Render a camera of the scene
+    Bitmap *render(const Camera *camera, const RenderSettings &settings) {
+        ImageBlock block(camera->getOutputSize(), camera->getReconstructionFilter());
+        block.clear();
+        Renderer(m_scene, block, settings, camera).render();
+        return block.toBitmap();
+    }
+
+    /// Compare two images (the samples are splatted in a different order)
+    static bool compare(const Bitmap &reference, const Bitmap &result) {
+        int errors = 0;
+        for (int y=0; y<reference.rows(); ++y) {
+            for (int x=0; x<reference.cols(); ++x) {
+                const Color3f &a = reference.coeff(y, x), &b = result.coeff(y, x);
+                float tolerance = 1e-4f * std::max(1.0f, a.maxCoeff());
+                if (((a - b).abs() > tolerance).any()) {
+                    if (errors++ < 5)
+                        cout << "Pixel (" << x << ", " << y << "): expected "
+                             << a.toString() << ", got " << b.toString() << endl;
+                }
+            }
+        }
+
+        if (errors > 0)
+            cout << errors << " pixels differ!" << endl;
+        cout << (errors == 0 ? "Accepted the reconstructed image." : "Rejected the reconstructed image.") << endl;
+        return errors == 0;
+    }
+
+    std::string m_filename;
+    int m_blockSize;
+    Scene *m_scene = nullptr;
+};
+
+NORI_REGISTER_CLASS(ReconstructionTest, "reconstructiontest");
+NORI_NAMESPACE_END
@@ -0,0 +1,392 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/render.h>
+#include <nori/checkpoint.h>
+#include <nori/samplefile.h>
+#include <nori/tilewriter.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/sampler.h>
+#include <nori/integrator.h>
+#include <nori/mesh.h>
+#include <nori/bsdf.h>
+#include <nori/timer.h>
+#include <tbb/parallel_for.h>
+#include <tbb/mutex.h>
+#include <fstream>
+
+NORI_NAMESPACE_BEGIN
+
+Renderer::Renderer(Scene *scene, ImageBlock &result, const RenderSettings &settings,
+        const Camera *camera)
+    : Renderer(scene, &result, nullptr, settings, camera) { }
+
+Renderer::Renderer(Scene *scene, TileWriter &writer, const RenderSettings &settings)
+    : Renderer(scene, nullptr, &writer, settings, nullptr) {
+    if (m_passSampleCount < m_sampleCount || !m_statistics.empty() ||
+        !m_settings.checkpointFilename.empty() || m_settings.partial)
+        throw NoriException("Renderer: streaming the output requires rendering all samples "
+            "in a single pass (without adaptive sampling, checkpoints or partial images)!");
+    if (scene->getIntegrator()->requiresFullImage())
+        throw NoriException("Renderer: the integrator cannot stream its output!");
+}
+
+Renderer::Renderer(Scene *scene, ImageBlock *result, TileWriter *writer, const RenderSettings &settings,
+        const Camera *camera)
+    : m_scene(scene), m_camera(camera ? camera : scene->getCamera()), m_result(result),
+      m_tileWriter(writer), m_settings(settings),
+      m_renderedSampleCount(0), m_stopped(false), m_checkpointPending(false) {
+    if (m_settings.adaptiveThreshold < 0)
+        throw NoriException("Renderer: the adaptive sampling threshold must be non-negative!");
+    if (m_settings.timeBudget < 0)
+        throw NoriException("Renderer: the time budget must be non-negative!");
+    if (m_settings.blockSize <= 0)
+        throw NoriException("Renderer: the block size must be positive!");
+    if (m_settings.resume && m_settings.checkpointFilename.empty())
+        throw NoriException("Renderer: resuming requires a checkpoint file!");
+
+    bool adaptive = m_settings.adaptiveThreshold > 0;
+    uint32_t samplerCount = (uint32_t) scene->getSampler()->getSampleCount();
+
+    m_sampleCount = settings.sampleCount;
+    if (m_sampleCount == 0)
+        m_sampleCount = adaptive ? 16 * samplerCount : samplerCount;
+
+    m_passSampleCount = settings.passSampleCount;
+    if (m_passSampleCount == 0) {
+        if (adaptive)
+            m_passSampleCount = samplerCount;
+        else if (m_settings.timeBudget > 0 || !m_settings.checkpointFilename.empty())
+            m_passSampleCount = 1;
+        else
+            m_passSampleCount = m_sampleCount;
+    }
+    m_passSampleCount = std::min(m_passSampleCount, m_sampleCount);
+
+    if (m_settings.firstSample >= m_sampleCount)
+        throw NoriException("Renderer: the range of samples is empty!");
+    m_renderedSampleCount = m_settings.firstSample;
+
+    if (m_settings.partial) {
+        /* Independent statistics of the same pixels can't be combined */
+        if (adaptive && m_settings.firstSample > 0)
+            throw NoriException("Renderer: adaptive sampling can't be split into sample ranges!");
+        if (scene->getIntegrator()->requiresFullImage())
+            throw NoriException("Renderer: the integrator can't render partial images!");
+    }
+
+    /* Contributions that the integrator adds in its postprocessing step
+       (e.g. the light tracing image of BDPT) aren't part of checkpoints */
+    if (!m_settings.checkpointFilename.empty() && scene->getIntegrator()->requiresFullImage())
+        throw NoriException("Renderer: the integrator doesn't support checkpoints!");
+
+    if (m_camera != scene->getCamera() && scene->getIntegrator()->requiresFullImage())
+        throw NoriException("Renderer: the integrator can only render the scene's active camera!");
+
+    Vector2i size = m_camera->getOutputSize();
+    if (adaptive)
+        m_statistics.resize((size_t) size.x() * (size_t) size.y());
+
+    /* The output variables are not part of checkpoints and sample files,
+       and only the block-based renderer records them */
+    if (!m_settings.aovs.empty()) {
+        if (m_settings.resume || m_settings.partial)
+            throw NoriException("Renderer: output variables can't be resumed "
+                "from a checkpoint or rendered as partial images!");
+        if (scene->getIntegrator()->overridesRender())
+            throw NoriException("Renderer: the integrator doesn't support output variables!");
+        if (m_result && !m_result->getAOVs())
+            m_result->setAOVs(m_settings.aovs);
+        const std::vector<Mesh *> &meshes = scene->getMeshes();
+        for (size_t i=0; i<meshes.size(); ++i)
+            m_meshIDs[meshes[i]] = (int) i;
+    }
+
+    /* A resumed render adds its samples to the existing ones */
+    if (!m_settings.sampleFilename.empty()) {
+        m_sampleFile.reset(new SampleFile(m_settings.sampleFilename, size, m_settings.resume));
+        m_settings.deferredFilter = true;
+    }
+}
+
+Renderer::~Renderer() {
+    if (m_checkpointThread.joinable())
+        m_checkpointThread.join();
+}
+
+void Renderer::render() {
+    Integrator *integrator = m_scene->getIntegrator();
+
+    if (!m_result || !integrator->render(m_scene, *m_result)) {
+        bool progressive = m_passSampleCount < m_sampleCount;
+        bool checkpoints = !m_settings.checkpointFilename.empty();
+        float budget = m_settings.timeBudget * 1000.0f,
+              interval = m_settings.checkpointInterval * 1000.0f;
+        Timer timer, checkpointTimer;
+
+        if (m_settings.resume)
+            resume();
+
+        for (uint32_t pass = 1; m_renderedSampleCount < m_sampleCount; ++pass) {
+            uint32_t count = std::min(m_passSampleCount, m_sampleCount - m_renderedSampleCount);
+            m_progressLabel = progressive ? tfm::format("pass %i", pass) : std::string("progress");
+            if (progressive || m_settings.showProgress)
+                cout << endl;
+            size_t active = renderPass(m_renderedSampleCount, count);
+            m_renderedSampleCount += count;
+
+            double elapsed = timer.elapsed();
+            if (progressive) {
+                cout << "\r  pass " << pass << ": " << m_renderedSampleCount << " spp";
+                if (!m_statistics.empty())
+                    cout << ", " << active << " pixels left";
+                cout << " (" << timeString(elapsed) << ")";
+                cout.flush();
+            }
+
+            if (m_stopped || (!m_statistics.empty() && active == 0))
+                break;
+
+            if (checkpoints && checkpointTimer.elapsed() > interval) {
+                checkpoint(false);
+                checkpointTimer.reset();
+            }
+
+            /* Don't start a pass that is expected to exceed the time budget */
+            if (budget > 0 && elapsed * (pass + 1) / pass > budget)
+                break;
+        }
+        if (progressive || m_settings.showProgress)
+            cout << endl;
+
+        /* The final state allows adding further samples later on */
+        if (checkpoints)
+            checkpoint(true);
+    }
+
+    /* Give the integrator a chance to add contributions that were
+       not associated with a particular image block */
+    if (m_result) {
+        m_result->lock();
+        integrator->postprocess(m_scene, *m_result);
+        m_result->unlock();
+    }
+}
+
+void Renderer::resume() {
+    const std::string &filename = m_settings.checkpointFilename;
+    if (!std::ifstream(filename).good()) {
+        cout << endl << "  no checkpoint \"" << filename << "\" found, starting from scratch";
+        return;
+    }
+
+    RenderCheckpoint checkpoint(filename);
+    if (checkpoint.getSamplerInfo() != m_scene->getSampler()->toString())
+        throw NoriException("The checkpoint was rendered with a different sampler!");
+    checkpoint.restore(*m_result, m_statistics);
+    m_renderedSampleCount = std::min(checkpoint.getSampleCount(), m_sampleCount);
+}
+
+void Renderer::checkpoint(bool wait) {
+    if (m_checkpointPending) {
+        if (!wait)
+            return;
+        m_checkpointThread.join();
+    } else if (m_checkpointThread.joinable()) {
+        m_checkpointThread.join();
+    }
+
+    /* Capture the state now, the worker threads may continue afterwards */
+    std::shared_ptr<RenderCheckpoint> checkpoint = std::make_shared<RenderCheckpoint>(
+        *m_result, m_statistics, m_renderedSampleCount, m_scene->getSampler()->toString());
+    std::string filename = m_settings.checkpointFilename;
+
+    m_checkpointPending = true;
+    m_checkpointThread = std::thread([this, checkpoint, filename] {
+        try {
+            checkpoint->save(filename);
+        } catch (const std::exception &e) {
+            cerr << "Warning: unable to write a checkpoint: " << e.what() << endl;
+        }
+        m_checkpointPending = false;
+    });
+
+    if (wait)
+        m_checkpointThread.join();
+}
+
+void Renderer::savePartial(const std::string &filename) const {
+    RenderCheckpoint(*m_result, m_statistics, m_renderedSampleCount,
+        m_scene->getSampler()->toString()).save(filename);
+}
+
+size_t Renderer::renderPass(uint32_t firstSample, uint32_t sampleCount) {
+    const Camera *camera = m_camera;
+
+    /* Create a block generator (i.e. a work scheduler), which splits
+       the blocks at the end of the pass to keep all threads busy */
+    int threadCount = getCoreCount();
+    BlockGenerator blockGenerator(camera->getOutputSize(), m_settings.blockSize,
+        m_settings.blockOrder, 2 * threadCount, m_settings.firstTile, m_settings.lastTile);
+    std::atomic<size_t> active(0);
+    std::atomic<int> blocksDone(0), reported(-1);
+    int blockCount = blockGenerator.getBlockCount();
+    tbb::mutex progressMutex;
+
+    /* Print the percentage of finished blocks whenever it changes */
+    auto progress = [&](int done) {
+        int percent = done * 100 / blockCount, last = reported;
+        while (percent > last) {
+            if (reported.compare_exchange_weak(last, percent)) {
+                tbb::mutex::scoped_lock lock(progressMutex);
+                cout << "\r  " << m_progressLabel << ": " << reported << "%";
+                cout.flush();
+                break;
+            }
+        }
+    };
+
+    /* Every worker keeps requesting blocks until none are left, hence
+       the load is balanced at the granularity of single blocks */
+    auto map = [&](int) {
+        /* Allocate memory for a small image block to be rendered
+           by the current thread */
+        ImageBlock block(Vector2i(m_settings.blockSize),
+            camera->getReconstructionFilter());
+        block.setDeferred(m_settings.deferredFilter);
+        block.setAOVs(m_settings.aovs);
+
+        /* Create a clone of the sampler for the current thread */
+        std::unique_ptr<Sampler> sampler(m_scene->getSampler()->clone());
+
+        /* Request image blocks from the block generator */
+        while (blockGenerator.next(block)) {
+            /* Inform the sampler about the block to be rendered */
+            sampler->prepare(block);
+
+            /* Render all contained pixels */
+            bool sampled = false;
+            active += renderBlock(sampler.get(), block, firstSample, sampleCount, sampled);
+
+            /* Reconstruct the block from its samples in deferred mode */
+            if (block.isDeferred()) {
+                if (m_sampleFile)
+                    m_sampleFile->write(block);
+                block.resolve();
+            }
+
+            /* The image block has been processed. Now add it to
+               the "big" block that represents the entire image */
+            if (m_tileWriter)
+                m_tileWriter->put(block);
+            else if (sampled)
+                m_result->put(block);
+
+            if (m_settings.showProgress)
+                progress(++blocksDone);
+        }
+    };
+
+    /// Uncomment the following line for single threaded rendering
+    // map(0);
+
+    /// Default: parallel rendering
+    tbb::parallel_for(0, std::min(threadCount, blockCount), map);
+
+    return active;
+}
+
+size_t Renderer::renderBlock(Sampler *sampler, ImageBlock &block, uint32_t firstSample,
+        uint32_t sampleCount, bool &sampled) {
+    const Camera *camera = m_camera;
+    const Integrator *integrator = m_scene->getIntegrator();
+    int width = camera->getOutputSize().x();
+    bool adaptive = !m_statistics.empty();
+    AOVBuffer *aovs = block.getAOVs();
+    size_t active = 0;
+
+    Point2i offset = block.getOffset();
+    Vector2i size  = block.getSize();
+
+    /* Clear the block contents */
+    block.clear();
+
+    /* The samples of a pixel are splatted together */
+    std::vector<Point2f> positions(sampleCount);
+    std::vector<Color3f> values(sampleCount);
+
+    /* For each pixel and pixel sample sample */
+    for (int y=0; y<size.y(); ++y) {
+        for (int x=0; x<size.x(); ++x) {
+            Point2i pixel(x + offset.x(), y + offset.y());
+
+            /* Blocks never overlap, hence no other thread touches these statistics */
+            PixelStatistics *stats = nullptr;
+            if (adaptive) {
+                stats = &m_statistics[(size_t) pixel.y() * width + pixel.x()];
+                if (!isActive(*stats))
+                    continue;
+            }
+
+            /* Continue the sample sequence where the previous pass stopped */
+            sampler->generate(pixel, stats ? stats->sampleCount : firstSample);
+            for (uint32_t i=0; i<sampleCount; ++i) {
+                Point2f pixelSample = pixel.cast<float>() + sampler->next2D();
+                Point2f apertureSample = sampler->next2D();
+
+                /* Sample a ray from the camera */
+                Ray3f ray;
+                Color3f value = camera->sampleRay(ray, pixelSample, apertureSample);
+
+                /* Compute the incident radiance (and the first surface seen by the camera ray) */
+                if (aovs) {
+                    AOVRecord record;
+                    value *= integrator->LiAOV(m_scene, sampler, ray, record);
+                    if (record.mesh)
+                        record.meshID = m_meshIDs.at(record.mesh);
+                    aovs->put(Point2i(x, y), record);
+                } else {
+                    value *= integrator->Li(m_scene, sampler, ray);
+                }
+
+                positions[i] = pixelSample;
+                values[i] = value;
+
+                if (stats) {
+                    if (value.isValid())
+                        stats->put(value.getLuminance());
+                    else
+                        stats->skip();
+                }
+
+                sampler->advance();
+            }
+
+            /* Store in the image block */
+            block.put(pixel, positions.data(), values.data(), sampleCount);
+            sampled = true;
+
+            if (stats && isActive(*stats))
+                active++;
+        }
+    }
+    return active;
+}
+
+NORI_NAMESPACE_END
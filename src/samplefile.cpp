@@ -0,0 +1,98 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/samplefile.h>
+#include <cstring>
+
+#define NORI_SAMPLE_FILE_MAGIC "NORISMP1"
+#define NORI_SAMPLE_FILE_CHUNK 65536 /* Number of samples read at once */
+
+NORI_NAMESPACE_BEGIN
+
+/// Read the header of a sample file and return the image size
+static Vector2i readHeader(std::istream &is, const std::string &filename) {
+    char magic[8];
+    int32_t size[2];
+    is.read(magic, sizeof(magic));
+    is.read(reinterpret_cast<char *>(size), sizeof(size));
+    if (!is || memcmp(magic, NORI_SAMPLE_FILE_MAGIC, sizeof(magic)) != 0)
+        throw NoriException("\"%s\" is not a sample file!", filename);
+    return Vector2i(size[0], size[1]);
+}
+
+SampleFile::SampleFile(const std::string &filename, const Vector2i &size, bool append)
+    : m_filename(filename) {
+    if (append && std::ifstream(filename).good()) {
+        Vector2i fileSize = readSize(filename);
+        if (fileSize != size)
+            throw NoriException("The sample file \"%s\" belongs to an image of a different size (%ix%i)!",
+                filename, fileSize.x(), fileSize.y());
+        m_file.open(filename, std::ios::binary | std::ios::app);
+    } else {
+        int32_t header[2] = { size.x(), size.y() };
+        m_file.open(filename, std::ios::binary | std::ios::trunc);
+        m_file.write(NORI_SAMPLE_FILE_MAGIC, 8);
+        m_file.write(reinterpret_cast<const char *>(header), sizeof(header));
+    }
+    if (!m_file)
+        throw NoriException("Unable to write the sample file \"%s\"!", filename);
+}
+
+void SampleFile::write(const ImageBlock &block) {
+    const std::vector<ImageBlock::Sample> &samples = block.getSamples();
+    if (samples.empty())
+        return;
+
+    /* Convert outside of the critical section */
+    std::vector<float> records(5 * samples.size());
+    float *ptr = records.data();
+    for (const ImageBlock::Sample &sample : samples) {
+        *ptr++ = sample.position.x(); *ptr++ = sample.position.y();
+        *ptr++ = sample.value.r(); *ptr++ = sample.value.g(); *ptr++ = sample.value.b();
+    }
+
+    tbb::mutex::scoped_lock lock(m_mutex);
+    m_file.write(reinterpret_cast<const char *>(records.data()), sizeof(float) * records.size());
+    if (!m_file)
+        throw NoriException("Unable to write the sample file \"%s\"!", m_filename);
+}
+
+Vector2i SampleFile::readSize(const std::string &filename) {
+    std::ifstream is(filename, std::ios::binary);
+    return readHeader(is, filename);
+}
+
+void SampleFile::read(const std::string &filename, ImageBlock &block) {
+    std::ifstream is(filename, std::ios::binary);
+    Vector2i size = readHeader(is, filename);
+    if (block.getSize() != size)
+        throw NoriException("The image block doesn't match the size of the sample file \"%s\" (%ix%i)!",
+            filename, size.x(), size.y());
+
+    std::vector<float> records(5 * NORI_SAMPLE_FILE_CHUNK);
+    while (is) {
+        is.read(reinterpret_cast<char *>(records.data()), sizeof(float) * records.size());
+        size_t count = (size_t) is.gcount() / (5 * sizeof(float));
+        for (size_t i=0; i<count; ++i) {
+            const float *record = &records[5 * i];
+            block.put(Point2f(record[0], record[1]), Color3f(record[2], record[3], record[4]));
+        }
+    }
+}
+
+NORI_NAMESPACE_END
@@ -22,6 +22,7 @@
 #include <nori/sampler.h>
 #include <nori/camera.h>
 #include <nori/emitter.h>
+#include <algorithm>
 
 NORI_NAMESPACE_BEGIN
 
@@ -30,15 +31,17 @@ Scene::Scene(const PropertyList &) {
 }
 
 Scene::~Scene() {
+    /* A scene that failed to load doesn't own the reused meshes yet */
+    if (m_previous)
+        releaseMeshes(getSharedMeshes());
     delete m_accel;
     delete m_sampler;
-    delete m_camera;
+    for (Camera *camera : m_cameras)
+        delete camera;
     delete m_integrator;
 }
 
 void Scene::activate() {
-    m_accel->build();
-
     if (!m_integrator)
         throw NoriException("No integrator was specified!");
     if (!m_camera)
@@ -50,6 +53,18 @@ void Scene::activate() {
             NoriObjectFactory::createInstance("independent", PropertyList()));
     }
 
+    /* Only take over the meshes of the previous version once the
+       scene is known to be valid (the previous version keeps them
+       if loading fails) */
+    if (m_previous) {
+        adoptMeshes();
+        m_previous = nullptr;
+    }
+
+    /* A BVH that was taken over from a previous version is still valid */
+    if (!m_accel->isBuilt())
+        m_accel->build();
+
     cout << endl;
     cout << "Configuration: " << toString() << endl;
     cout << endl;
@@ -61,6 +76,8 @@ void Scene::addChild(NoriObject *obj) {
                 Mesh *mesh = static_cast<Mesh *>(obj);
                 m_accel->addMesh(mesh);
                 m_meshes.push_back(mesh);
+                if (mesh->isEmitter())
+                    m_emitterMeshes.push_back(mesh);
             }
             break;
         
@@ -78,9 +95,9 @@ void Scene::addChild(NoriObject *obj) {
             break;
 
         case ECamera:
-            if (m_camera)
-                throw NoriException("There can only be one camera per scene!");
-            m_camera = static_cast<Camera *>(obj);
+            m_cameras.push_back(static_cast<Camera *>(obj));
+            if (!m_camera)
+                m_camera = m_cameras.back();
             break;
         
         case EIntegrator:
@@ -95,6 +112,32 @@ void Scene::addChild(NoriObject *obj) {
     }
 }
 
+void Scene::adoptMeshes() {
+    std::unordered_set<const Mesh *> shared = getSharedMeshes();
+    if (m_previous->m_meshes == m_meshes && m_previous->m_accel->isBuilt())
+        std::swap(m_accel, m_previous->m_accel);
+
+    /* Don't let the previous version delete the meshes of this scene */
+    m_previous->releaseMeshes(shared);
+}
+
+std::unordered_set<const Mesh *> Scene::getSharedMeshes() const {
+    std::unordered_set<const Mesh *> previous(m_previous->m_meshes.begin(), m_previous->m_meshes.end());
+    std::unordered_set<const Mesh *> shared;
+    for (const Mesh *mesh : m_meshes)
+        if (previous.count(mesh) > 0)
+            shared.insert(mesh);
+    return shared;
+}
+
+void Scene::releaseMeshes(const std::unordered_set<const Mesh *> &meshes) {
+    auto released = [&](const Mesh *mesh) { return meshes.count(mesh) > 0; };
+    m_meshes.erase(std::remove_if(m_meshes.begin(), m_meshes.end(), released), m_meshes.end());
+    m_emitterMeshes.erase(std::remove_if(m_emitterMeshes.begin(), m_emitterMeshes.end(), released),
+        m_emitterMeshes.end());
+    m_accel->releaseMeshes(meshes);
+}
+
 std::string Scene::toString() const {
     std::string meshes;
     for (size_t i=0; i<m_meshes.size(); ++i) {
@@ -104,17 +147,26 @@ std::string Scene::toString() const {
         meshes += "\n";
     }
 
+    std::string cameras;
+    for (size_t i=0; i<m_cameras.size(); ++i) {
+        cameras += std::string("  ") + indent(m_cameras[i]->toString(), 2);
+        if (i + 1 < m_cameras.size())
+            cameras += ",";
+        cameras += "\n";
+    }
+
     return tfm::format(
         "Scene[\n"
         "  integrator = %s,\n"
         "  sampler = %s\n"
-        "  camera = %s,\n"
+        "  cameras = {\n"
+        "  %s  },\n"
         "  meshes = {\n"
         "  %s  }\n"
         "]",
         indent(m_integrator->toString()),
         indent(m_sampler->toString()),
-        indent(m_camera->toString()),
+        indent(cameras, 2),
         indent(meshes, 2)
     );
 }
@@ -0,0 +1,409 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/server.h>
+#include <nori/parser.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/integrator.h>
+#include <nori/timer.h>
+#include <filesystem/resolver.h>
+#include <sys/stat.h>
+#include <Eigen/Geometry>
+#include <algorithm>
+#include <thread>
+#include <cerrno>
+#include <cstring>
+
+#if !defined(_WIN32)
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include <csignal>
+#endif
+
+NORI_NAMESPACE_BEGIN
+
+RenderServer::RenderServer(const std::string &socketPath, const RenderSettings &settings,
+        const EXRSettings &exrSettings)
+    : m_socketPath(socketPath), m_settings(settings), m_exrSettings(exrSettings) {
+    if (m_settings.partial || !m_settings.checkpointFilename.empty() ||
+        !m_settings.sampleFilename.empty())
+        throw NoriException("Partial renders, checkpoints and sample files "
+            "are not supported by the render server!");
+}
+
+RenderServer::~RenderServer() { }
+
+RenderServer::Connection::~Connection() {
+#if !defined(_WIN32)
+    ::close(fd);
+#endif
+}
+
+void RenderServer::Connection::send(const std::string &line) {
+#if !defined(_WIN32)
+    std::string data = line + "\n";
+    size_t offset = 0;
+    while (offset < data.size()) {
+        ssize_t written = ::send(fd, data.data() + offset, data.size() - offset, 0);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return;
+        offset += (size_t) written;
+    }
+#endif
+}
+
+void RenderServer::run() {
+#if defined(_WIN32)
+    throw NoriException("The render server is not available on Windows!");
+#else
+    /* Don't terminate when a client closes its connection before the reply */
+    signal(SIGPIPE, SIG_IGN);
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (m_socketPath.size() >= sizeof(address.sun_path))
+        throw NoriException("The socket path \"%s\" is too long!", m_socketPath);
+    strcpy(address.sun_path, m_socketPath.c_str());
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        throw NoriException("Unable to create a socket: %s", strerror(errno));
+
+    /* Remove the socket of a previous server that wasn't shut down */
+    ::unlink(m_socketPath.c_str());
+    if (::bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+        ::listen(fd, SOMAXCONN) != 0 || ::pipe(m_wakeup) != 0) {
+        std::string error = strerror(errno);
+        ::close(fd);
+        throw NoriException("Unable to listen on \"%s\": %s", m_socketPath, error);
+    }
+
+    cout << "Listening on \"" << m_socketPath << "\" .." << endl;
+
+    m_stopping = false;
+    std::thread renderThread([this] { renderJobs(); });
+
+    /* Connections that are still being read, with their incomplete lines */
+    std::vector<std::shared_ptr<Connection>> connections;
+    std::vector<std::string> buffers;
+    std::string error;
+
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_stopping)
+                break;
+        }
+
+        std::vector<pollfd> fds(2 + connections.size());
+        fds[0] = pollfd { m_wakeup[0], POLLIN, 0 };
+        fds[1] = pollfd { fd, POLLIN, 0 };
+        for (size_t i = 0; i < connections.size(); ++i)
+            fds[2 + i] = pollfd { connections[i]->fd, POLLIN, 0 };
+
+        if (::poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            error = strerror(errno);
+            break;
+        }
+
+        /* The render thread only writes to the pipe when stopping */
+        if (fds[0].revents)
+            continue;
+
+        /* Read from the connections before adding new ones (the indices refer to "fds") */
+        for (size_t i = connections.size(); i-- > 0; ) {
+            if (!fds[2 + i].revents)
+                continue;
+            char chunk[4096];
+            ssize_t count = ::recv(connections[i]->fd, chunk, sizeof(chunk), 0);
+            if (count < 0 && (errno == EINTR || errno == EAGAIN))
+                continue;
+            if (count > 0) {
+                buffers[i].append(chunk, (size_t) count);
+                queueJobs(connections[i], buffers[i]);
+            } else {
+                /* Also run a last job that isn't terminated by a newline */
+                buffers[i] += '\n';
+                queueJobs(connections[i], buffers[i]);
+
+                /* The queued jobs keep the connection open until they are answered */
+                connections.erase(connections.begin() + i);
+                buffers.erase(buffers.begin() + i);
+            }
+        }
+
+        if (fds[1].revents) {
+            int connection = ::accept(fd, nullptr, nullptr);
+            if (connection >= 0) {
+                connections.push_back(std::make_shared<Connection>(connection));
+                buffers.emplace_back();
+            } else if (errno != EINTR && errno != ECONNABORTED) {
+                error = strerror(errno);
+                break;
+            }
+        }
+    }
+
+    /* Stop the render thread (when failing) and answer the remaining jobs */
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_condition.notify_all();
+    renderThread.join();
+    for (Job &job : m_jobs)
+        job.connection->send("error The server is shutting down");
+    m_jobs.clear();
+    connections.clear();
+
+    ::close(fd);
+    ::close(m_wakeup[0]);
+    ::close(m_wakeup[1]);
+    ::unlink(m_socketPath.c_str());
+    if (!error.empty())
+        throw NoriException("Unable to serve the connections: %s", error);
+    cout << "Shut down the render server." << endl;
+#endif
+}
+
+void RenderServer::queueJobs(const std::shared_ptr<Connection> &connection, std::string &buffer) {
+    size_t newline;
+    while ((newline = buffer.find('\n')) != std::string::npos) {
+        std::string line = buffer.substr(0, newline);
+        buffer.erase(0, newline + 1);
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line.find_first_not_of(" \t") == std::string::npos)
+            continue;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_jobs.push_back(Job { connection, line });
+        }
+        m_condition.notify_one();
+    }
+}
+
+void RenderServer::renderJobs() {
+#if !defined(_WIN32)
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this] { return m_stopping || !m_jobs.empty(); });
+            if (m_stopping)
+                return;
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+
+        if (job.line == "shutdown") {
+            job.connection->send("done shutdown");
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stopping = true;
+            }
+            char byte = 0;
+            while (::write(m_wakeup[1], &byte, 1) < 0 && errno == EINTR)
+                ;
+            return;
+        }
+
+        std::string reply;
+        try {
+            reply = "done " + render(job.line);
+        } catch (const std::exception &e) {
+            cerr << "Error: " << e.what() << endl;
+            reply = std::string("error ") + e.what();
+            std::replace(reply.begin(), reply.end(), '\n', ' ');
+        }
+        job.connection->send(reply);
+    }
+#endif
+}
+
+std::string RenderServer::render(const std::string &job) {
+    std::vector<std::string> tokens = tokenize(job, " \t");
+    std::string sceneFilename = tokens[0], outputFilename, cameraFilename;
+    std::vector<std::string> lookAt;
+    RenderSettings settings = m_settings;
+    Vector2i size(-1, -1);
+    float fov = 30.0f;
+    bool cameraOptions = false;
+
+    for (size_t i = 1; i < tokens.size(); ++i) {
+        size_t pos = tokens[i].find('=');
+        if (pos == std::string::npos)
+            throw NoriException("Invalid job argument \"%s\"", tokens[i]);
+        std::string key = tokens[i].substr(0, pos), value = tokens[i].substr(pos + 1);
+        if (key == "output")
+            outputFilename = value;
+        else if (key == "camera")
+            cameraFilename = value;
+        else if (key == "lookat")
+            lookAt = tokenize(value, ",");
+        else if (key == "fov") {
+            fov = toFloat(value);
+            cameraOptions = true;
+        } else if (key == "width") {
+            size.x() = toInt(value);
+            cameraOptions = true;
+        } else if (key == "height") {
+            size.y() = toInt(value);
+            cameraOptions = true;
+        } else if (key == "spp")
+            settings.sampleCount = (uint32_t) toUInt(value);
+        else
+            throw NoriException("Invalid job argument \"%s\"", tokens[i]);
+    }
+
+    if (outputFilename.empty())
+        throw NoriException("The job doesn't specify an output file!");
+    if (!lookAt.empty() && lookAt.size() != 9)
+        throw NoriException("\"lookat\" expects 9 comma-separated values!");
+    if (lookAt.empty() && cameraOptions)
+        throw NoriException("\"fov\", \"width\" and \"height\" require \"lookat\"!");
+    if (!lookAt.empty() && !cameraFilename.empty())
+        throw NoriException("\"camera\" and \"lookat\" can't be combined!");
+
+    Scene *scene = getScene(sceneFilename);
+
+    /* Create the camera that replaces the scene's camera (if any) */
+    std::unique_ptr<Camera> camera;
+    if (!cameraFilename.empty()) {
+        std::unique_ptr<NoriObject> object(loadFromXML(cameraFilename));
+        if (object->getClassType() != NoriObject::ECamera)
+            throw NoriException("\"%s\" does not describe a camera!", cameraFilename);
+        camera.reset(static_cast<Camera *>(object.release()));
+    } else if (!lookAt.empty()) {
+        Vector3f origin(toFloat(lookAt[0]), toFloat(lookAt[1]), toFloat(lookAt[2])),
+                 target(toFloat(lookAt[3]), toFloat(lookAt[4]), toFloat(lookAt[5])),
+                 up(toFloat(lookAt[6]), toFloat(lookAt[7]), toFloat(lookAt[8]));
+
+        /* Same construction as the <lookat> element of the scene format */
+        Vector3f dir = (target - origin).normalized();
+        Vector3f left = up.normalized().cross(dir).normalized();
+        Vector3f newUp = dir.cross(left).normalized();
+
+        Eigen::Matrix4f trafo;
+        trafo << left, newUp, dir, origin,
+                  0, 0, 0, 1;
+
+        Vector2i sceneSize = scene->getCamera()->getOutputSize();
+        PropertyList propList;
+        propList.setTransform("toWorld", Transform(trafo));
+        propList.setInteger("width", size.x() > 0 ? size.x() : sceneSize.x());
+        propList.setInteger("height", size.y() > 0 ? size.y() : sceneSize.y());
+        propList.setFloat("fov", fov);
+
+        camera.reset(static_cast<Camera *>(
+            NoriObjectFactory::createInstance("perspective", propList)));
+        camera->activate();
+    }
+
+    /* Determine the filename of the output bitmap */
+    std::string outputName = outputFilename;
+    size_t lastdot = outputName.find_last_of(".");
+    if (lastdot != std::string::npos)
+        outputName.erase(lastdot, std::string::npos);
+
+    Camera *sceneCamera = camera ? scene->setCamera(camera.get()) : nullptr;
+    try {
+        const Camera *activeCamera = scene->getCamera();
+
+        /* Preprocessing can depend on the camera (e.g. when
+           light paths are traced), so it is repeated every job */
+        scene->getIntegrator()->preprocess(scene);
+
+        ImageBlock result(activeCamera->getOutputSize(), activeCamera->getReconstructionFilter());
+        result.clear();
+
+        cout << "Rendering \"" << sceneFilename << "\" to \"" << outputName << "\" .. ";
+        cout.flush();
+        Timer timer;
+        Renderer renderer(scene, result, settings);
+        renderer.render();
+        cout << "done. (took " << timer.elapsedString() << ")" << endl;
+
+        result.normalize();
+        result.saveEXR(outputName, m_exrSettings);
+        result.savePNG(outputName);
+    } catch (...) {
+        if (sceneCamera)
+            scene->setCamera(sceneCamera);
+        throw;
+    }
+    if (sceneCamera)
+        scene->setCamera(sceneCamera);
+
+    return outputName + ".exr";
+}
+
+Scene *RenderServer::getScene(const std::string &filename) {
+    filesystem::path path = filesystem::path(filename).make_absolute();
+
+    struct stat status;
+    if (stat(path.str().c_str(), &status) != 0)
+        throw NoriException("Unable to access the scene \"%s\"!", filename);
+
+    /* When the file was modified, its unchanged meshes are reused */
+    auto it = m_scenes.find(path.str());
+    Scene *previous = nullptr;
+    if (it != m_scenes.end()) {
+        if (it->second.modificationTime == status.st_mtime)
+            return it->second.scene.get();
+        previous = it->second.scene.get();
+
+        /* The previous version can't be rendered anymore, but it still owns
+           the meshes if reloading fails, in which case the next job retries */
+        it->second.modificationTime = 0;
+    }
+
+    cout << "Loading \"" << path.str() << "\" .." << endl;
+
+    /* Resolve the resources of the scene relative to its directory,
+       without affecting the scenes that are loaded later on */
+    filesystem::resolver *resolver = getFileResolver();
+    resolver->prepend(path.parent_path());
+    std::unique_ptr<NoriObject> root;
+    try {
+        root.reset(loadFromXML(path.str(), previous));
+    } catch (...) {
+        resolver->erase(resolver->begin());
+        throw;
+    }
+    resolver->erase(resolver->begin());
+
+    if (root->getClassType() != NoriObject::EScene)
+        throw NoriException("\"%s\" does not describe a scene!", filename);
+
+    SceneEntry &entry = m_scenes[path.str()];
+    entry.scene.reset(static_cast<Scene *>(root.release()));
+    entry.modificationTime = status.st_mtime;
+    return entry.scene.get();
+}
+
+NORI_NAMESPACE_END
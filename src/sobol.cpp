@@ -0,0 +1,86 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/sampler.h>
+#include <nori/lowdiscrepancy.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * Owen-scrambled Sobol sampling
+ *
+ * Every pair of dimensions requested via \ref next2D() (and every single
+ * dimension requested via \ref next1D()) is drawn from the first two
+ * dimensions of the Sobol sequence, which form a (0, 2)-sequence. To avoid
+ * correlation between the pairs and between pixels, both the sample index
+ * and the resulting coordinates are scrambled using hash-based nested
+ * uniform scrambling, seeded by the pixel and the dimension (Burley,
+ * "Practical Hash-based Owen Scrambling", JCGT 2020). Any prefix of the
+ * samples of a pixel whose length is a power of two is stratified.
+ */
+class Sobol : public Sampler {
+public:
+    Sobol(const PropertyList &propList) {
+        m_sampleCount = (size_t) propList.getInteger("sampleCount", 1);
+        m_seed = (uint32_t) propList.getInteger("seed", 0);
+    }
+
+    virtual ~Sobol() { }
+
+    std::unique_ptr<Sampler> clone() const {
+        std::unique_ptr<Sobol> cloned(new Sobol());
+        cloned->m_sampleCount = m_sampleCount;
+        cloned->m_seed = m_seed;
+        return std::move(cloned);
+    }
+
+    void prepare(const ImageBlock &) { /* No-op for this sampler */ }
+
+    float next1D() {
+        uint64_t seed = LowDiscrepancy::hash(m_pixelSeed, m_dimension++);
+        uint32_t index = shuffledIndex(seed);
+        return sample(index, 0, seed);
+    }
+
+    Point2f next2D() {
+        uint64_t seed = LowDiscrepancy::hash(m_pixelSeed, m_dimension++);
+        uint32_t index = shuffledIndex(seed);
+        return Point2f(sample(index, 0, seed), sample(index, 1, seed));
+    }
+
+    std::string toString() const {
+        return tfm::format("Sobol[sampleCount=%i, seed=%i]", m_sampleCount, m_seed);
+    }
+protected:
+    Sobol() { }
+
+    /// Decorrelate the sample order of different dimensions (preserves stratification)
+    uint32_t shuffledIndex(uint64_t seed) const {
+        return LowDiscrepancy::nestedUniformScramble(m_sampleIndex, (uint32_t) seed);
+    }
+
+    float sample(uint32_t index, int dim, uint64_t seed) const {
+        uint32_t value = LowDiscrepancy::sobol(index, dim);
+        uint32_t scrambleSeed = (uint32_t) LowDiscrepancy::hash(seed, dim + 1);
+        return LowDiscrepancy::toFloat(LowDiscrepancy::nestedUniformScramble(value, scrambleSeed));
+    }
+
+};
+
+NORI_REGISTER_CLASS(Sobol, "sobol");
+NORI_NAMESPACE_END
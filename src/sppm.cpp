@@ -0,0 +1,411 @@
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/sampler.h>
+#include <nori/emitter.h>
+#include <nori/bsdf.h>
+#include <nori/block.h>
+#include <nori/warp.h>
+#include <nori/atomic.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <pcg32.h>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Stochastic progressive photon mapping
+ *
+ * Alternates camera passes, which find one visible point on a diffuse
+ * surface per pixel, and photon passes, which splat photon power into
+ * nearby visible points. Every pixel keeps its own shrinking lookup
+ * radius, so the estimate converges while memory stays proportional to
+ * the number of pixels (no photons are stored). The image is refreshed
+ * after each iteration, so convergence can be followed in the preview.
+ *
+ * Since the visible points are tied to pixels, the reconstruction filter
+ * of the camera is not used; each iteration takes one jittered camera
+ * ray per pixel (box filtering).
+ */
+class SPPMIntegrator : public Integrator {
+public:
+	SPPMIntegrator(const PropertyList &props) {
+		/* Number of camera/photon pass pairs */
+		m_iterations = props.getInteger("iterations", 64);
+		/* Photon paths traced per iteration */
+		m_photonsPerIteration = props.getInteger("photonCount", 250000);
+		/* Initial lookup radius (0: derive from the scene size) */
+		m_initialRadius = props.getFloat("initialRadius", 0.0f);
+		/* Fraction of new photons kept per iteration (controls radius reduction) */
+		m_alpha = props.getFloat("alpha", 2.0f / 3.0f);
+		/* Maximum number of bounces of camera and photon paths */
+		m_maxDepth = props.getInteger("maxDepth", 5);
+
+		if (m_iterations <= 0 || m_photonsPerIteration <= 0)
+			throw NoriException("SPPMIntegrator: iterations and photonCount must be positive!");
+		if (m_initialRadius < 0)
+			throw NoriException("SPPMIntegrator: initialRadius must be non-negative!");
+		if (m_alpha <= 0 || m_alpha > 1)
+			throw NoriException("SPPMIntegrator: alpha must be in (0, 1]!");
+	}
+
+	bool requiresFullImage() const {
+		return true;
+	}
+
+	bool overridesRender() const {
+		return true;
+	}
+
+	bool render(const Scene *scene, ImageBlock &result) {
+		const Camera *camera = scene->getCamera();
+		Vector2i size = camera->getOutputSize();
+		m_pixelCount = static_cast<size_t>(size.x()) * size.y();
+
+		if (scene->getEmitterMeshes().empty())
+			throw NoriException("SPPMIntegrator: the scene contains no emitters!");
+
+		float initialRadius = m_initialRadius;
+		if (initialRadius == 0)
+			initialRadius = scene->getBoundingBox().getExtents().norm() / 500.0f;
+
+		m_pixels.reset(new SPPMPixel[m_pixelCount]);
+		for (size_t i = 0; i < m_pixelCount; ++i)
+			m_pixels[i].radius = initialRadius;
+		m_gridCounts.reset(new std::atomic<uint32_t>[m_pixelCount + 1]);
+		m_gridEntries.clear();
+		m_seed = scene->getSampler()->getSeed();
+
+		for (int iteration = 0; iteration < m_iterations; ++iteration) {
+			cameraPass(scene, iteration);
+			buildGrid();
+			photonPass(scene, iteration);
+			updatePixels();
+			writeImage(result, size, iteration + 1);
+		}
+
+		/* Release the per-pixel state */
+		m_pixels.reset();
+		m_gridCounts.reset();
+		m_gridEntries.clear();
+		m_gridEntries.shrink_to_fit();
+		return true;
+	}
+
+	Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const {
+		throw NoriException("SPPMIntegrator::Li(): the integrator renders progressively and "
+			"does not support per-sample radiance queries!");
+	}
+
+	std::string toString() const {
+		return tfm::format(
+			"SPPMIntegrator[\n"
+			"  iterations = %i,\n"
+			"  photonCount = %i,\n"
+			"  initialRadius = %f,\n"
+			"  alpha = %f,\n"
+			"  maxDepth = %i\n"
+			"]",
+			m_iterations, m_photonsPerIteration, m_initialRadius, m_alpha, m_maxDepth
+		);
+	}
+private:
+	/// Per-pixel state of the progressive estimate
+	struct SPPMPixel {
+		/* Visible point found by the most recent camera pass */
+		Point3f p;
+		Frame shFrame;
+		Vector3f wo;
+		const BSDF *bsdf = nullptr;
+		Color3f beta = Color3f(0.0f);
+
+		/* Radiance of directly visible emitters (summed over all iterations) */
+		Color3f ld = Color3f(0.0f);
+
+		/* Progressive density estimate */
+		float radius = 0.0f;
+		float n = 0.0f;
+		Color3f tau = Color3f(0.0f);
+
+		/* Photon statistics of the current iteration */
+		std::atomic<float> phi[3];
+		std::atomic<uint32_t> m;
+
+		SPPMPixel() : m(0) {
+			for (int i = 0; i < 3; ++i)
+				phi[i] = 0.0f;
+		}
+	};
+
+	/// Random number stream of the camera (0) or photon (1) pass of an iteration
+	uint64_t stream(int iteration, int pass) const {
+		return LowDiscrepancy::hash(m_seed, static_cast<uint64_t>(iteration), static_cast<uint64_t>(pass));
+	}
+
+	/// Trace one camera ray per pixel to the first diffuse surface
+	void cameraPass(const Scene *scene, int iteration) {
+		const Camera *camera = scene->getCamera();
+		const Vector2i &size = camera->getOutputSize();
+
+		tbb::parallel_for(tbb::blocked_range<int>(0, size.y()),
+			[&](const tbb::blocked_range<int> &range) {
+				for (int y = range.begin(); y != range.end(); ++y) {
+					for (int x = 0; x < size.x(); ++x) {
+						size_t index = static_cast<size_t>(y) * size.x() + x;
+						SPPMPixel &pixel = m_pixels[index];
+						pcg32 rng;
+						rng.seed(index, stream(iteration, 0));
+
+						Point2f pixelSample = Point2f((float) x, (float) y) + Point2f(rng.nextFloat(), rng.nextFloat());
+						Ray3f ray;
+						Color3f beta = camera->sampleRay(ray, pixelSample, Point2f(rng.nextFloat(), rng.nextFloat()));
+						pixel.beta = Color3f(0.0f);
+
+						for (int depth = 0; depth <= m_maxDepth; ++depth) {
+							Intersection its;
+							if (!scene->rayIntersect(ray, its))
+								break;
+							if (its.mesh->isEmitter())
+								pixel.ld += beta * its.mesh->getEmitter()->le();
+
+							const BSDF *bsdf = its.mesh->getBSDF();
+							Vector3f wo = its.shFrame.toLocal(-ray.d);
+							if (bsdf->isDiffuse()) {
+								pixel.p = its.p;
+								pixel.shFrame = its.shFrame;
+								pixel.wo = wo;
+								pixel.bsdf = bsdf;
+								pixel.beta = beta;
+								break;
+							}
+
+							BSDFQueryRecord bsdfQueryRecord(wo);
+							Color3f f = bsdf->sample(bsdfQueryRecord, Point2f(rng.nextFloat(), rng.nextFloat()));
+							if (f.isZero())
+								break;
+							beta *= f;
+							ray = Ray3f(its.p, its.shFrame.toWorld(bsdfQueryRecord.wo));
+						}
+					}
+				}
+			}
+		);
+	}
+
+	/// Grid cell containing the point \c p
+	Point3i gridCell(const Point3f &p) const {
+		Vector3f rel = (p - m_gridBounds.min) / m_gridCellSize;
+		return Point3i((int) std::floor(rel.x()), (int) std::floor(rel.y()), (int) std::floor(rel.z()));
+	}
+
+	/// Hash of a grid cell into the range [0, number of pixels)
+	size_t gridHash(const Point3i &c) const {
+		return static_cast<size_t>(
+			(static_cast<uint32_t>(c.x()) * 73856093u) ^
+			(static_cast<uint32_t>(c.y()) * 19349663u) ^
+			(static_cast<uint32_t>(c.z()) * 83492791u)) % m_pixelCount;
+	}
+
+	/// Invoke \c functor for every grid cell overlapped by the lookup sphere of \c pixel
+	template <typename Functor> void forEachCell(const SPPMPixel &pixel, Functor functor) const {
+		Point3i lo = gridCell(pixel.p - Vector3f(pixel.radius)),
+				hi = gridCell(pixel.p + Vector3f(pixel.radius));
+		for (int z = lo.z(); z <= hi.z(); ++z)
+			for (int y = lo.y(); y <= hi.y(); ++y)
+				for (int x = lo.x(); x <= hi.x(); ++x)
+					functor(gridHash(Point3i(x, y, z)));
+	}
+
+	/**
+	 * \brief Insert the visible points into a hashed uniform grid
+	 *
+	 * The grid is stored as a flat array of pixel indices sorted by hash
+	 * bucket (a counting sort), so its size only depends on the number of
+	 * pixels and on how many cells each lookup sphere overlaps.
+	 */
+	void buildGrid() {
+		m_gridBounds.reset();
+		float maxRadius = 0.0f;
+		for (size_t i = 0; i < m_pixelCount; ++i) {
+			const SPPMPixel &pixel = m_pixels[i];
+			if (pixel.beta.isZero())
+				continue;
+			m_gridBounds.expandBy(pixel.p - Vector3f(pixel.radius));
+			m_gridBounds.expandBy(pixel.p + Vector3f(pixel.radius));
+			maxRadius = std::max(maxRadius, pixel.radius);
+		}
+		m_gridCellSize = 2.0f * maxRadius;
+
+		for (size_t i = 0; i <= m_pixelCount; ++i)
+			m_gridCounts[i].store(0, std::memory_order_relaxed);
+		m_gridEntries.clear();
+		if (!m_gridBounds.isValid())
+			return;
+
+		auto forEachVisiblePoint = [&](auto functor) {
+			tbb::parallel_for(tbb::blocked_range<size_t>(0, m_pixelCount),
+				[&](const tbb::blocked_range<size_t> &range) {
+					for (size_t i = range.begin(); i != range.end(); ++i) {
+						if (m_pixels[i].beta.isZero())
+							continue;
+						forEachCell(m_pixels[i], [&](size_t bucket) { functor(i, bucket); });
+					}
+				}
+			);
+		};
+
+		/* Count the entries of every bucket and turn the counts into offsets */
+		forEachVisiblePoint([&](size_t, size_t bucket) {
+			m_gridCounts[bucket + 1].fetch_add(1, std::memory_order_relaxed);
+		});
+		for (size_t i = 1; i <= m_pixelCount; ++i)
+			m_gridCounts[i].store(m_gridCounts[i].load(std::memory_order_relaxed) +
+				m_gridCounts[i - 1].load(std::memory_order_relaxed), std::memory_order_relaxed);
+		m_gridEntries.resize(m_gridCounts[m_pixelCount].load());
+
+		/* Fill the buckets, using the offsets as insertion cursors */
+		std::unique_ptr<std::atomic<uint32_t>[]> cursor(new std::atomic<uint32_t>[m_pixelCount]);
+		for (size_t i = 0; i < m_pixelCount; ++i)
+			cursor[i].store(m_gridCounts[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+		forEachVisiblePoint([&](size_t pixel, size_t bucket) {
+			m_gridEntries[cursor[bucket].fetch_add(1, std::memory_order_relaxed)] = static_cast<uint32_t>(pixel);
+		});
+	}
+
+	/// Trace photon paths and splat their power into nearby visible points
+	void photonPass(const Scene *scene, int iteration) {
+		if (m_gridEntries.empty())
+			return;
+		const std::vector<Mesh *> &emitters = scene->getEmitterMeshes();
+		const size_t chunkSize = 4096;
+		size_t chunkCount = (m_photonsPerIteration + chunkSize - 1) / chunkSize;
+
+		tbb::parallel_for(tbb::blocked_range<size_t>(0, chunkCount),
+			[&](const tbb::blocked_range<size_t> &range) {
+				for (size_t c = range.begin(); c != range.end(); ++c) {
+					pcg32 rng;
+					rng.seed(c, stream(iteration, 1));
+					size_t end = std::min((c + 1) * chunkSize, static_cast<size_t>(m_photonsPerIteration));
+					for (size_t i = c * chunkSize; i < end; ++i)
+						tracePhoton(scene, emitters, rng);
+				}
+			}
+		);
+	}
+
+	void tracePhoton(const Scene *scene, const std::vector<Mesh *> &emitters, pcg32 &rng) const {
+		size_t index = std::min(static_cast<size_t>(rng.nextFloat() * emitters.size()), emitters.size() - 1);
+		const Emitter *emitter = emitters[index]->getEmitter();
+
+		Point2f positionSample(rng.nextFloat(), rng.nextFloat());
+		SampleOnEmitter soe = emitter->sample(positionSample);
+		Frame frame(soe.normal);
+		Vector3f local = Warp::squareToCosineHemisphere(Point2f(rng.nextFloat(), rng.nextFloat()));
+
+		/* Le * cos / (pdf(emitter) * pdf(position) * cos / pi) */
+		Color3f power = emitter->le() * M_PI * static_cast<float>(emitters.size()) / soe.probabilityDensity;
+		Ray3f ray(soe.position, frame.toWorld(local));
+
+		for (int depth = 0; depth < m_maxDepth; ++depth) {
+			Intersection its;
+			if (!scene->rayIntersect(ray, its))
+				break;
+
+			const BSDF *bsdf = its.mesh->getBSDF();
+			Vector3f wi = -ray.d.normalized();
+			if (bsdf->isDiffuse()) {
+				Point3i cell = gridCell(its.p);
+				size_t bucket = gridHash(cell);
+				uint32_t begin = m_gridCounts[bucket].load(std::memory_order_relaxed),
+						 end = m_gridCounts[bucket + 1].load(std::memory_order_relaxed);
+				for (uint32_t e = begin; e < end; ++e) {
+					SPPMPixel &pixel = m_pixels[m_gridEntries[e]];
+					if ((pixel.p - its.p).squaredNorm() > pixel.radius * pixel.radius)
+						continue;
+					BSDFQueryRecord bsdfQueryRecord(pixel.shFrame.toLocal(wi), pixel.wo, ESolidAngle);
+					Color3f phi = pixel.bsdf->eval(bsdfQueryRecord) * power;
+					for (int k = 0; k < 3; ++k)
+						atomicAdd(pixel.phi[k], phi[k]);
+					pixel.m.fetch_add(1, std::memory_order_relaxed);
+				}
+			}
+
+			BSDFQueryRecord bsdfQueryRecord(its.shFrame.toLocal(wi));
+			Color3f f = bsdf->sample(bsdfQueryRecord, Point2f(rng.nextFloat(), rng.nextFloat()));
+			if (f.isZero())
+				break;
+
+			/* Russian roulette based on the throughput of the bounce */
+			float q = 1.0f;
+			if (depth >= 3) {
+				q = std::min(f.maxCoeff(), 0.95f);
+				if (rng.nextFloat() >= q)
+					break;
+			}
+			power *= f / q;
+			ray = Ray3f(its.p, its.shFrame.toWorld(bsdfQueryRecord.wo));
+		}
+	}
+
+	/// Shrink the radii and fold the photons of this iteration into the estimate
+	void updatePixels() {
+		tbb::parallel_for(tbb::blocked_range<size_t>(0, m_pixelCount),
+			[&](const tbb::blocked_range<size_t> &range) {
+				for (size_t i = range.begin(); i != range.end(); ++i) {
+					SPPMPixel &pixel = m_pixels[i];
+					uint32_t m = pixel.m.load(std::memory_order_relaxed);
+					if (m > 0) {
+						float n = pixel.n + m_alpha * m;
+						float radius = pixel.radius * std::sqrt(n / (pixel.n + m));
+						Color3f phi(pixel.phi[0].load(std::memory_order_relaxed),
+							pixel.phi[1].load(std::memory_order_relaxed),
+							pixel.phi[2].load(std::memory_order_relaxed));
+						pixel.tau = (pixel.tau + pixel.beta * phi) *
+							(radius * radius) / (pixel.radius * pixel.radius);
+						pixel.n = n;
+						pixel.radius = radius;
+					}
+					pixel.m.store(0, std::memory_order_relaxed);
+					for (int k = 0; k < 3; ++k)
+						pixel.phi[k].store(0.0f, std::memory_order_relaxed);
+				}
+			}
+		);
+	}
+
+	/// Replace the contents of \c result by the current estimate
+	void writeImage(ImageBlock &result, const Vector2i &size, int iterations) const {
+		int border = result.getBorderSize();
+		float photons = static_cast<float>(iterations) * m_photonsPerIteration;
+
+		result.lock();
+		for (int y = 0; y < size.y(); ++y) {
+			for (int x = 0; x < size.x(); ++x) {
+				const SPPMPixel &pixel = m_pixels[static_cast<size_t>(y) * size.x() + x];
+				Color3f l = pixel.ld / static_cast<float>(iterations) +
+					pixel.tau / (photons * M_PI * pixel.radius * pixel.radius);
+				result.coeffRef(y + border, x + border) << l, 1.0f;
+			}
+		}
+		result.unlock();
+	}
+
+	int m_iterations;
+	int m_photonsPerIteration;
+	float m_initialRadius;
+	float m_alpha;
+	int m_maxDepth;
+
+	/// Seed of the scene's sampler, which decorrelates different renderings
+	uint32_t m_seed = 0;
+	size_t m_pixelCount = 0;
+	std::unique_ptr<SPPMPixel[]> m_pixels;
+	BoundingBox3f m_gridBounds;
+	float m_gridCellSize = 0.0f;
+	std::unique_ptr<std::atomic<uint32_t>[]> m_gridCounts;
+	std::vector<uint32_t> m_gridEntries;
+};
+
+NORI_REGISTER_CLASS(SPPMIntegrator, "sppm")
+NORI_NAMESPACE_END
@@ -0,0 +1,202 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/tilewriter.h>
+#include <nori/bbox.h>
+#include <nori/rfilter.h>
+#include <nori/bitmap.h>
+#include <ImfTiledOutputFile.h>
+#include <ImfChannelList.h>
+#include <ImfStringAttribute.h>
+
+NORI_NAMESPACE_BEGIN
+
+TileWriter::TileWriter(const std::string &filename, const Vector2i &size, int tileSize,
+        const ReconstructionFilter *filter, const std::vector<AOVBuffer::EType> &aovs,
+        const EXRSettings &settings)
+    : m_size(size), m_tileSize(tileSize), m_aovs(aovs) {
+    if (tileSize <= 0)
+        throw NoriException("TileWriter: the tile size must be positive!");
+
+    /* Same border as the blocks allocated by ImageBlock */
+    m_borderSize = filter ? (int) std::ceil(filter->getRadius() - 0.5f) : 0;
+    m_reach = (m_borderSize + tileSize - 1) / tileSize;
+    m_numTiles = Vector2i(
+        (size.x() + tileSize - 1) / tileSize,
+        (size.y() + tileSize - 1) / tileSize);
+    m_tiles.resize((size_t) m_numTiles.x() * m_numTiles.y());
+
+    cout << "Streaming a " << size.x() << "x" << size.y()
+         << " tiled OpenEXR file to \"" << filename << "\"" << endl;
+
+    Imf::Header header(size.x(), size.y());
+    header.insert("comments", Imf::StringAttribute("Generated by Nori"));
+    header.compression() = (Imf::Compression) settings.compression;
+    header.setTileDescription(Imf::TileDescription(tileSize, tileSize, Imf::ONE_LEVEL));
+    /* Tiles are written in the order in which they are finished */
+    header.lineOrder() = Imf::RANDOM_Y;
+
+    /* Mesh IDs and sample counts would lose precision as halfs */
+    Imf::PixelType type = settings.half ? Imf::HALF : Imf::FLOAT;
+    Imf::ChannelList &channels = header.channels();
+    channels.insert("R", Imf::Channel(type));
+    channels.insert("G", Imf::Channel(type));
+    channels.insert("B", Imf::Channel(type));
+    for (const std::string &name : AOVBuffer(Vector2i(0, 0), aovs).getChannelNames()) {
+        bool exact = endsWith(name, ".ID") || endsWith(name, ".N");
+        channels.insert(name, Imf::Channel(exact ? Imf::FLOAT : type));
+    }
+
+    m_file.reset(new Imf::TiledOutputFile(filename.c_str(), header));
+}
+
+TileWriter::~TileWriter() { }
+
+BoundingBox2i TileWriter::getTileBounds(const Point2i &tile) const {
+    Point2i min = tile * m_tileSize;
+    Point2i max = (min + Vector2i(m_tileSize)).cwiseMin(m_size) - Vector2i(1);
+    return BoundingBox2i(min, max);
+}
+
+bool TileWriter::isReady(const Point2i &tile) const {
+    for (int y = std::max(tile.y() - m_reach, 0); y <= std::min(tile.y() + m_reach, m_numTiles.y() - 1); ++y) {
+        for (int x = std::max(tile.x() - m_reach, 0); x <= std::min(tile.x() + m_reach, m_numTiles.x() - 1); ++x) {
+            const Tile &neighbor = m_tiles[(size_t) y * m_numTiles.x() + x];
+            Vector2i extents = getTileBounds(Point2i(x, y)).getExtents() + Vector2i(1);
+            if (neighbor.renderedPixels != extents.x() * extents.y())
+                return false;
+        }
+    }
+    return true;
+}
+
+void TileWriter::put(const ImageBlock &block) {
+    int border = block.getBorderSize();
+    Point2i offset = block.getOffset();
+    Vector2i size = block.getSize();
+    Point2i owner(offset.x() / m_tileSize, offset.y() / m_tileSize);
+
+    if (border != m_borderSize)
+        throw NoriException("TileWriter: the block has an unexpected border size!");
+    if ((offset.x() + size.x() - 1) / m_tileSize != owner.x() ||
+        (offset.y() + size.y() - 1) / m_tileSize != owner.y())
+        throw NoriException("TileWriter: the block %s spans several tiles!", block.toString());
+
+    /* Pixels of the block (including the border) that lie within the image */
+    BoundingBox2i extent(offset - Vector2i(border), offset + size + Vector2i(border - 1));
+    extent.clip(BoundingBox2i(Point2i(0, 0), Point2i(m_size - Vector2i(1))));
+
+    std::vector<std::pair<Point2i, std::unique_ptr<ImageBlock>>> finished;
+    {
+        tbb::mutex::scoped_lock lock(m_mutex);
+
+        /* Add the block to every tile it reaches into */
+        for (int y = extent.min.y() / m_tileSize; y <= extent.max.y() / m_tileSize; ++y) {
+            for (int x = extent.min.x() / m_tileSize; x <= extent.max.x() / m_tileSize; ++x) {
+                Tile &tile = m_tiles[(size_t) y * m_numTiles.x() + x];
+                BoundingBox2i bounds = getTileBounds(Point2i(x, y));
+                if (tile.written)
+                    throw NoriException("TileWriter: tile (%i, %i) has already been written!", x, y);
+                if (!tile.pixels) {
+                    tile.pixels.reset(new ImageBlock(Vector2i(m_tileSize), nullptr));
+                    tile.pixels->setOffset(bounds.min);
+                    tile.pixels->setSize(bounds.getExtents() + Vector2i(1));
+                    tile.pixels->setAOVs(m_aovs);
+                    tile.pixels->clear();
+                }
+
+                BoundingBox2i region(bounds);
+                region.clip(extent);
+                Vector2i extents = region.getExtents() + Vector2i(1);
+                tile.pixels->block(region.min.y() - bounds.min.y(), region.min.x() - bounds.min.x(),
+                        extents.y(), extents.x()) +=
+                    block.block(region.min.y() - offset.y() + border, region.min.x() - offset.x() + border,
+                        extents.y(), extents.x());
+            }
+        }
+
+        Tile &tile = m_tiles[(size_t) owner.y() * m_numTiles.x() + owner.x()];
+        if (tile.pixels->getAOVs() && block.getAOVs())
+            tile.pixels->getAOVs()->put(*block.getAOVs(), offset - tile.pixels->getOffset(), size);
+        tile.renderedPixels += size.x() * size.y();
+
+        /* Collect the tiles that can't receive any further contributions */
+        for (int y = std::max(owner.y() - m_reach, 0); y <= std::min(owner.y() + m_reach, m_numTiles.y() - 1); ++y) {
+            for (int x = std::max(owner.x() - m_reach, 0); x <= std::min(owner.x() + m_reach, m_numTiles.x() - 1); ++x) {
+                Tile &neighbor = m_tiles[(size_t) y * m_numTiles.x() + x];
+                if (!neighbor.written && isReady(Point2i(x, y))) {
+                    neighbor.written = true;
+                    finished.emplace_back(Point2i(x, y), std::move(neighbor.pixels));
+                }
+            }
+        }
+    }
+
+    /* Compress and write the tiles without blocking other threads */
+    for (auto &entry : finished)
+        writeTile(entry.first, *entry.second);
+}
+
+void TileWriter::writeTile(const Point2i &tile, const ImageBlock &pixels) {
+    Vector2i size = pixels.getSize();
+    size_t pixelCount = (size_t) m_tileSize * m_tileSize;
+
+    std::vector<float> rgb(3 * pixelCount);
+    for (int y=0; y<size.y(); ++y) {
+        for (int x=0; x<size.x(); ++x) {
+            Color3f value = pixels.coeff(y, x).divideByFilterWeight();
+            std::copy(value.data(), value.data() + 3, &rgb[3 * ((size_t) y * m_tileSize + x)]);
+        }
+    }
+
+    /* The slices use coordinates relative to the tile */
+    Imf::FrameBuffer frameBuffer;
+    size_t compStride = sizeof(float),
+           pixelStride = 3 * compStride,
+           rowStride = pixelStride * m_tileSize;
+    char *ptr = reinterpret_cast<char *>(rgb.data());
+    frameBuffer.insert("R", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride, 1, 1, 0.0, true, true)); ptr += compStride;
+    frameBuffer.insert("G", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride, 1, 1, 0.0, true, true)); ptr += compStride;
+    frameBuffer.insert("B", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride, 1, 1, 0.0, true, true));
+
+    std::vector<float> planes;
+    if (pixels.getAOVs()) {
+        std::vector<std::string> names = pixels.getAOVs()->getChannelNames();
+        planes = pixels.getAOVs()->resolve();
+        for (size_t i=0; i<names.size(); ++i)
+            frameBuffer.insert(names[i], Imf::Slice(Imf::FLOAT,
+                reinterpret_cast<char *>(planes.data() + i * pixelCount),
+                compStride, compStride * m_tileSize, 1, 1, 0.0, true, true));
+    }
+
+    tbb::mutex::scoped_lock lock(m_fileMutex);
+    m_file->setFrameBuffer(frameBuffer);
+    m_file->writeTile(tile.x(), tile.y());
+}
+
+void TileWriter::finish() {
+    tbb::mutex::scoped_lock lock(m_mutex);
+    size_t missing = 0;
+    for (const Tile &tile : m_tiles)
+        if (!tile.written)
+            missing++;
+    if (missing > 0)
+        throw NoriException("TileWriter: %i tiles have not been rendered completely!", missing);
+}
+
+NORI_NAMESPACE_END
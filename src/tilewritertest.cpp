@@ -0,0 +1,217 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/tilewriter.h>
+#include <nori/render.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/integrator.h>
+#include <nori/bitmap.h>
+#include <ImfInputFile.h>
+#include <ImfChannelList.h>
+#include <cstdio>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Consistency test of streamed tiled OpenEXR files
+ *
+ * Renders every camera of a scene with all output variables into an
+ * image block and streams it into a tiled OpenEXR file (like "nori
+ * --stream"), once for each of the given block sizes. The file is read
+ * back and must contain the same image and output variables. Image
+ * sizes that aren't a multiple of the block size yield partial tiles
+ * along the right and bottom edges, and filters whose border exceeds
+ * the block size reach into several neighboring tiles.
+ */
+class TileWriterTest : public NoriObject {
+public:
+    TileWriterTest(const PropertyList &propList) {
+        /* Temporary file that receives the tiles */
+        m_filename = propList.getString("filename", "tilewritertest.exr");
+
+        /* Block (i.e. tile) sizes of the renders */
+        std::vector<std::string> blockSizes = tokenize(propList.getString("blockSizes", "3, 16"));
+        for (auto blockSize : blockSizes)
+            m_blockSizes.push_back(toInt(blockSize));
+
+        for (int i=0; i<AOVBuffer::ETypeCount; ++i)
+            m_aovs.push_back((AOVBuffer::EType) i);
+    }
+
+    virtual ~TileWriterTest() {
+        delete m_scene;
+    }
+
+    void addChild(NoriObject *obj) {
+        switch (obj->getClassType()) {
+            case EScene:
+                if (m_scene)
+                    throw NoriException("TileWriterTest: tried to register multiple scenes!");
+                m_scene = static_cast<Scene *>(obj);
+                break;
+
+            default:
+                throw NoriException("TileWriterTest::addChild(<%s>) is not supported!",
+                    classTypeName(obj->getClassType()));
+        }
+    }
+
+    /// Run the tests
+    void activate() {
+        if (!m_scene)
+            throw NoriException("TileWriterTest: a scene is required!");
+
+        m_scene->getIntegrator()->preprocess(m_scene);
+
+        int total = 0, passed = 0;
+
+        for (size_t i=0; i<m_scene->getCameras().size(); ++i) {
+            /* The tile writer renders the active camera */
+            m_scene->selectCamera(i);
+            for (int blockSize : m_blockSizes) {
+                cout << "------------------------------------------------------" << endl;
+                cout << "Testing camera " << i << " with " << blockSize << "x" << blockSize
+                     << " tiles .. " << endl;
+                ++total;
+                if (testStream(blockSize))
+                    ++passed;
+            }
+        }
+        m_scene->selectCamera(0);
+
+        cout << "Passed " << passed << "/" << total << " tests." << endl;
+        if (passed < total)
+            throw std::runtime_error("Some tests failed :(");
+    }
+
+    std::string toString() const {
+        std::string blockSizes;
+        for (size_t i=0; i<m_blockSizes.size(); ++i)
+            blockSizes += (i > 0 ? ", " : "") + std::to_string(m_blockSizes[i]);
+        return tfm::format(
+            "TileWriterTest[\n"
+            "  filename = \"%s\",\n"
+            "  blockSizes = {%s}\n"
+            "]",
+            m_filename,
+            blockSizes
+        );
+    }
+
+    EClassType getClassType() const { return ETest; }
+private:
+    /// Render the active camera into an image block and a tiled file and compare them
+    bool testStream(int blockSize) {
+        const Camera *camera = m_scene->getCamera();
+        const ReconstructionFilter *filter = camera->getReconstructionFilter();
+        Vector2i size = camera->getOutputSize();
+        size_t pixelCount = (size_t) size.x() * size.y();
+
+        RenderSettings settings;
+        settings.blockSize = blockSize;
+        settings.aovs = m_aovs;
+
+        ImageBlock block(size, filter);
+        block.clear();
+        Renderer(m_scene, block, settings).render();
+        cout << "Image " << size.x() << "x" << size.y() << ", border "
+             << block.getBorderSize() << endl;
+        std::unique_ptr<Bitmap> reference(block.toBitmap());
+        std::vector<std::string> names = block.getAOVs()->getChannelNames();
+        std::vector<float> referencePlanes = block.getAOVs()->resolve();
+
+        {
+            TileWriter writer(m_filename, size, blockSize, filter, m_aovs, EXRSettings());
+            Renderer(m_scene, writer, settings).render();
+            writer.finish();
+        }
+
+        Imf::InputFile file(m_filename.c_str());
+        Imath::Box2i dataWindow = file.header().dataWindow();
+        bool success = true;
+        if (dataWindow.min.x != 0 || dataWindow.min.y != 0 ||
+            dataWindow.max.x != size.x() - 1 || dataWindow.max.y != size.y() - 1) {
+            cout << "The file has an unexpected data window!" << endl;
+            std::remove(m_filename.c_str());
+            return false;
+        }
+
+        std::vector<float> rgb(3 * pixelCount), planes(names.size() * pixelCount);
+        Imf::FrameBuffer frameBuffer;
+        size_t compStride = sizeof(float),
+               pixelStride = 3 * compStride,
+               rowStride = pixelStride * size.x();
+        char *ptr = reinterpret_cast<char *>(rgb.data());
+        frameBuffer.insert("R", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride)); ptr += compStride;
+        frameBuffer.insert("G", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride)); ptr += compStride;
+        frameBuffer.insert("B", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride));
+        for (size_t i=0; i<names.size(); ++i) {
+            if (!file.header().channels().findChannel(names[i].c_str())) {
+                cout << "The channel \"" << names[i] << "\" is missing!" << endl;
+                success = false;
+            }
+            frameBuffer.insert(names[i], Imf::Slice(Imf::FLOAT,
+                reinterpret_cast<char *>(planes.data() + i * pixelCount),
+                compStride, compStride * size.x()));
+        }
+        file.setFrameBuffer(frameBuffer);
+        file.readPixels(dataWindow.min.y, dataWindow.max.y);
+        std::remove(m_filename.c_str());
+
+        /* The borders of the blocks are summed in a different order */
+        int errors = 0;
+        for (int y=0; y<size.y(); ++y) {
+            for (int x=0; x<size.x(); ++x) {
+                const Color3f &a = reference->coeff(y, x);
+                const float *b = &rgb[3 * ((size_t) y * size.x() + x)];
+                float tolerance = 1e-4f * std::max(1.0f, a.maxCoeff());
+                if ((std::abs(a.r() - b[0]) > tolerance || std::abs(a.g() - b[1]) > tolerance ||
+                     std::abs(a.b() - b[2]) > tolerance) && errors++ < 5)
+                    cout << "Pixel (" << x << ", " << y << "): expected " << a.toString()
+                         << ", got [" << b[0] << ", " << b[1] << ", " << b[2] << "]" << endl;
+            }
+        }
+
+        /* Every pixel of the output variables is written by a single block */
+        for (size_t i=0; i<names.size(); ++i) {
+            for (size_t j=0; j<pixelCount; ++j) {
+                float a = referencePlanes[i * pixelCount + j], b = planes[i * pixelCount + j];
+                if (a != b && errors++ < 5)
+                    cout << "Channel \"" << names[i] << "\" of pixel (" << j % size.x() << ", "
+                         << j / size.x() << "): expected " << a << ", got " << b << endl;
+            }
+        }
+
+        if (errors > 0) {
+            cout << errors << " values differ!" << endl;
+            success = false;
+        }
+        cout << (success ? "Accepted the streamed image." : "Rejected the streamed image.") << endl;
+        return success;
+    }
+
+    std::string m_filename;
+    std::vector<int> m_blockSizes;
+    std::vector<AOVBuffer::EType> m_aovs;
+    Scene *m_scene = nullptr;
+};
+
+NORI_REGISTER_CLASS(TileWriterTest, "tilewritertest");
+NORI_NAMESPACE_END
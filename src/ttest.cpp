@@ -21,6 +21,7 @@
 #include <nori/camera.h>
 #include <nori/integrator.h>
 #include <nori/sampler.h>
+#include <nori/render.h>
 #include <hypothesis.h>
 #include <pcg32.h>
 
@@ -54,6 +55,18 @@ NORI_NAMESPACE_BEGIN
  *
  * 2. that the average radiance received by a camera within some scene
  *    matches a given value (modulo noise).
+ *
+ * Integrators that require the full image (e.g. bidirectional path tracing)
+ * can't be queried ray by ray. Their scenes (and all scenes when the
+ * "renderImage" parameter is set) are rendered instead, and the pixel values
+ * of the image are used as samples. The reference value should then be the
+ * same for all pixels, and the number of samples equals the number of pixels.
+ *
+ * The pixels are only independent samples if the integrator doesn't share
+ * any random state between them. Photon mapping methods use the same photons
+ * in all pixels, for instance. The "runs" parameter then renders the image
+ * several times with different seeds (repeating the preprocessing step), and
+ * the average of each image is one sample.
  */
 class StudentsTTest : public NoriObject {
 public:
@@ -74,6 +87,14 @@ public:
 
         /* Number of BSDF samples that should be generated (default: 100K) */
         m_sampleCount = propList.getInteger("sampleCount", 100000);
+
+        /* Test the pixels of rendered images instead of individual paths */
+        m_renderImage = propList.getBoolean("renderImage", false);
+
+        /* Number of independently seeded images (each image is one sample) */
+        m_runs = propList.getInteger("runs", 1);
+        if (m_runs < 1)
+            throw NoriException("StudentsTTest: \"runs\" must be positive!");
     }
 
     virtual ~StudentsTTest() {
@@ -153,7 +174,7 @@ public:
 
             int ctr = 0;
             for (auto scene : m_scenes) {
-                const Integrator *integrator = scene->getIntegrator();
+                Integrator *integrator = scene->getIntegrator();
                 const Camera *camera = scene->getCamera();
                 float reference = m_references[ctr++];
 
@@ -161,31 +182,84 @@ public:
                 cout << "Testing scene: " << scene->toString() << endl;
                 ++total;
 
-                cout << "Generating " << m_sampleCount << " paths.. " << endl;
-
                 double mean = 0, variance = 0;
-                for (int k=0; k<m_sampleCount; ++k) {
-                    /* Sample a ray from the camera */
-                    Ray3f ray;
-                    Point2f pixelSample = (sampler->next2D().array()
-                        * camera->getOutputSize().cast<float>().array()).matrix();
-                    Color3f value = camera->sampleRay(ray, pixelSample, sampler->next2D());
-
-                    /* Compute the incident radiance */
-                    value *= integrator->Li(scene, sampler, ray);
-
-                    /* Numerically robust online variance estimation using an
-                       algorithm proposed by Donald Knuth (TAOCP vol.2, 3rd ed., p.232) */
-                    double result = (double) value.getLuminance();
-                    double delta = result - mean;
-                    mean += delta / (double) (k+1);
-                    variance += delta * (result - mean);
+                int sampleCount = m_sampleCount;
+                if (m_runs > 1) {
+                    Vector2i size = camera->getOutputSize();
+                    sampleCount = m_runs;
+                    cout << "Rendering " << m_runs << " independent images.. " << endl;
+
+                    Sampler *sceneSampler = scene->getSampler();
+                    uint32_t seed = sceneSampler->getSeed();
+                    for (int k=0; k<m_runs; ++k) {
+                        sceneSampler->setSeed(seed + (uint32_t) k);
+                        integrator->preprocess(scene);
+
+                        ImageBlock block(size, camera->getReconstructionFilter());
+                        block.clear();
+                        Renderer(scene, block, RenderSettings()).render();
+
+                        double imageMean = 0;
+                        for (int y=0; y<size.y(); ++y)
+                            for (int x=0; x<size.x(); ++x)
+                                imageMean += (double) block.coeff(y + block.getBorderSize(),
+                                    x + block.getBorderSize()).divideByFilterWeight().getLuminance();
+                        double result = imageMean / ((double) size.x() * size.y());
+                        double delta = result - mean;
+                        mean += delta / (double) (k+1);
+                        variance += delta * (result - mean);
+                    }
+                    sceneSampler->setSeed(seed);
+                } else if (m_renderImage || integrator->requiresFullImage()) {
+                    Vector2i size = camera->getOutputSize();
+                    sampleCount = size.x() * size.y();
+                    cout << "Rendering " << sampleCount << " pixels.. " << endl;
+
+                    integrator->preprocess(scene);
+                    ImageBlock block(size, camera->getReconstructionFilter());
+                    block.clear();
+                    Renderer renderer(scene, block, RenderSettings());
+                    renderer.render();
+
+                    int k = 0;
+                    for (int y=0; y<size.y(); ++y) {
+                        for (int x=0; x<size.x(); ++x) {
+                            Color3f value = block.coeff(y + block.getBorderSize(),
+                                x + block.getBorderSize()).divideByFilterWeight();
+                            double result = (double) value.getLuminance();
+                            double delta = result - mean;
+                            mean += delta / (double) (k+1);
+                            variance += delta * (result - mean);
+                            ++k;
+                        }
+                    }
+                } else {
+                    integrator->preprocess(scene);
+                    cout << "Generating " << m_sampleCount << " paths.. " << endl;
+
+                    for (int k=0; k<m_sampleCount; ++k) {
+                        /* Sample a ray from the camera */
+                        Ray3f ray;
+                        Point2f pixelSample = (sampler->next2D().array()
+                            * camera->getOutputSize().cast<float>().array()).matrix();
+                        Color3f value = camera->sampleRay(ray, pixelSample, sampler->next2D());
+
+                        /* Compute the incident radiance */
+                        value *= integrator->Li(scene, sampler, ray);
+
+                        /* Numerically robust online variance estimation using an
+                           algorithm proposed by Donald Knuth (TAOCP vol.2, 3rd ed., p.232) */
+                        double result = (double) value.getLuminance();
+                        double delta = result - mean;
+                        mean += delta / (double) (k+1);
+                        variance += delta * (result - mean);
+                    }
                 }
-                variance /= m_sampleCount - 1;
+                variance /= sampleCount - 1;
 
                 std::pair<bool, std::string>
                     result = hypothesis::students_t_test(mean, variance, reference,
-                        m_sampleCount, m_significanceLevel, (int) m_references.size());
+                        sampleCount, m_significanceLevel, (int) m_references.size());
 
                 if (result.first)
                     ++passed;
@@ -201,10 +275,14 @@ public:
         return tfm::format(
             "StudentsTTest[\n"
             "  significanceLevel = %f,\n"
-            "  sampleCount= %i\n"
+            "  sampleCount= %i,\n"
+            "  renderImage = %s,\n"
+            "  runs = %i\n"
             "]",
             m_significanceLevel,
-            m_sampleCount
+            m_sampleCount,
+            m_renderImage ? "yes" : "no",
+            m_runs
         );
     }
 
@@ -216,6 +294,8 @@ private:
     std::vector<float> m_references;
     float m_significanceLevel;
     int m_sampleCount;
+    bool m_renderImage;
+    int m_runs;
 };
 
 NORI_REGISTER_CLASS(StudentsTTest, "ttest");
@@ -3,6 +3,7 @@
 #include <nori/sampler.h>
 #include <nori/emitter.h>
 #include <nori/bsdf.h>
+#include <nori/aov.h>
 
 NORI_NAMESPACE_BEGIN
 
@@ -11,9 +12,19 @@ public:
 	WhittedIntegrator(const PropertyList &props) {}
 
 	Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const {
+		return Li(scene, sampler, ray, nullptr);
+	}
+
+	Color3f LiAOV(const Scene *scene, Sampler *sampler, const Ray3f &ray, AOVRecord &record) const {
+		return Li(scene, sampler, ray, &record);
+	}
+
+	Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray, AOVRecord *record) const {
 		Intersection its;
 		if (!scene->rayIntersect(ray, its))
 			return Color3f(0.0f);
+		if (record)
+			record->setSurface(its);
 
 		Color3f li(0.0f);
 		if (its.mesh->isEmitter()) {